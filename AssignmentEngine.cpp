@@ -0,0 +1,160 @@
+﻿#include "assignmentEngine.h"
+
+using namespace std;
+
+/**
+ * Создать задачу о назначениях без рёбер
+ * \param[in] rowsCount Количество строк
+ * \param[in] colsCount Количество столбцов
+ */
+SparseAssignment::SparseAssignment(int rowsCount, int colsCount)
+{
+	this->rowsCount = rowsCount;
+	this->colsCount = colsCount;
+	this->edges.resize(rowsCount);
+	this->totalCost = 0;
+}
+
+/**
+ * Добавить допустимое ребро
+ * \param[in] row Строка
+ * \param[in] col Столбец
+ * \param[in] cost Неотрицательная стоимость назначения
+ */
+void SparseAssignment::addEdge(int row, int col, long long cost)
+{
+	this->edges[row].push_back({ col, cost });
+}
+
+/**
+ * Найти назначение минимальной стоимости, покрывающее все строки.
+ * Кратчайшие увеличивающие пути ищутся алгоритмом Дейкстры по приведённым стоимостям,
+ * поэтому для разреженных задач (и одинаковых строк) каждая строка обходит лишь несколько рёбер
+ * \return Существует ли назначение, покрывающее все строки
+ */
+bool SparseAssignment::solve()
+{
+	rowPotentials.assign(rowsCount, 0);
+	colPotentials.assign(colsCount, 0);
+	colOfRow.assign(rowsCount, -1);
+	rowOfCol.assign(colsCount, -1);
+	colDistances.assign(colsCount, numeric_limits<long long>::max());
+	prevRow.assign(colsCount, -1);
+	finished.assign(colsCount, false);
+	totalCost = 0;
+
+	if (rowsCount > colsCount)
+		return false;
+
+	for (int row = 0; row < rowsCount; row++) {
+		if (!augment(row))
+			return false;
+	}
+
+	for (int row = 0; row < rowsCount; row++) {
+		for (const auto& edge : edges[row]) {
+			if (edge.col == colOfRow[row]) {
+				totalCost += edge.cost;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Назначить свободную строку, перестроив кратчайший увеличивающий путь
+ * \param[in] startRow Свободная строка
+ * \return Найден ли увеличивающий путь
+ */
+bool SparseAssignment::augment(int startRow)
+{
+	vector<int> finishedCols;
+	vector<int> touchedCols;
+	priority_queue<pair<long long, int>, vector<pair<long long, int>>, greater<pair<long long, int>>> queue;
+
+	auto relax = [&](int row, long long rowDistance) {
+		for (const auto& edge : edges[row]) {
+			if (finished[edge.col])
+				continue;
+			long long distance = rowDistance + edge.cost - rowPotentials[row] - colPotentials[edge.col];
+			if (distance < colDistances[edge.col]) {
+				if (prevRow[edge.col] == -1)
+					touchedCols.push_back(edge.col);
+				colDistances[edge.col] = distance;
+				prevRow[edge.col] = row;
+				queue.emplace(distance, edge.col);
+			}
+		}
+	};
+
+	relax(startRow, 0);
+	int freeCol = -1;
+	long long pathLength = 0;
+	while (!queue.empty()) {
+		auto top = queue.top();
+		queue.pop();
+		int col = top.second;
+		if (finished[col] || top.first != colDistances[col])
+			continue;
+
+		finished[col] = true;
+		finishedCols.push_back(col);
+		if (rowOfCol[col] == -1) {
+			freeCol = col;
+			pathLength = top.first;
+			break;
+		}
+		relax(rowOfCol[col], top.first);
+	}
+
+	// Рабочие массивы очищаются только в посещённых столбцах, чтобы шаг не зависел от общего числа столбцов
+	auto resetTouched = [&]() {
+		for (int col : touchedCols) {
+			colDistances[col] = numeric_limits<long long>::max();
+			prevRow[col] = -1;
+			finished[col] = false;
+		}
+	};
+
+	if (freeCol == -1) {
+		resetTouched();
+		return false;
+	}
+
+	// Обновить потенциалы, чтобы приведённые стоимости остались неотрицательными, а путь - нулевым
+	rowPotentials[startRow] += pathLength;
+	for (int col : finishedCols) {
+		if (col == freeCol)
+			continue;
+		long long shift = pathLength - colDistances[col];
+		colPotentials[col] -= shift;
+		rowPotentials[rowOfCol[col]] += shift;
+	}
+
+	// Перевернуть увеличивающий путь
+	for (int col = freeCol; col != -1;) {
+		int row = prevRow[col];
+		int nextCol = colOfRow[row];
+		colOfRow[row] = col;
+		rowOfCol[col] = row;
+		col = row == startRow ? -1 : nextCol;
+	}
+	resetTouched();
+	return true;
+}
+
+/**
+ * Столбец, назначенный строке
+ * \param[in] row Строка
+ * \return Столбец или -1, если задача не решена
+ */
+int SparseAssignment::getColumn(int row) const
+{
+	return colOfRow[row];
+}
+
+long long SparseAssignment::getCost() const
+{
+	return totalCost;
+}
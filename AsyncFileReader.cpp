@@ -0,0 +1,153 @@
+﻿#include "asyncFileReader.h"
+#include "searchStats.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+using namespace std;
+
+/**
+ * Начать чтение файла в отдельном потоке
+ * \param[in] path Путь к файлу
+ * \param[in] chunkSize Количество байт, читаемых за раз
+ */
+AsyncFileReader::AsyncFileReader(const string& path, size_t chunkSize)
+	: path(path), chunkSize(max<size_t>(chunkSize, 1))
+{
+	error_code sizeError;
+	uintmax_t fileSize = filesystem::file_size(path, sizeError);
+	this->capacity = sizeError ? 0 : (size_t)fileSize;
+	this->text = make_shared<string>(this->capacity, '\0');
+	this->buffer = this->text->data();
+	this->published = 0;
+	this->received = 0;
+	this->finished = false;
+	this->opened = false;
+	this->cancelled = false;
+	this->worker = thread(&AsyncFileReader::run, this);
+}
+
+/**
+ * Прекратить чтение, если оно ещё идёт, и дождаться потока чтения
+ */
+AsyncFileReader::~AsyncFileReader()
+{
+	this->cancelled = true;
+	if (this->worker.joinable())
+		this->worker.join();
+}
+
+/**
+ * Путь к читаемому файлу
+ * \return Путь
+ */
+const string& AsyncFileReader::getPath() const
+{
+	return this->path;
+}
+
+/**
+ * Дождаться, пока прочитанный текст станет длиннее заданного или чтение закончится
+ * \param[in] length Длина уже обработанного текста
+ * \return Длина прочитанного текста
+ */
+size_t AsyncFileReader::waitForText(size_t length)
+{
+	PhaseTimer timer(StatsPhase::FileRead);
+	unique_lock<mutex> guard(this->lock);
+	this->changed.wait(guard, [&] { return this->published > length || this->finished; });
+	return this->published;
+}
+
+/**
+ * Дождаться начала текста или конца чтения
+ * \return Логический флаг, что файл не удалось прочитать или текста в нём нет
+ */
+bool AsyncFileReader::isEmpty()
+{
+	PhaseTimer timer(StatsPhase::FileRead);
+	unique_lock<mutex> guard(this->lock);
+	this->changed.wait(guard, [&] { return this->received > 0 || this->finished; });
+	return this->received == 0;
+}
+
+/**
+ * Начало прочитанного текста. Пока файл читается, текст лежит в буфере, который не перевыделяется
+ * \param[in] length Длина, не превышающая результата waitForText
+ * \return Текст
+ */
+string_view AsyncFileReader::getText(size_t length) const
+{
+	return string_view(this->buffer, length);
+}
+
+/**
+ * Дождаться конца чтения
+ * \return Удалось ли открыть файл
+ */
+bool AsyncFileReader::wait()
+{
+	this->waitForText(SIZE_MAX);
+	if (this->worker.joinable())
+		this->worker.join();
+	return this->opened;
+}
+
+/**
+ * Весь текст файла. Буфер отдаётся узлам деревьев, которые ссылаются на имена в нём.
+ * Если файл вырос при чтении, текст дописывается в буфер, и тот может перевыделиться
+ * \return Текст
+ */
+shared_ptr<const string> AsyncFileReader::getContent()
+{
+	this->wait();
+	if (this->text->size() != this->published || !this->overflow.empty()) {
+		this->text->resize(this->published);
+		this->text->append(this->overflow);
+		this->overflow.clear();
+		this->buffer = this->text->data();
+		this->published = this->text->size();
+	}
+	return this->text;
+}
+
+/**
+ * Чтение файла частями в буфер с публикацией каждой прочитанной части
+ */
+void AsyncFileReader::run()
+{
+	ifstream in(this->path);
+	{
+		lock_guard<mutex> guard(this->lock);
+		this->opened = in.is_open();
+	}
+
+	size_t length = 0;
+	while (in && !this->cancelled) {
+		// Переводы строк выбрасываются сразу, поэтому прочитанное никогда не длиннее места под него
+		if (length < this->capacity) {
+			in.read(this->buffer + length, min(this->chunkSize, this->capacity - length));
+			char* begin = this->buffer + length;
+			length = remove(begin, begin + in.gcount(), '\n') - this->buffer;
+			lock_guard<mutex> guard(this->lock);
+			this->published = length;
+			this->received = length;
+		}
+		else {
+			string chunk(this->chunkSize, '\0');
+			in.read(chunk.data(), chunk.size());
+			chunk.resize(in.gcount());
+			chunk.erase(remove(chunk.begin(), chunk.end(), '\n'), chunk.end());
+			lock_guard<mutex> guard(this->lock);
+			this->overflow += chunk;
+			this->received += chunk.size();
+		}
+		this->changed.notify_all();
+	}
+
+	{
+		lock_guard<mutex> guard(this->lock);
+		this->finished = true;
+	}
+	this->changed.notify_all();
+}
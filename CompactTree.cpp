@@ -0,0 +1,99 @@
+﻿#include "compactTree.h"
+#include "searchStats.h"
+#include <type_traits>
+
+using namespace std;
+
+/**
+ * Уложить копию дерева в собственную арену. Дети каждого узла создаются подряд, после чего
+ * так же укладываются семейства детей, начиная с первого ребёнка; индексы детей по именам копируются
+ * из исходного дерева, где они уже построены
+ * \param[in] tree Главное дерево (nullptr - пустое дерево)
+ */
+template <class Label>
+BasicCompactTree<Label>::BasicCompactTree(const TreeNode* tree)
+	: arena(64 * 1024, StatsStructure::Nodes)
+{
+	if (tree == nullptr)
+		return;
+	PhaseTimer timer(StatsPhase::TreeBuilding);
+
+	// Текстовые метки переносятся в новый буфер; его объём известен заранее, поэтому буфер не перевыделяется
+	shared_ptr<string> text;
+	if constexpr (is_same_v<Label, TextLabel>) {
+		size_t textSize = 0;
+		vector<const TreeNode*> nodes{ tree };
+		while (!nodes.empty()) {
+			const TreeNode* node = nodes.back();
+			nodes.pop_back();
+			textSize += node->label.text.size();
+			for (auto child : node->getChildrenView())
+				nodes.push_back(child);
+		}
+		text = make_shared<string>();
+		text->reserve(textSize);
+	}
+	auto copyLabel = [&text](const TreeNode* node) {
+		if constexpr (is_same_v<Label, TextLabel>) {
+			size_t start = text->size();
+			text->append(node->label.text);
+			return TextLabel{ string_view(*text).substr(start, node->label.text.size()), text };
+		}
+		else {
+			return node->label;
+		}
+	};
+
+	PatchArena::NodeScope scope(this->arena);
+	this->root = make_unique<TreeNode>(copyLabel(tree));
+	vector<pair<const TreeNode*, TreeNode*>> families{ { tree, this->root.get() } };
+	while (!families.empty()) {
+		auto family = families.back();
+		families.pop_back();
+
+		TreeNode* copy = family.second;
+		copy->children.reserve(family.first->children.size());
+		for (auto child : family.first->getChildrenView()) {
+			copy->children.push_back(make_unique<TreeNode>(copyLabel(child)));
+			copy->children.back()->parent = copy;
+		}
+		copy->childrenByName = family.first->childrenByName;
+
+		for (size_t i = copy->children.size(); i > 0; i--)
+			families.emplace_back(family.first->children[i - 1].get(), copy->children[i - 1].get());
+	}
+}
+
+/**
+ * Освободить дерево: узлы удаляются вместе с ареной
+ */
+template <class Label>
+BasicCompactTree<Label>::~BasicCompactTree()
+{
+	PatchArena::NodeScope scope(this->arena);
+	this->root.reset();
+}
+
+/**
+ * Корень уложенного дерева
+ * \return Корень или nullptr, если дерево пусто
+ */
+template <class Label>
+const BasicNode<Label>* BasicCompactTree<Label>::getRoot() const
+{
+	return this->root.get();
+}
+
+/**
+ * Объём памяти, занятой узлами дерева
+ * \return Объём арены в байтах
+ */
+template <class Label>
+size_t BasicCompactTree<Label>::getCapacity() const
+{
+	return this->arena.getCapacity();
+}
+
+template class BasicCompactTree<TextLabel>;
+template class BasicCompactTree<uint32_t>;
+template class BasicCompactTree<InternedLabel>;
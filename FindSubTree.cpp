@@ -1,16 +1,216 @@
 ﻿#include "findSubTree.h"
+#include "treeEditDistance.h"
+#include "pqGramIndex.h"
+#include "assignmentEngine.h"
+#include "searchStats.h"
+#include "patchArena.h"
+#include "treeDag.h"
+#include "multiPatternSearch.h"
+#include "treeStream.h"
+#include "treeLayout.h"
+#include "matchEnumerator.h"
+#include "compactTree.h"
+#include "asyncFileReader.h"
+#include <atomic>
+#include <mutex>
 
 using namespace std;
 
 const string GRAPHVIZ_PATH = "dot";
 
+// Выдать новый номер изменения дерева. Номера только сравниваются на равенство, поэтому порядок между потоками не важен
+unsigned long long nextRevision()
+{
+	static atomic<unsigned long long> lastRevision{ 0 };
+	return lastRevision.fetch_add(1, memory_order_relaxed) + 1;
+}
+
+// Установить бит в битовом множестве, расширяя его при необходимости
+template <class Bits>
+static void setBit(Bits& bits, size_t index)
+{
+	if (bits.size() <= index / 64)
+		bits.resize(index / 64 + 1, 0);
+	bits[index / 64] |= 1ull << (index % 64);
+}
+
+// Узнать, установлен ли бит в битовом множестве
+template <class Bits>
+static bool testBit(const Bits& bits, size_t index)
+{
+	return index / 64 < bits.size() && (bits[index / 64] >> (index % 64) & 1);
+}
+
+/**
+ * Создать пустую интернированную метку
+ */
+InternedLabel::InternedLabel()
+{
+	static const string emptyText;
+	this->text = &emptyText;
+}
+
+/**
+ * Интернировать строку: одинаковые строки получают метки с одним и тем же адресом
+ * \param[in] text Текст метки
+ */
+InternedLabel::InternedLabel(string_view text)
+{
+	// Узлы unordered_set не перемещаются при росте таблицы, поэтому адреса строк постоянны.
+	// Пул общий для всех деревьев, поэтому деревья разных потоков пополняют его под блокировкой
+	static unordered_set<string> pool;
+	static mutex poolLock;
+	lock_guard<mutex> guard(poolLock);
+	this->text = &*pool.emplace(text).first;
+}
+
+const string& InternedLabel::str() const
+{
+	return *this->text;
+}
+
+bool InternedLabel::operator==(const InternedLabel& other) const
+{
+	return this->text == other.text;
+}
+
+bool InternedLabel::operator!=(const InternedLabel& other) const
+{
+	return this->text != other.text;
+}
+
+// Порядок интернированных меток - порядок их адресов, а не алфавитный
+bool InternedLabel::operator<(const InternedLabel& other) const
+{
+	return less<const string*>()(this->text, other.text);
+}
+
+string_view LabelTraits<TextLabel>::view(const TextLabel& label)
+{
+	return label.text;
+}
+
+TextLabel LabelTraits<TextLabel>::make(const string& name)
+{
+	auto buffer = make_shared<const string>(name);
+	return TextLabel{ *buffer, buffer };
+}
+
+TextLabel LabelTraits<TextLabel>::own(string_view label)
+{
+	auto buffer = make_shared<const string>(label);
+	return TextLabel{ *buffer, buffer };
+}
+
+string LabelTraits<TextLabel>::toString(const TextLabel& label)
+{
+	return string(label.text);
+}
+
+size_t LabelTraits<TextLabel>::hash(string_view label)
+{
+	return std::hash<string_view>()(label);
+}
+
+uint32_t LabelTraits<uint32_t>::view(uint32_t label)
+{
+	return label;
+}
+
+/**
+ * Числовая метка из текста
+ * \param[in] name Десятичная запись идентификатора
+ * \return Идентификатор
+ */
+uint32_t LabelTraits<uint32_t>::make(const string& name)
+{
+	return (uint32_t)stoul(name);
+}
+
+uint32_t LabelTraits<uint32_t>::own(uint32_t label)
+{
+	return label;
+}
+
+string LabelTraits<uint32_t>::toString(uint32_t label)
+{
+	return to_string(label);
+}
+
+size_t LabelTraits<uint32_t>::hash(uint32_t label)
+{
+	return std::hash<uint32_t>()(label);
+}
+
+InternedLabel LabelTraits<InternedLabel>::view(const InternedLabel& label)
+{
+	return label;
+}
+
+InternedLabel LabelTraits<InternedLabel>::make(const string& name)
+{
+	return InternedLabel(name);
+}
+
+InternedLabel LabelTraits<InternedLabel>::own(const InternedLabel& label)
+{
+	return label;
+}
+
+string LabelTraits<InternedLabel>::toString(const InternedLabel& label)
+{
+	return label.str();
+}
+
+size_t LabelTraits<InternedLabel>::hash(const InternedLabel& label)
+{
+	return std::hash<const string*>()(&label.str());
+}
+
 /**
  * Создать узел
  * \param[in] data Имя нового узла
  */
-Node::Node(const string& data)
+template <class Label>
+BasicNode<Label>::BasicNode(const string& data)
+	: BasicNode(LabelTraits<Label>::make(data))
+{
+}
+
+/**
+ * Создать узел с заданной меткой. Текстовая метка может указывать в общий буфер (например, во входной текст дерева)
+ * \param[in] label Метка нового узла
+ */
+template <class Label>
+BasicNode<Label>::BasicNode(const Label& label)
+{
+	this->label = label;
+	this->parent = nullptr;
+	this->preorderIndex = 0;
+	this->postorderIndex = 0;
+	this->numbering = 0;
+	this->revision = nextRevision();
+}
+
+template <class Label>
+void* BasicNode<Label>::operator new(size_t size)
+{
+	// Узлы плотно уложенного дерева создаются в его арене
+	PatchArena* arena = PatchArena::currentForNodes();
+	if (arena != nullptr)
+		return arena->allocate(size, alignof(BasicNode<Label>));
+	SearchStats::allocated(StatsStructure::Nodes, size);
+	return ::operator new(size);
+}
+
+template <class Label>
+void BasicNode<Label>::operator delete(void* pointer, size_t size)
 {
-	this->name = data;
+	PatchArena* arena = PatchArena::currentForNodes();
+	if (arena != nullptr && arena->owns(pointer))
+		return;
+	SearchStats::released(StatsStructure::Nodes, size);
+	::operator delete(pointer);
 }
 
 /**
@@ -18,54 +218,146 @@ Node::Node(const string& data)
  * \param[in] this Родительский узел
  * \param[in] newChild Новый ребёнок
  */
-Node* Node::addChild(unique_ptr<Node> newChild)
+template <class Label>
+BasicNode<Label>* BasicNode<Label>::addChild(unique_ptr<BasicNode<Label>> newChild)
 {
-	Node* addedChild = newChild.get();
+	BasicNode<Label>* addedChild = newChild.get();
+	addedChild->parent = this;
+	unsigned addedIndex = (unsigned)this->children.size();
 	this->children.push_back(move(newChild));
+
+	// Новый ребёнок встаёт после одноимённых; при добавлении детей по порядку имён вставка происходит в конец
+	if (this->children.size() <= 2) {
+		this->indexChildren();
+	}
+	else {
+		auto compareName = [this](LabelView name, unsigned index) {
+			return name < this->children[index]->getLabel();
+		};
+		auto position = this->childrenByName.end();
+		if (compareName(addedChild->getLabel(), this->childrenByName.back()))
+			position = upper_bound(this->childrenByName.begin(), this->childrenByName.end(), addedChild->getLabel(), compareName);
+		this->childrenByName.insert(position, addedIndex);
+	}
+	this->touch();
 	return addedChild;
 }
 
+/**
+ * Добавить к узлу сразу нескольких детей, забрав их из конца вектора. Индекс детей по именам
+ * перестраивается один раз, поэтому разборщик не тратит квадратичное время на широкие узлы
+ * \param[in] this Родительский узел
+ * \param[in,out] newChildren Новые дети в порядке добавления; забранные дети удаляются из вектора
+ * \param[in] first Номер первого забираемого ребёнка
+ */
+template <class Label>
+void BasicNode<Label>::addChildren(vector<unique_ptr<BasicNode<Label>>>& newChildren, size_t first)
+{
+	if (first >= newChildren.size())
+		return;
+	this->children.reserve(this->children.size() + newChildren.size() - first);
+	for (size_t i = first; i < newChildren.size(); i++) {
+		newChildren[i]->parent = this;
+		this->children.push_back(move(newChildren[i]));
+	}
+	newChildren.resize(first);
+	this->indexChildren();
+	this->touch();
+}
+
+/**
+ * Построить индекс детей по именам заново. Для единственного ребёнка индекс не хранится (см. findChildrenNamed)
+ * \param[in] this Узел
+ */
+template <class Label>
+void BasicNode<Label>::indexChildren()
+{
+	if (this->children.size() <= 1) {
+		this->childrenByName.clear();
+		return;
+	}
+	this->childrenByName.resize(this->children.size());
+	for (unsigned i = 0; i < this->children.size(); i++)
+		this->childrenByName[i] = i;
+	// Одноимённые дети упорядочиваются по номеру: так порядок устойчив без вспомогательного буфера stable_sort
+	sort(this->childrenByName.begin(), this->childrenByName.end(), [this](unsigned a, unsigned b) {
+		auto aLabel = this->children[a]->getLabel();
+		auto bLabel = this->children[b]->getLabel();
+		return aLabel < bLabel || (!(bLabel < aLabel) && a < b);
+	});
+}
+
 /**
  * Добавить ребёнка к заданному узлу
  * \param[in] this Родительский узел
  * \param[in] newChildName Имя нового ребёнка
  * \return Указатель на созданного ребёнка
  */
-Node* Node::addChild(const string& newChildName)
+template <class Label>
+BasicNode<Label>* BasicNode<Label>::addChild(const string& newChildName)
 {
-	Node* addedChild = nullptr;
-	unique_ptr<Node> newChild = make_unique<Node>(newChildName);
+	BasicNode<Label>* addedChild = nullptr;
+	unique_ptr<BasicNode<Label>> newChild = make_unique<BasicNode<Label>>(newChildName);
 	addedChild = newChild.get(); 
 	this->addChild(move(newChild));
 	return addedChild;
 }
 
+/**
+ * Добавить ребёнка с заданной меткой к заданному узлу
+ * \param[in] this Родительский узел
+ * \param[in] newChildLabel Метка нового ребёнка
+ * \return Указатель на созданного ребёнка
+ */
+template <class Label>
+BasicNode<Label>* BasicNode<Label>::addChild(const Label& newChildLabel)
+{
+	return this->addChild(make_unique<BasicNode<Label>>(newChildLabel));
+}
+
 /**
  * Создать копию дерева
  * \param[in] this Копируемое дерево
  * \return Скопированное дерево
  */
-unique_ptr<Node> Node::copy() const
+template <class Label>
+unique_ptr<BasicNode<Label>> BasicNode<Label>::copy() const
 {
 	if (this == nullptr)
 		return nullptr;
 
-	auto root = make_unique<Node>(this->name);
+	auto root = make_unique<BasicNode<Label>>(this->label);
 
+	// Дети копии идут в том же порядке, поэтому индекс по именам переносится без сортировки
+	root->children.reserve(this->children.size());
 	for (auto& child : children)
 	{
-		root->addChild(child->copy());
+		root->children.push_back(child->copy());
+		root->children.back()->parent = root.get();
 	}
+	root->childrenByName = this->childrenByName;
 
 	return root;
 }
 
+/**
+ * Создать копию узла без детей. Текстовая метка копии ссылается на тот же буфер
+ * \param[in] this Копируемый узел
+ * \return Узел с той же меткой
+ */
+template <class Label>
+unique_ptr<BasicNode<Label>> BasicNode<Label>::copyNode() const
+{
+	return make_unique<BasicNode<Label>>(this->label);
+}
+
 /**
  * Узнать, является ли этот узел - листом
  * \param[in] this Узел
  * \return Логический флаг, является ли листом
  */
-bool Node::isLeaf() const
+template <class Label>
+bool BasicNode<Label>::isLeaf() const
 {
 	if (this == nullptr)
 		return false;
@@ -81,7 +373,8 @@ bool Node::isLeaf() const
  * \param[in] this Узел
  * \return Логический флаг, есть ли потомки
  */
-bool Node::isNode() const
+template <class Label>
+bool BasicNode<Label>::isNode() const
 {
 	if (this == nullptr)
 		return false;
@@ -95,7 +388,8 @@ bool Node::isNode() const
  * \param[in] probablyChild Узел, подозреваемый в качестве ребёнка
  * \return Логический флаг, является ли узел ребёнком
  */
-bool Node::isChild(const Node* probablyChild) const {
+template <class Label>
+bool BasicNode<Label>::isChild(const BasicNode<Label>* probablyChild) const {
 	return any_of(children.begin(), children.end(), [probablyChild](const auto& child) -> bool {
 		return probablyChild == child.get();
 	});
@@ -106,7 +400,8 @@ bool Node::isChild(const Node* probablyChild) const {
  * \param[in] this Узел
  * \return количество потомков
  */
-int Node::descendantsCount() const
+template <class Label>
+int BasicNode<Label>::descendantsCount() const
 {
 	int count = children.size();
 	for (auto& child : children)
@@ -121,22 +416,96 @@ int Node::descendantsCount() const
  * \param[in] this Узел
  * \return Дети данного узла
  */
-vector<Node*> Node::getChildren() const {
-	vector<Node*> result;
+template <class Label>
+vector<BasicNode<Label>*> BasicNode<Label>::getChildren() const {
+	vector<BasicNode<Label>*> result;
 	for (const auto& child : children) {
 		result.push_back(child.get());
 	}
 	return result;
 }
 
+/**
+ * Дети данного узла без построения нового списка
+ * \param[in] this Узел
+ * \return Представление детей узла, действительное до изменения списка детей
+ */
+template <class Label>
+PointerView<BasicNode<Label>> BasicNode<Label>::getChildrenView() const
+{
+	return PointerView<BasicNode<Label>>(this->children.data(), this->children.size());
+}
+
+/**
+ * Ребёнок данного узла по его номеру
+ * \param[in] this Узел
+ * \param[in] index Номер ребёнка
+ * \return Ребёнок узла
+ */
+template <class Label>
+BasicNode<Label>* BasicNode<Label>::getChild(size_t index) const
+{
+	return this->children[index].get();
+}
+
+/**
+ * Количество детей данного узла
+ * \param[in] this Узел
+ * \return Количество детей
+ */
+template <class Label>
+size_t BasicNode<Label>::getChildrenCount() const
+{
+	return this->children.size();
+}
+
+/**
+ * Поиск детей данного узла с заданным именем по упорядоченному по именам индексу детей.
+ * Одноимённые дети перечисляются в порядке их следования в узле
+ * \param[in] this Узел
+ * \param[in] childName Имя искомых детей
+ * \return Диапазон номеров найденных детей
+ */
+template <class Label>
+pair<vector<unsigned>::const_iterator, vector<unsigned>::const_iterator> BasicNode<Label>::findChildrenNamed(LabelView childName) const
+{
+	// Индекс единственного ребёнка общий для всех узлов, чтобы не выделять память под каждый
+	if (this->children.size() == 1) {
+		static const vector<unsigned> singleChild = { 0 };
+		bool named = this->children[0]->getLabel() == childName;
+		return make_pair(singleChild.begin(), named ? singleChild.end() : singleChild.begin());
+	}
+
+	auto compareName = [this](unsigned index, LabelView name) {
+		return this->children[index]->getLabel() < name;
+	};
+	auto begin = lower_bound(this->childrenByName.begin(), this->childrenByName.end(), childName, compareName);
+	auto end = begin;
+	while (end != this->childrenByName.end() && this->children[*end]->getLabel() == childName)
+		++end;
+	return make_pair(begin, end);
+}
+
 /**
  * Выведать название данного узла
  * \param[in] this Узел
  * \return Название данного узла
  */
-string Node::getName() const
+template <class Label>
+string BasicNode<Label>::getName() const
+{
+	return LabelTraits<Label>::toString(this->label);
+}
+
+/**
+ * Метка узла без копирования. Для текстовых меток представление действительно, пока жив узел
+ * \param[in] this Узел
+ * \return Метка узла
+ */
+template <class Label>
+typename BasicNode<Label>::LabelView BasicNode<Label>::getLabel() const
 {
-	return this->name;
+	return LabelTraits<Label>::view(this->label);
 }
 
 /**
@@ -144,11 +513,12 @@ string Node::getName() const
  * \param[in] this Узел
  * \param[in] level Стартовый отступ от левого края консоли
  */
-void Node::print(int level) const
+template <class Label>
+void BasicNode<Label>::print(int level) const
 {
 	for (int i = 0; i < level; ++i)
 		cout << "-";
-	cout << this->name << endl;
+	cout << this->getName() << endl;
 
 	level++;
 	for (auto& child : children)
@@ -163,12 +533,14 @@ void Node::print(int level) const
  * \param[in] searchedNodeName Наименование искомых потомков
  * \return Найденные потомки
  */
-vector<const Node*> Node::findDescendants(const string& searchedNodeName) const
+template <class Label>
+vector<const BasicNode<Label>*> BasicNode<Label>::findDescendants(LabelView searchedNodeName) const
 {
-	vector<const Node*> foundNodes;
-	vector<const Node*> foundInChild;
+	vector<const BasicNode<Label>*> foundNodes;
+	vector<const BasicNode<Label>*> foundInChild;
+	SearchStats::count(StatsCounter::NodesVisited);
 
-	if (this->getName() == searchedNodeName) {
+	if (this->getLabel() == searchedNodeName) {
 		foundNodes.push_back(this);
 	}
 
@@ -185,21 +557,17 @@ vector<const Node*> Node::findDescendants(const string& searchedNodeName) const
  * \param[in,out] this Дерево, в которое производится вставка
  * \param[in] removingChild Удаляемый узел
  * \param[in] insertingNode Замена удаленному узлу
- * \return Указатель на новый узел
+ * \return Указатель на новый узел или nullptr, если удаляемый узел не является потомком дерева
  */
-Node* Node::insertDescendant(const Node* removingChild, unique_ptr<Node>& insertingNode)
+template <class Label>
+BasicNode<Label>* BasicNode<Label>::insertDescendant(const BasicNode<Label>* removingChild, unique_ptr<BasicNode<Label>>& insertingNode)
 {
-	Node* insertedChild = nullptr;
-	for (const auto& child : this->children) {
-		if (child.get() == removingChild) {
-			this->removeChild(child.get());
-			return this->addChild(move(insertingNode));
-		}
-		insertedChild = child->insertDescendant(removingChild, insertingNode);
-		if (insertedChild != nullptr)
-			return insertedChild;
-	}
-	return nullptr;
+	if (removingChild == this || !this->contains(removingChild))
+		return nullptr;
+
+	BasicNode<Label>* removingParent = removingChild->parent;
+	removingParent->removeChild(removingChild);
+	return removingParent->addChild(move(insertingNode));
 }
 
 /**
@@ -207,53 +575,181 @@ Node* Node::insertDescendant(const Node* removingChild, unique_ptr<Node>& insert
  * \param[in] this Главное дерево
  * \param[in] cmpTree Искомое дерево
  * \param[out] deltaTree Дерево разности
+ * \param[in] policy Способ сопоставления детей
  * \return Количество нехватающих узлов в главном дереве
  */
-int Node::buildDeltaTreeWrap(const Node* cmpTree, unique_ptr<Node>& deltaTree) const
+template <class Label>
+int BasicNode<Label>::buildDeltaTreeWrap(const BasicNode<Label>* cmpTree, unique_ptr<BasicNode<Label>>& deltaTree, MatchPolicy policy) const
 {
-	unique_ptr<Node> cmpTreeCopy = cmpTree->copy();
-	unique_ptr<PatchNode> patch = this->buildPatchWrap(cmpTreeCopy.get());
+	// Patch-граф строится в арене: текущей, если её задал вызывающий, иначе - в собственной
+	optional<PatchArena> localArena;
+	optional<PatchArena::Scope> localScope;
+	if (PatchArena::current() == nullptr) {
+		localArena.emplace();
+		localScope.emplace(*localArena);
+	}
+
+	// Соединения patch-графа указывают прямо в искомое дерево: оно не изменяется, а дерево разности собирается заново
+	unique_ptr<BasicPatchNode<Label>> patch;
+	{
+		PhaseTimer timer(StatsPhase::PatchBuilding);
+		patch = this->buildPatchWrap(cmpTree, policy);
+	}
 
-	if (patch->buildDeltaTree(cmpTreeCopy.get()) == -1) {
+	PhaseTimer timer(StatsPhase::DeltaConstruction);
+	// Если сопоставление невозможно, дерева разности нет
+	int delta = patch->getConnectionsView().front().weight;
+	unique_ptr<BasicNode<Label>> builtDeltaTree;
+	if (delta == -1 || patch->buildDeltaTree(cmpTree, builtDeltaTree) == -1) {
 		deltaTree = nullptr;
-		return -1;
+		delta = -1;
 	}
-	
-	if (cmpTreeCopy->descendantsCount() == 0) {
+	else if (builtDeltaTree->descendantsCount() == 0) {
 		deltaTree = nullptr;
 	}
 	else {
-		deltaTree = move(cmpTreeCopy);
+		deltaTree = move(builtDeltaTree);
 	}
 
-	return patch->getConnections()[0].second;
+	// Вся память patch-графа принадлежит арене и освобождается её сбросом без обхода узлов
+	patch.release();
+	return delta;
 }
 
 /**
  * Создание родословной узла(пути по дереву от потомка до самого старшего родителя).
+ * Путь строится подъёмом по ссылкам на родителей, поэтому обходится только глубина потомка
  * \param[in] this Дерево, в котором ищется родословная
  * \param[in] searchedChild Узел, для которого составляется родословная
- * \return Родословная узла
+ * \param[out] deepestChild Узел родословной, соответствующий искомому узлу
+ * \return Родословная узла или nullptr, если узел не принадлежит дереву
  */
-unique_ptr<Node> Node::buildPedigree(const Node* searchedChild, Node** deepestChild) const
+template <class Label>
+unique_ptr<BasicNode<Label>> BasicNode<Label>::buildPedigree(const BasicNode<Label>* searchedChild, BasicNode<Label>** deepestChild) const
 {
-	unique_ptr<Node> foundNode;
-	unique_ptr<Node> pedigree = make_unique<Node>(this->getName());
-	
-	if (this == searchedChild) {
-		*deepestChild = pedigree.get();
-		return move(pedigree);
+	if (!this->contains(searchedChild))
+		return nullptr;
+
+	unique_ptr<BasicNode<Label>> pedigree = make_unique<BasicNode<Label>>(searchedChild->label);
+	*deepestChild = pedigree.get();
+	for (const BasicNode<Label>* ancestor = searchedChild; ancestor != this; ancestor = ancestor->parent) {
+		auto ancestorCopy = make_unique<BasicNode<Label>>(ancestor->parent->label);
+		ancestorCopy->addChild(move(pedigree));
+		pedigree = move(ancestorCopy);
+	}
+
+	return pedigree;
+}
+
+/**
+ * Получить родителя узла
+ * \param[in] this Узел
+ * \return Родитель узла или nullptr, если узел - корень
+ */
+template <class Label>
+BasicNode<Label>* BasicNode<Label>::getParent() const
+{
+	return this->parent;
+}
+
+/**
+ * Путь от корня дерева до данного узла
+ * \param[in] this Узел
+ * \return Узлы пути, начиная с корня и заканчивая самим узлом
+ */
+template <class Label>
+vector<const BasicNode<Label>*> BasicNode<Label>::pathFromRoot() const
+{
+	vector<const BasicNode<Label>*> path;
+	for (const BasicNode<Label>* ancestor = this; ancestor != nullptr; ancestor = ancestor->parent) {
+		path.push_back(ancestor);
 	}
+	reverse(path.begin(), path.end());
+	return path;
+}
 
-	for (const auto& treeChild : children) {
-		foundNode = treeChild->buildPedigree(searchedChild, deepestChild);
-		if (foundNode != nullptr) {
-			pedigree->addChild(move(foundNode));
-			return move(pedigree);
+/**
+ * Пронумеровать узлы поддерева в прямом и обратном порядке обхода.
+ * Добавление и удаление узлов не меняет отношение предок-потомок между оставшимися узлами,
+ * поэтому нумерация остаётся верной для всех узлов, получивших её.
+ * Нумерация записывается в узлы, поэтому, как и изменение дерева, не должна выполняться одновременно с другими
+ * операциями над тем же деревом
+ * \param[in] this Корень нумеруемого поддерева
+ */
+template <class Label>
+void BasicNode<Label>::numberIntervals() const
+{
+	static atomic<unsigned long long> lastNumbering{ 0 };
+	unsigned long long curNumbering = lastNumbering.fetch_add(1, memory_order_relaxed) + 1;
+	unsigned preorder = 0;
+	unsigned postorder = 0;
+
+	// Обход без рекурсии, чтобы не переполнять стек на глубоких деревьях
+	stack<pair<const BasicNode<Label>*, size_t>> path;
+	this->preorderIndex = preorder++;
+	this->numbering = curNumbering;
+	path.emplace(this, 0);
+	while (!path.empty()) {
+		auto& top = path.top();
+		if (top.second < top.first->children.size()) {
+			const BasicNode<Label>* child = top.first->children[top.second++].get();
+			child->preorderIndex = preorder++;
+			child->numbering = curNumbering;
+			path.emplace(child, 0);
+		}
+		else {
+			top.first->postorderIndex = postorder++;
+			path.pop();
 		}
-	} 
+	}
+}
 
-	return nullptr;
+/**
+ * Узнать, содержится ли узел в поддереве данного узла (включая сам узел).
+ * Если оба узла пронумерованы одной нумерацией, проверка сравнивает их интервалы,
+ * иначе поднимается от узла по ссылкам на родителей
+ * \param[in] this Корень поддерева
+ * \param[in] node Проверяемый узел
+ * \return Логический флаг, содержится ли узел в поддереве
+ */
+template <class Label>
+bool BasicNode<Label>::contains(const BasicNode<Label>* node) const
+{
+	if (node == nullptr)
+		return false;
+
+	if (this->numbering != 0 && this->numbering == node->numbering)
+		return this->preorderIndex <= node->preorderIndex && node->postorderIndex <= this->postorderIndex;
+
+	for (const BasicNode<Label>* ancestor = node; ancestor != nullptr; ancestor = ancestor->parent) {
+		if (ancestor == this)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Номер последнего изменения поддерева узла. Меняется при любом добавлении или удалении узлов в поддереве
+ * \param[in] this Узел
+ * \return Номер изменения
+ */
+template <class Label>
+unsigned long long BasicNode<Label>::getRevision() const
+{
+	return this->revision;
+}
+
+/**
+ * Отметить изменение поддерева узла новым номером у самого узла и всех его предков
+ * \param[in] this Изменённый узел
+ */
+template <class Label>
+void BasicNode<Label>::touch()
+{
+	unsigned long long curRevision = nextRevision();
+	for (BasicNode<Label>* ancestor = this; ancestor != nullptr; ancestor = ancestor->parent) {
+		ancestor->revision = curRevision;
+	}
 }
 
 /**
@@ -261,11 +757,24 @@ unique_ptr<Node> Node::buildPedigree(const Node* searchedChild, Node** deepestCh
  * \param[in] this Узел
  * \param[in] nodeToDelete Удаляемый ребёнок узла
  */
-void Node::removeChild(const Node* nodeToDelete)
+template <class Label>
+void BasicNode<Label>::removeChild(const BasicNode<Label>* nodeToDelete)
 {
 	for (auto it = children.begin(); it < children.end(); ++it) {
 		if (nodeToDelete == (*it).get()) {
+			unsigned removedIndex = (unsigned)(it - children.begin());
 			children.erase(it);
+			if (children.size() <= 1) {
+				childrenByName.clear();
+			}
+			else {
+				childrenByName.erase(find(childrenByName.begin(), childrenByName.end(), removedIndex));
+				for (auto& index : childrenByName) {
+					if (index > removedIndex)
+						index--;
+				}
+			}
+			this->touch();
 			return;
 		}		
 	}
@@ -275,15 +784,49 @@ void Node::removeChild(const Node* nodeToDelete)
  * Инициализировать корневой Patch-узел и построить Patch дерево
  * \param[in] this Главное дерево
  * \param[in] cmpTree Сравниваемое дерево
+ * \param[in] policy Способ сопоставления детей
  * \return Patch
  */
-unique_ptr<PatchNode> Node::buildPatchWrap(Node* cmpTree) const {
-	auto patch = make_unique<PatchNode>(this);
-	int rootConWeight = this->buildPatch(cmpTree, patch.get());
+template <class Label>
+unique_ptr<BasicPatchNode<Label>> BasicNode<Label>::buildPatchWrap(const BasicNode<Label>* cmpTree, MatchPolicy policy) const {
+	auto patch = make_unique<BasicPatchNode<Label>>(this);
+	int rootConWeight;
+	switch (policy) {
+	case MatchPolicy::OrderedSubsequence:
+		rootConWeight = this->template buildPatch<MatchPolicy::OrderedSubsequence>(cmpTree, patch.get());
+		break;
+	case MatchPolicy::OrderedExact:
+		rootConWeight = this->template buildPatch<MatchPolicy::OrderedExact>(cmpTree, patch.get());
+		break;
+	default:
+		rootConWeight = this->template buildPatch<MatchPolicy::Unordered>(cmpTree, patch.get());
+		break;
+	}
 	patch->addConnection(rootConWeight, cmpTree);
 	return move(patch);
 }
 
+/**
+ * Вычислить вес соединения между узлом главного дерева и одноимённым узлом сравниваемого дерева
+ * \param[in] this Узел главного дерева
+ * \param[in] cmpChild Узел сравниваемого дерева
+ * \param[out] pairPatch Patch-дерево для пары узлов (остаётся пустым, если один из узлов - лист)
+ * \return Количество недостающих узлов или -1, если сопоставление невозможно
+ */
+template <class Label>
+template <MatchPolicy policy>
+int BasicNode<Label>::connectionWeight(const BasicNode<Label>* cmpChild, unique_ptr<BasicPatchNode<Label>>& pairPatch) const {
+	// Считать что узлы идентичны, если они являются листьями
+	if (this->isLeaf() && cmpChild->isLeaf())
+		return 0;
+	if (this->isLeaf())
+		return cmpChild->descendantsCount();
+	if (cmpChild->isLeaf())
+		return -1;
+	pairPatch = make_unique<BasicPatchNode<Label>>(this);
+	return this->template buildPatch<policy>(cmpChild, pairPatch.get());
+}
+
 /**
  * Построить Patch дерево, с заданным корневым узлом
  * \param[in] this Главное дерево
@@ -291,86 +834,420 @@ unique_ptr<PatchNode> Node::buildPatchWrap(Node* cmpTree) const {
  * \param[in,out] patch Patch-дерево
  * \return Минимальное количество дополнительных узлов в главном дереве для полного совпадения со сравниваемым
  */
-int Node::buildPatch(const Node* cmpTree, PatchNode* patch) const {
-	unique_ptr<PatchNode> curPatchNode;
+template <class Label>
+template <MatchPolicy policy>
+int BasicNode<Label>::buildPatch(const BasicNode<Label>* cmpTree, BasicPatchNode<Label>* patch) const {
+	unique_ptr<BasicPatchNode<Label>> curPatchNode;
+	unique_ptr<BasicPatchNode<Label>> pairPatch;
 	int curWeight;
-	for (const auto& mainChild : this->children) {
-		curPatchNode = make_unique<PatchNode>(mainChild.get());
-		for (const auto& cmpChild : cmpTree->children) {
-			if (!(mainChild->getName() == cmpChild->getName())) {
-				continue;
-			}
+	SearchStats::count(StatsCounter::NodesVisited);
+	patch->reserveChildren(this->children.size());
+
+	// Дети сопоставляются строго попарно по позициям. Лист главного дерева, как и в connectionWeight,
+	// сопоставляется с одноимённым узлом любой ширины: недостающими считаются все потомки узла
+	if constexpr (policy == MatchPolicy::OrderedExact) {
+		if (this->isLeaf())
+			return cmpTree->descendantsCount();
+		if (this->children.size() != cmpTree->children.size())
+			return -1;
 
-			// Считать что узлы идентичны, если они являются
-			if (mainChild->isLeaf() && cmpChild->isLeaf()) {
-				curWeight = 0;
-			}
-			else if (mainChild->isLeaf() && cmpChild->isNode()) {
-				curWeight = cmpChild->descendantsCount();
-			}
-			else if (mainChild->isNode() && cmpChild->isLeaf()) {
-				curWeight = -1;
-			}
-			else if (mainChild->isNode() && cmpChild->isNode()) {
-				curWeight = mainChild->buildPatch(cmpChild.get(), curPatchNode.get());
-			}
+		int sumConnections = 0;
+		for (size_t i = 0; i < this->children.size(); i++) {
+			const BasicNode<Label>* mainChild = this->children[i].get();
+			BasicNode<Label>* cmpChild = cmpTree->children[i].get();
+			if (mainChild->getLabel() != cmpChild->getLabel())
+				return -1;
+
+			curWeight = mainChild->template connectionWeight<policy>(cmpChild, pairPatch);
+			if (curWeight == -1)
+				return -1;
 
-			curPatchNode->addConnection(curWeight, cmpChild.get());
+			curPatchNode = make_unique<BasicPatchNode<Label>>(mainChild);
+			curPatchNode->addConnection(curWeight, cmpChild, move(pairPatch), (int)i);
+			patch->addChild(move(curPatchNode));
+			sumConnections += curWeight;
 		}
+		return sumConnections;
+	}
+	// Дети главного дерева вкладываются в детей сравниваемого дерева с сохранением порядка.
+	// Каждый ребёнок сопоставляется с самым левым подходящим ребёнком, пропущенные дети считаются недостающими
+	else if constexpr (policy == MatchPolicy::OrderedSubsequence) {
+		int sumConnections = 0;
+		size_t cmpIndex = 0;
+		size_t cmpChildrenCount = cmpTree->children.size();
+		for (const auto& mainChild : this->children) {
+			curWeight = -1;
+			while (curWeight == -1 && cmpIndex < cmpChildrenCount) {
+				BasicNode<Label>* cmpChild = cmpTree->children[cmpIndex++].get();
+				if (mainChild->getLabel() != cmpChild->getLabel()) {
+					sumConnections += 1 + cmpChild->descendantsCount();
+					continue;
+				}
+
+				curWeight = mainChild->template connectionWeight<policy>(cmpChild, pairPatch);
+				if (curWeight == -1) {
+					sumConnections += 1 + cmpChild->descendantsCount();
+					continue;
+				}
+				curPatchNode = make_unique<BasicPatchNode<Label>>(mainChild.get());
+				curPatchNode->addConnection(curWeight, cmpChild, move(pairPatch), (int)cmpIndex - 1);
+			}
 
-		// Если в главном дереве есть узлы, на которых не нашлось узла из cmpTree, то сравнение невозможно
-		if (curPatchNode->getConnections().empty())
-			return -1;
+			// Если для ребёнка главного дерева не нашлось пары, то сравнение невозможно
+			if (curWeight == -1)
+				return -1;
+
+			patch->addChild(move(curPatchNode));
+			sumConnections += curWeight;
+		}
 
-		patch->addChild(move(curPatchNode));
+		for (; cmpIndex < cmpChildrenCount; cmpIndex++) {
+			sumConnections += 1 + cmpTree->children[cmpIndex]->descendantsCount();
+		}
+		return sumConnections;
 	}
+	// Одноимённые дети распределяются взаимно однозначно с минимальным суммарным весом. Пары оцениваются
+	// без patch-деревьев, а patch-деревья строятся только для выбранных пар
+	else {
+		size_t cmpChildrenCount = cmpTree->children.size();
+		vector<int> selectedCols(this->children.size(), -1);
+		vector<bool> caughtCols(cmpChildrenCount, false);
+		int sumConnections = 0;
+		for (size_t i = 0; i < this->children.size(); i++) {
+			if (selectedCols[i] != -1)
+				continue;
 
+			auto groupName = this->children[i]->getLabel();
+			auto rowsRange = this->findChildrenNamed(groupName);
+			auto colsRange = cmpTree->findChildrenNamed(groupName);
+			// Если для ребёнка главного дерева нет одноимённого ребёнка в сравниваемом дереве, то сравнение невозможно
+			if (colsRange.first == colsRange.second)
+				return -1;
 
-	int currentMinConnectionIndex;
-	int minSumConnections = 0;
+			// Стоимость того, что одноимённый ребёнок сравниваемого дерева останется без пары
+			vector<unsigned> cols(colsRange.first, colsRange.second);
+			vector<int> missingCosts;
+			int missingSum = 0;
+			int maxMissingCost = 0;
+			for (unsigned col : cols) {
+				caughtCols[col] = true;
+				missingCosts.push_back(1 + cmpTree->children[col]->descendantsCount());
+				missingSum += missingCosts.back();
+				maxMissingCost = max(maxMissingCost, missingCosts.back());
+			}
 
-	// Если количество детей patch не равно количеству детей в узле сравниваемого дерева
-	if (this->getChildren().size() < cmpTree->children.size()) {
-		auto uncaughtChildren = patch->findUncaughtChildren(cmpTree);
-		for (const auto& child : uncaughtChildren) {
-			minSumConnections += 1 + child->descendantsCount();
+			// Единственному ребёнку достаточно самого лёгкого соединения (при равных весах - самого левого)
+			if (rowsRange.second - rowsRange.first == 1) {
+				const BasicNode<Label>* mainChild = this->children[i].get();
+				int minWeight = -1;
+				size_t minCol = 0;
+				for (size_t col = 0; col < cols.size(); col++) {
+					curWeight = mainChild->template evaluateConnection<policy>(cmpTree->children[cols[col]].get(), nullptr);
+					if (curWeight != -1 && (minWeight == -1 || curWeight < minWeight)) {
+						minWeight = curWeight;
+						minCol = col;
+					}
+				}
+				if (minWeight == -1)
+					return -1;
+				selectedCols[i] = (int)cols[minCol];
+				sumConnections += minWeight + missingSum - missingCosts[minCol];
+			}
+			else {
+				// Стоимость ребра смещена так, чтобы быть неотрицательной и учитывать, что назначенный ребёнок перестаёт быть недостающим.
+				// Рёбра строки добавляются в порядке возрастания веса
+				vector<unsigned> rows(rowsRange.first, rowsRange.second);
+				SparseAssignment assignment((int)rows.size(), (int)cols.size());
+				vector<pair<int, int>> rowEdges;
+				for (size_t row = 0; row < rows.size(); row++) {
+					const BasicNode<Label>* mainChild = this->children[rows[row]].get();
+					rowEdges.clear();
+					for (size_t col = 0; col < cols.size(); col++) {
+						curWeight = mainChild->template evaluateConnection<policy>(cmpTree->children[cols[col]].get(), nullptr);
+						if (curWeight != -1)
+							rowEdges.emplace_back(curWeight, (int)col);
+					}
+					stable_sort(rowEdges.begin(), rowEdges.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+					for (const auto& edge : rowEdges)
+						assignment.addEdge((int)row, edge.second, (long long)edge.first + maxMissingCost - missingCosts[edge.second]);
+				}
+				if (!assignment.solve())
+					return -1;
+
+				for (size_t row = 0; row < rows.size(); row++)
+					selectedCols[rows[row]] = (int)cols[assignment.getColumn((int)row)];
+				sumConnections += (int)(assignment.getCost() - (long long)rows.size() * maxMissingCost + missingSum);
+			}
 		}
-	}
 
-	for (const auto& patchChild : patch->getChildren()) {
-		currentMinConnectionIndex = patchChild->findMinValidConnection();
+		// Дети, имени которых нет в главном дереве, недостают целиком
+		for (size_t cmpIndex = 0; cmpIndex < cmpChildrenCount; cmpIndex++) {
+			if (!caughtCols[cmpIndex])
+				sumConnections += 1 + cmpTree->children[cmpIndex]->descendantsCount();
+		}
 
-		if (currentMinConnectionIndex == -1)
-			return -1;
+		for (size_t i = 0; i < this->children.size(); i++) {
+			const BasicNode<Label>* mainChild = this->children[i].get();
+			BasicNode<Label>* cmpChild = cmpTree->children[selectedCols[i]].get();
+			curWeight = mainChild->template connectionWeight<policy>(cmpChild, pairPatch);
+			curPatchNode = make_unique<BasicPatchNode<Label>>(mainChild);
+			curPatchNode->addConnection(curWeight, cmpChild, move(pairPatch), selectedCols[i]);
+			patch->addChild(move(curPatchNode));
+		}
+		return sumConnections;
+	}
+}
 
-		minSumConnections += patchChild->getConnections()[currentMinConnectionIndex].second;
+/**
+ * Вычислить вес patch-дерева, не строя его: то же самое значение, что возвращает buildPatch,
+ * но без patch-узлов и списков соединений. Помимо стека рекурсии нужна лишь память
+ * для назначения одной группы одноимённых детей текущего узла
+ * \param[in] this Главное дерево
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] cmpTree Сравниваемое дерево
+ * \param[in,out] memo Общие веса одинаковых поддеревьев нескольких искомых деревьев (nullptr - не используются)
+ * \return Минимальное количество дополнительных узлов в главном дереве или -1, если сопоставление невозможно
+ */
+template <class Label>
+int BasicNode<Label>::evaluatePatchWrap(const BasicNode<Label>* cmpTree, MatchPolicy policy, BasicWeightMemo<Label>* memo) const
+{
+	int weight;
+	if (memo != nullptr && memo->find(this, cmpTree, weight))
+		return weight;
+
+	switch (policy) {
+	case MatchPolicy::OrderedSubsequence:
+		weight = this->template evaluatePatch<MatchPolicy::OrderedSubsequence>(cmpTree, memo);
+		break;
+	case MatchPolicy::OrderedExact:
+		weight = this->template evaluatePatch<MatchPolicy::OrderedExact>(cmpTree, memo);
+		break;
+	default:
+		weight = this->template evaluatePatch<MatchPolicy::Unordered>(cmpTree, memo);
+		break;
 	}
 
-	return minSumConnections;
+	if (memo != nullptr)
+		memo->store(this, cmpTree, weight);
+	return weight;
 }
 
 /**
- * Поиск поддерева и построение минимального дерева разности.
- * \param[in] this Главное дерево, в котором проводится поиск
+ * Вычислить вес соединения между одноимёнными узлами, не строя patch-дерево для пары
+ * \param[in] this Узел главного дерева
+ * \param[in] cmpChild Узел сравниваемого дерева
+ * \param[in,out] memo Общие веса одинаковых поддеревьев (nullptr - не используются)
+ * \return Количество недостающих узлов или -1, если сопоставление невозможно
+ */
+template <class Label>
+template <MatchPolicy policy>
+int BasicNode<Label>::evaluateConnection(const BasicNode<Label>* cmpChild, BasicWeightMemo<Label>* memo) const {
+	if (this->isLeaf() && cmpChild->isLeaf())
+		return 0;
+	if (this->isLeaf())
+		return cmpChild->descendantsCount();
+	if (cmpChild->isLeaf())
+		return -1;
+
+	int weight;
+	if (memo != nullptr && memo->find(this, cmpChild, weight))
+		return weight;
+	weight = this->template evaluatePatch<policy>(cmpChild, memo);
+	if (memo != nullptr)
+		memo->store(this, cmpChild, weight);
+	return weight;
+}
+
+/**
+ * Ленивое вычисление веса patch-дерева (см. evaluatePatchWrap)
+ * \param[in] this Главное дерево
+ * \param[in] cmpTree Сравниваемое дерево
+ * \param[in,out] memo Общие веса одинаковых поддеревьев (nullptr - не используются)
+ * \return Минимальное количество дополнительных узлов или -1, если сопоставление невозможно
+ */
+template <class Label>
+template <MatchPolicy policy>
+int BasicNode<Label>::evaluatePatch(const BasicNode<Label>* cmpTree, BasicWeightMemo<Label>* memo) const {
+	int curWeight;
+	SearchStats::count(StatsCounter::NodesVisited);
+
+	if constexpr (policy == MatchPolicy::OrderedExact) {
+		// Лист главного дерева - как в buildPatch
+		if (this->isLeaf())
+			return cmpTree->descendantsCount();
+		if (this->children.size() != cmpTree->children.size())
+			return -1;
+
+		int sumConnections = 0;
+		for (size_t i = 0; i < this->children.size(); i++) {
+			const BasicNode<Label>* mainChild = this->children[i].get();
+			const BasicNode<Label>* cmpChild = cmpTree->children[i].get();
+			if (mainChild->getLabel() != cmpChild->getLabel())
+				return -1;
+
+			curWeight = mainChild->template evaluateConnection<policy>(cmpChild, memo);
+			if (curWeight == -1)
+				return -1;
+			sumConnections += curWeight;
+		}
+		return sumConnections;
+	}
+	else if constexpr (policy == MatchPolicy::OrderedSubsequence) {
+		int sumConnections = 0;
+		size_t cmpIndex = 0;
+		size_t cmpChildrenCount = cmpTree->children.size();
+		for (const auto& mainChild : this->children) {
+			curWeight = -1;
+			while (curWeight == -1 && cmpIndex < cmpChildrenCount) {
+				const BasicNode<Label>* cmpChild = cmpTree->children[cmpIndex++].get();
+				if (mainChild->getLabel() == cmpChild->getLabel())
+					curWeight = mainChild->template evaluateConnection<policy>(cmpChild, memo);
+				if (curWeight == -1)
+					sumConnections += 1 + cmpChild->descendantsCount();
+			}
+
+			if (curWeight == -1)
+				return -1;
+			sumConnections += curWeight;
+		}
+
+		for (; cmpIndex < cmpChildrenCount; cmpIndex++) {
+			sumConnections += 1 + cmpTree->children[cmpIndex]->descendantsCount();
+		}
+		return sumConnections;
+	}
+	else {
+		// Каждому ребёнку главного дерева нужен хотя бы один одноимённый ребёнок в сравниваемом дереве
+		for (const auto& mainChild : this->children) {
+			auto cmpRange = cmpTree->findChildrenNamed(mainChild->getLabel());
+			if (cmpRange.first == cmpRange.second)
+				return -1;
+		}
+
+		// Группы одноимённых детей перебираются по первому ребёнку группы в сравниваемом дереве.
+		// Дети, имени которых нет в главном дереве, недостают целиком
+		int sumConnections = 0;
+		for (unsigned cmpIndex = 0; cmpIndex < cmpTree->children.size(); cmpIndex++) {
+			auto groupName = cmpTree->children[cmpIndex]->getLabel();
+			auto colsRange = cmpTree->findChildrenNamed(groupName);
+			if (*colsRange.first != cmpIndex)
+				continue;
+
+			auto rowsRange = this->findChildrenNamed(groupName);
+			size_t rowsCount = rowsRange.second - rowsRange.first;
+			size_t colsCount = colsRange.second - colsRange.first;
+			int missingSum = 0;
+			int maxMissingCost = 0;
+			for (auto colIt = colsRange.first; colIt != colsRange.second; ++colIt) {
+				int missingCost = 1 + cmpTree->children[*colIt]->descendantsCount();
+				missingSum += missingCost;
+				maxMissingCost = max(maxMissingCost, missingCost);
+			}
+
+			if (rowsCount == 0) {
+				sumConnections += missingSum;
+			}
+			// Единственному ребёнку достаточно самого лёгкого соединения (при равных весах - самого левого)
+			else if (rowsCount == 1) {
+				const BasicNode<Label>* mainChild = this->children[*rowsRange.first].get();
+				int minWeight = -1;
+				int minMissingCost = 0;
+				for (auto colIt = colsRange.first; colIt != colsRange.second; ++colIt) {
+					const BasicNode<Label>* cmpChild = cmpTree->children[*colIt].get();
+					curWeight = mainChild->template evaluateConnection<policy>(cmpChild, memo);
+					if (curWeight != -1 && (minWeight == -1 || curWeight < minWeight)) {
+						minWeight = curWeight;
+						minMissingCost = 1 + cmpChild->descendantsCount();
+					}
+				}
+				if (minWeight == -1)
+					return -1;
+				sumConnections += minWeight + missingSum - minMissingCost;
+			}
+			// Сумма весов назначения и недостающих детей выражается через стоимость назначения со смещёнными рёбрами
+			else {
+				SparseAssignment assignment((int)rowsCount, (int)colsCount);
+				size_t row = 0;
+				for (auto rowIt = rowsRange.first; rowIt != rowsRange.second; ++rowIt, row++) {
+					const BasicNode<Label>* mainChild = this->children[*rowIt].get();
+					size_t col = 0;
+					for (auto colIt = colsRange.first; colIt != colsRange.second; ++colIt, col++) {
+						const BasicNode<Label>* cmpChild = cmpTree->children[*colIt].get();
+						curWeight = mainChild->template evaluateConnection<policy>(cmpChild, memo);
+						if (curWeight == -1)
+							continue;
+						assignment.addEdge((int)row, (int)col, (long long)curWeight + maxMissingCost - 1 - cmpChild->descendantsCount());
+					}
+				}
+				if (!assignment.solve())
+					return -1;
+				sumConnections += (int)(assignment.getCost() - (long long)rowsCount * maxMissingCost + missingSum);
+			}
+		}
+		return sumConnections;
+	}
+}
+
+/**
+ * Поиск поддерева и построение минимального дерева разности.
+ * \param[in] this Главное дерево, в котором проводится поиск
  * \param[in] cmpTree Искомое дерево
  * \param[out] deltaTree Дерево разности, содержающее узлы, которых не хватает главному дереву для появления в нем поддерева, совпадающего с искомым деревом
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву
+ */
+template <class Label>
+int BasicNode<Label>::findSubTree(const BasicNode<Label>* cmpTree, unique_ptr<BasicNode<Label>>& deltaTree, MatchPolicy policy) const {
+	vector<const BasicNode<Label>*> probableCmpTrees;
+	{
+		PhaseTimer timer(StatsPhase::CandidateLookup);
+		probableCmpTrees = this->findDescendants(cmpTree->getLabel());
+	}
+	return this->findSubTreeAmong(probableCmpTrees, cmpTree, deltaTree, policy);
+}
+
+/**
+ * Поиск поддерева среди заданных кандидатов и построение минимального дерева разности.
+ * \param[in] this Главное дерево, которому принадлежат кандидаты
+ * \param[in] probableCmpTrees Узлы главного дерева, проверяемые в качестве корня искомого дерева
+ * \param[in] cmpTree Искомое дерево
+ * \param[out] deltaTree Дерево разности
+ * \param[in] policy Способ сопоставления детей
  * \return Количество узлов, которые необходимо добавить к главному дереву
  */
-int Node::findSubTree(const Node* cmpTree, unique_ptr<Node>& deltaTree) const {
-	vector<const Node*> probableCmpTrees = this->findDescendants(cmpTree->getName());
+template <class Label>
+int BasicNode<Label>::findSubTreeAmong(const vector<const BasicNode<Label>*>& probableCmpTrees, const BasicNode<Label>* cmpTree, unique_ptr<BasicNode<Label>>& deltaTree, MatchPolicy policy) const {
 	int curDeltaValue;
-	const Node* minTree = nullptr;
-	unique_ptr<Node> curDeltaTree;
-	unique_ptr<Node> minDeltaTree;
+	const BasicNode<Label>* minTree = nullptr;
+	unique_ptr<BasicNode<Label>> curDeltaTree;
+	unique_ptr<BasicNode<Label>> minDeltaTree;
 	int minDelta = INT_MAX;
 
-	// Найти минимальное дерево разности среди узлов, имя котороых совпадает с именем корня искомого дерева
-	for (const auto& tree : probableCmpTrees) {
-		curDeltaValue = tree->buildDeltaTreeWrap(cmpTree, curDeltaTree);
-		if (curDeltaValue != -1 && curDeltaValue < minDelta) {
+	// Кандидаты сначала оцениваются без построения patch-графов
+	vector<pair<int, size_t>> rankedTrees;
+	{
+		PhaseTimer timer(StatsPhase::PatchBuilding);
+		for (size_t i = 0; i < probableCmpTrees.size(); i++) {
+			SearchStats::count(StatsCounter::CandidatesEvaluated);
+			curDeltaValue = probableCmpTrees[i]->evaluatePatchWrap(cmpTree, policy);
+			if (curDeltaValue != -1)
+				rankedTrees.emplace_back(curDeltaValue, i);
+		}
+	}
+	sort(rankedTrees.begin(), rankedTrees.end());
+
+	// Patch-граф строится только для лучшего кандидата (для следующего - лишь если дерево разности не удалось построить)
+	PatchArena arena;
+	PatchArena::Scope arenaScope(arena);
+	for (const auto& rankedTree : rankedTrees) {
+		arena.reset();
+		const BasicNode<Label>* tree = probableCmpTrees[rankedTree.second];
+		curDeltaValue = tree->buildDeltaTreeWrap(cmpTree, curDeltaTree, policy);
+		if (curDeltaValue != -1) {
 			minTree = tree;
 			minDelta = curDeltaValue;
 			minDeltaTree = move(curDeltaTree);
+			break;
 		}
 	}
 
@@ -382,11 +1259,19 @@ int Node::findSubTree(const Node* cmpTree, unique_ptr<Node>& deltaTree) const {
 
 	// Если минимальное дерево разности не содержит ни одного узла, считать поиск успешным
 	if (minDeltaTree.get() == nullptr) {
+		deltaTree = nullptr;
+		return minDelta;
+	}
+
+	// Если лучшим кандидатом оказался корень главного дерева, родословная не нужна
+	if (minTree == this) {
+		deltaTree = move(minDeltaTree);
 		return minDelta;
 	}
 
 	// Иначе от корня минимально дерева разности построить родословную до корня главного дерева
-	Node* removingChild = nullptr;
+	PhaseTimer timer(StatsPhase::Pedigree);
+	BasicNode<Label>* removingChild = nullptr;
 	auto parents = this->buildPedigree(minTree, &removingChild);
 
 	parents->insertDescendant(removingChild, minDeltaTree);
@@ -396,79 +1281,209 @@ int Node::findSubTree(const Node* cmpTree, unique_ptr<Node>& deltaTree) const {
 	return minDelta;
 }
 
+/**
+ * Подсчёт недостающих узлов без построения patch-графов и дерева разности.
+ * Кандидаты те же, что и у findSubTree, но каждый оценивается лениво
+ * \param[in] this Главное дерево
+ * \param[in] cmpTree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву, или -1, если поддерево не найдено
+ */
+template <class Label>
+int BasicNode<Label>::countMissingNodes(const BasicNode<Label>* cmpTree, MatchPolicy policy) const
+{
+	vector<const BasicNode<Label>*> probableCmpTrees;
+	{
+		PhaseTimer timer(StatsPhase::CandidateLookup);
+		probableCmpTrees = this->findDescendants(cmpTree->getLabel());
+	}
+
+	PhaseTimer timer(StatsPhase::PatchBuilding);
+	int minDelta = -1;
+	for (const auto& tree : probableCmpTrees) {
+		SearchStats::count(StatsCounter::CandidatesEvaluated);
+		int curDelta = tree->evaluatePatchWrap(cmpTree, policy);
+		if (curDelta != -1 && (minDelta == -1 || curDelta < minDelta))
+			minDelta = curDelta;
+	}
+	return minDelta;
+}
+
 /**
  * Построение дерева разности на основе заданного Patch-дерева.
+ * Искомое дерево не изменяется: в дерево разности копируются только его узлы, оставшиеся без пары
  * \param[in] this Patch-дерево 
- * \param[in, out] cmpTree Искомое дерево
+ * \param[in] cmpTree Искомое дерево
+ * \param[out] deltaTree Дерево разности: искомое дерево без полностью совпавших поддеревьев
  * \return Успешность построения дерева разности
  */
-int PatchNode::buildDeltaTree(Node* cmpTree) const
+template <class Label>
+int BasicPatchNode<Label>::buildDeltaTree(const BasicNode<Label>* cmpTree, unique_ptr<BasicNode<Label>>& deltaTree)
 {
-	int curMinConnectionIndex;
+	int curConnectionIndex;
+	size_t cmpChildrenCount = cmpTree->getChildrenCount();
+	// Для каждого ребёнка искомого дерева: совпал ли он полностью и его собственное дерево разности
+	vector<bool> matchedChildren(cmpChildrenCount, false);
+	vector<unique_ptr<BasicNode<Label>>> childDeltaTrees(cmpChildrenCount);
 
 	// Для каждого patch-узла
-	for (auto patchChild : this->getChildren()) {
-		// Выбрать самое легкое соединение
-		auto& curConnections = patchChild->connections;
-		curMinConnectionIndex = patchChild->findMinValidConnection();
+	for (auto patchChild : this->getChildrenView()) {
+		// Взять соединение, выбранное при назначении детей
+		curConnectionIndex = patchChild->findSelectedConnection();
 
-		if (curMinConnectionIndex == -1)
+		if (curConnectionIndex == -1)
 			return -1;
 
-		// Если вес соединения равен нулю, удалить из дерева разности узел, на который указывает данное соединение
-		auto curConnectionToDelete = curConnections[curMinConnectionIndex];
-		if (curConnectionToDelete.second == 0) {
-			this->deleteAllChildReferences(curConnectionToDelete.first);
-			cmpTree->removeChild(curConnectionToDelete.first);
+		const BasicPatchConnection<Label>& curConnection = patchChild->connections[curConnectionIndex];
+		const BasicNode<Label>* curTarget = curConnection.target;
+		int targetIndex = curConnection.targetIndex;
+		if (targetIndex < 0) {
+			auto cmpChildren = cmpTree->getChildrenView();
+			auto targetIt = std::find(cmpChildren.begin(), cmpChildren.end(), curTarget);
+			if (targetIt == cmpChildren.end())
+				continue;
+			targetIndex = (int)distance(cmpChildren.begin(), targetIt);
+		}
+
+		// Если вес соединения равен нулю, узел, на который указывает данное соединение, не попадает в дерево разности
+		if (curConnection.weight == 0) {
+			this->deleteAllChildReferences(curTarget, curConnection.targetIndex);
+			matchedChildren[targetIndex] = true;
 		}
 		// Иначе составить дерево разности для узла, на который указывает данное соединение
-		else {
-			if (patchChild->buildDeltaTree(curConnectionToDelete.first) == -1)
+		else if (curConnection.patch != nullptr) {
+			if (curConnection.patch->buildDeltaTree(curTarget, childDeltaTrees[targetIndex]) == -1)
 				return -1;
 		}
 	}
+
+	// Поддеревья, для которых не строилось собственное дерево разности, копируются целиком
+	deltaTree = cmpTree->copyNode();
+	for (size_t i = 0; i < cmpChildrenCount; i++) {
+		if (matchedChildren[i])
+			continue;
+		if (childDeltaTrees[i] != nullptr)
+			deltaTree->addChild(move(childDeltaTrees[i]));
+		else
+			deltaTree->addChild(cmpTree->getChild(i)->copy());
+	}
 	return 0;
 }
 
 
-PatchNode::PatchNode()
+// Память для списков нового patch-узла: текущая арена или общая куча
+static pmr::memory_resource* patchResource()
+{
+	PatchArena* arena = PatchArena::current();
+	if (arena != nullptr)
+		return arena;
+	return pmr::get_default_resource();
+}
+
+template <class Label>
+BasicPatchNode<Label>::BasicPatchNode()
+	: BasicPatchNode((BasicNode<Label>*)nullptr)
 {
-	this->rootSubTree = nullptr;
 }
 
-PatchNode::PatchNode(Node* rootSubTree)
+template <class Label>
+BasicPatchNode<Label>::BasicPatchNode(BasicNode<Label>* rootSubTree)
+	: connections(patchResource()), children(patchResource()), removedChildren(patchResource()), referenceCounts(patchResource())
 {
 	this->rootSubTree = rootSubTree;
+	this->selectedTarget = nullptr;
+	this->parent = nullptr;
+	this->positionInParent = 0;
+	this->untrackedConnections = 0;
+	SearchStats::count(StatsCounter::PatchNodesAllocated);
 }
 
-PatchNode::PatchNode(const Node* rootSubTree)
+template <class Label>
+BasicPatchNode<Label>::BasicPatchNode(const BasicNode<Label>* rootSubTree)
+	: BasicPatchNode(const_cast<BasicNode<Label>*>(rootSubTree))
 {
-	this->rootSubTree = const_cast<Node*>(rootSubTree);
 }
 
-Node* PatchNode::getRoot() const
+template <class Label>
+void* BasicPatchNode<Label>::operator new(size_t size)
+{
+	PatchArena* arena = PatchArena::current();
+	if (arena != nullptr)
+		return arena->allocate(size, alignof(BasicPatchNode<Label>));
+	SearchStats::allocated(StatsStructure::PatchNodes, size);
+	return ::operator new(size);
+}
+
+template <class Label>
+void BasicPatchNode<Label>::operator delete(void* pointer, size_t size)
+{
+	// Память арены освобождается только её сбросом
+	PatchArena* arena = PatchArena::current();
+	if (arena != nullptr && arena->owns(pointer))
+		return;
+	SearchStats::released(StatsStructure::PatchNodes, size);
+	::operator delete(pointer);
+}
+
+template <class Label>
+BasicNode<Label>* BasicPatchNode<Label>::getRoot() const
 {
 	return this->rootSubTree;
 }
 
-vector<pair<Node*, int>> PatchNode::getConnections() const
+template <class Label>
+vector<pair<const BasicNode<Label>*, int>> BasicPatchNode<Label>::getConnections() const
+{
+	vector<pair<const BasicNode<Label>*, int>> result;
+	for (const auto& connection : this->connections) {
+		if (!this->isRemoved(connection))
+			result.emplace_back(connection.target, connection.weight);
+	}
+	return result;
+}
+
+/**
+ * Действующие соединения patch-узла без построения нового списка
+ * \param[in] this patch-узел
+ * \return Представление соединений, пропускающее соединения с удалёнными узлами
+ */
+template <class Label>
+typename BasicPatchNode<Label>::ConnectionsView BasicPatchNode<Label>::getConnectionsView() const
 {
-	return connections;
+	return ConnectionsView(this);
 }
 
 /**
  * Удаляет все соединения ведущие к указанному узлу из дочерних patch-узлов.
+ * Если известен номер узла, он лишь помечается удалённым в битовом множестве,
+ * а соединения, ссылающиеся на него, перестают учитываться. Битовое множество и количество ссылок
+ * строятся при первом таком удалении
  * \param this Родительский patch-узел
  * \param selectedNode Выбранный узел
+ * \param selectedIndex Номер выбранного узла среди детей сравниваемого узла (-1, если не известен)
  * \return Количество удаленных соединений
  */
-int PatchNode::deleteAllChildReferences(const Node* selectedNode) const
+template <class Label>
+int BasicPatchNode<Label>::deleteAllChildReferences(const BasicNode<Label>* selectedNode, int selectedIndex)
 {
 	int deletedConnectionsCount = 0;
+	if (selectedIndex >= 0) {
+		if (this->referenceCounts.empty())
+			this->indexReferences((size_t)selectedIndex + 1);
+		if (testBit(this->removedChildren, selectedIndex))
+			return 0;
+		setBit(this->removedChildren, selectedIndex);
+		if ((size_t)selectedIndex < this->referenceCounts.size())
+			deletedConnectionsCount = (int)this->referenceCounts[selectedIndex];
+		if (this->untrackedConnections == 0)
+			return deletedConnectionsCount;
+	}
+
+	// Соединения без номера целевого узла удаляются перебором
 	for (const auto& patchChild : this->children) {
 		auto& curConnections = patchChild->connections;
 		for (auto conIt = curConnections.begin(); conIt != curConnections.end();) {
-			if ((*conIt).first == selectedNode) {
+			if ((*conIt).target == selectedNode && (selectedIndex < 0 || (*conIt).targetIndex < 0)) {
 				conIt = curConnections.erase(conIt);
 				deletedConnectionsCount++;
 			}
@@ -486,28 +1501,114 @@ int PatchNode::deleteAllChildReferences(const Node* selectedNode) const
  * \param[in] newChild Новый ребёнок
  * \return Указатель на добавленного ребёнка
  */
-PatchNode* PatchNode::addChild(unique_ptr<PatchNode> newChild)
+template <class Label>
+BasicPatchNode<Label>* BasicPatchNode<Label>::addChild(unique_ptr<BasicPatchNode<Label>> newChild)
 {
+	newChild->parent = this;
+	newChild->positionInParent = (unsigned)this->children.size();
+	for (const auto& connection : newChild->connections) {
+		this->trackConnection(connection);
+	}
 	this->children.push_back(move(newChild));
 	return (*(children.end() - 1)).get();
 }
 
+/**
+ * Заранее выделить место под детей patch-узла, чтобы список не перевыделялся при росте
+ * (в арене память перевыделенных списков не возвращается до её сброса)
+ * \param[in] this Patch-узел
+ * \param[in] childrenCount Количество детей patch-узла
+ */
+template <class Label>
+void BasicPatchNode<Label>::reserveChildren(size_t childrenCount)
+{
+	this->children.reserve(childrenCount);
+}
+
+/**
+ * Заранее выделить место под соединения patch-узла
+ * \param[in] this Patch-узел
+ * \param[in] connectionsCount Количество соединений
+ */
+template <class Label>
+void BasicPatchNode<Label>::reserveConnections(size_t connectionsCount)
+{
+	this->connections.reserve(connectionsCount);
+}
+
+/**
+ * Учесть новое соединение ребёнка: в количестве соединений без номера целевого узла
+ * или, если количество ссылок уже построено, в нём
+ * \param[in] this Родительский patch-узел
+ * \param[in] connection Соединение ребёнка
+ */
+template <class Label>
+void BasicPatchNode<Label>::trackConnection(const BasicPatchConnection<Label>& connection)
+{
+	if (connection.targetIndex < 0) {
+		this->untrackedConnections++;
+		return;
+	}
+	if (this->referenceCounts.empty())
+		return;
+
+	if (this->referenceCounts.size() <= (size_t)connection.targetIndex)
+		this->referenceCounts.resize(connection.targetIndex + 1, 0);
+	this->referenceCounts[connection.targetIndex]++;
+}
+
+/**
+ * Построить количество ссылок на детей сравниваемого узла и место под битовое множество удалённых детей.
+ * Оба списка выделяются один раз нужного размера: в арене память перевыделенных списков не возвращается
+ * \param[in] this Родительский patch-узел
+ * \param[in] targetsCount Наименьшее количество детей сравниваемого узла
+ */
+template <class Label>
+void BasicPatchNode<Label>::indexReferences(size_t targetsCount)
+{
+	for (const auto& patchChild : this->children) {
+		for (const auto& connection : patchChild->connections)
+			targetsCount = max(targetsCount, (size_t)(connection.targetIndex + 1));
+	}
+
+	this->referenceCounts.assign(targetsCount, 0);
+	this->removedChildren.assign((targetsCount + 63) / 64, 0);
+	for (const auto& patchChild : this->children) {
+		for (const auto& connection : patchChild->connections) {
+			if (connection.targetIndex >= 0)
+				this->referenceCounts[connection.targetIndex]++;
+		}
+	}
+}
+
+/**
+ * Узнать, удалён ли целевой узел соединения из дерева разности
+ * \param[in] this Patch-узел, которому принадлежит соединение
+ * \param[in] connection Соединение
+ * \return Логический флаг, удалён ли целевой узел
+ */
+template <class Label>
+bool BasicPatchNode<Label>::isRemoved(const BasicPatchConnection<Label>& connection) const
+{
+	return this->parent != nullptr && connection.targetIndex >= 0 && testBit(this->parent->removedChildren, connection.targetIndex);
+}
+
 /**
  * Добавить соединение к patch-узлу
  * \param[in] this Patch-узел
  * \param[in] weight Вес нового соединения
  * \param[in] searchedSubTree Целевое дерево
+ * \param[in] connectionPatch Patch-дерево для пары соединённых узлов
+ * \param[in] targetIndex Номер целевого дерева среди детей его родителя (-1, если не известен)
  */
-void PatchNode::addConnection(int weight, Node* searchedSubTree)
+template <class Label>
+void BasicPatchNode<Label>::addConnection(int weight, const BasicNode<Label>* searchedSubTree, unique_ptr<BasicPatchNode<Label>> connectionPatch, int targetIndex)
 {
-	auto newPair = make_pair(searchedSubTree, weight);
-	for (auto conIt = this->connections.begin(); conIt < this->connections.end(); ++conIt) {
-		if ((*conIt).second > weight) {
-			this->connections.insert(conIt, newPair);
-			return;
-		}
-	}
-	this->connections.push_back(newPair);
+	BasicPatchConnection<Label> newConnection{ searchedSubTree, weight, move(connectionPatch), targetIndex };
+	SearchStats::count(StatsCounter::ConnectionsCreated);
+	if (this->parent != nullptr)
+		this->parent->trackConnection(newConnection);
+	this->connections.push_back(move(newConnection));
 }
 
 /**
@@ -515,25 +1616,38 @@ void PatchNode::addConnection(int weight, Node* searchedSubTree)
  * \param[in] this patch-узел
  * \return Список всех детей patch-узла
  */
-vector<PatchNode*> PatchNode::getChildren() const
+template <class Label>
+vector<BasicPatchNode<Label>*> BasicPatchNode<Label>::getChildren() const
 {
-	vector<PatchNode*> resChildren;
+	vector<BasicPatchNode<Label>*> resChildren;
 	for (const auto& child : this->children) {
 		resChildren.push_back(child.get());
 	}
 	return resChildren;
 }
 
+/**
+ * Дети patch-узла без построения нового списка
+ * \param[in] this patch-узел
+ * \return Представление детей patch-узла, действительное до изменения списка детей
+ */
+template <class Label>
+PointerView<BasicPatchNode<Label>> BasicPatchNode<Label>::getChildrenView() const
+{
+	return PointerView<BasicPatchNode<Label>>(this->children.data(), this->children.size());
+}
+
 /**
  * Поиск исходящего из patch-узла соединения, указывающего на заданный узел дерева
  * \param[in] this patch-узел
  * \param[in] searchedNode Узел дерева
  * \return Соединения, связывающее patch-узел и узел дерева
  */
-vector<pair<Node*, int>>::const_iterator PatchNode::findConnection(const Node* searchedNode) const
+template <class Label>
+typename pmr::vector<BasicPatchConnection<Label>>::const_iterator BasicPatchNode<Label>::findConnection(const BasicNode<Label>* searchedNode) const
 {
 	for (auto i = this->connections.begin(); i < this->connections.end(); i++) {
-		if ((*i).first == searchedNode) {
+		if ((*i).target == searchedNode && !this->isRemoved(*i)) {
 			return i;
 		}
 	}
@@ -541,32 +1655,88 @@ vector<pair<Node*, int>>::const_iterator PatchNode::findConnection(const Node* s
 }
 
 /**
- * Поиск наименьшего валидного(с неотрицательным весом) соединения
+ * Поиск наименьшего валидного(с неотрицательным весом) соединения. Соединения хранятся в порядке добавления,
+ * поэтому из равных по весу выбирается добавленное раньше
  * \param this patch-узел, среди соединений которого производится поиск
  * \param startIndex Начальная позиция поиска
  * \return Индекс наименьшего валидного соедниения среди соединений patch-узла
  */
-int PatchNode::findMinValidConnection(int startIndex) const
+template <class Label>
+int BasicPatchNode<Label>::findMinValidConnection(int startIndex) const
 {
-	for (int i = startIndex; i < this->connections.size(); i++) {
-		if (this->connections[i].second != -1)
-			return i;
+	int minIndex = -1;
+	for (int i = startIndex; i < (int)this->connections.size(); i++) {
+		const BasicPatchConnection<Label>& connection = this->connections[i];
+		if (connection.weight == -1 || this->isRemoved(connection))
+			continue;
+		if (minIndex == -1 || connection.weight < this->connections[minIndex].weight)
+			minIndex = i;
 	}
-	return -1;
+	return minIndex;
+}
+
+/**
+ * Закрепить за patch-узлом соединение с заданным узлом
+ * \param this patch-узел
+ * \param searchedNode Узел сравниваемого дерева
+ */
+template <class Label>
+void BasicPatchNode<Label>::selectConnection(const BasicNode<Label>* searchedNode)
+{
+	this->selectedTarget = searchedNode;
+}
+
+/**
+ * Поиск соединения, закреплённого за patch-узлом
+ * \param this patch-узел
+ * \return Индекс закреплённого соединения, а если оно не задано - наименьшего валидного соединения
+ */
+template <class Label>
+int BasicPatchNode<Label>::findSelectedConnection() const
+{
+	if (this->selectedTarget == nullptr)
+		return this->findMinValidConnection();
+
+	auto selected = this->findConnection(this->selectedTarget);
+	if (selected == this->connections.end())
+		return -1;
+	return selected - this->connections.begin();
 }
 
-// Возвращает массив детей дерева, на которых не нашлось узлов патча среди детей текущего patchNode
-vector<Node*> PatchNode::findUncaughtChildren(const Node* treeNode) const
+/**
+ * Поиск детей узла сравниваемого дерева, на которые не ссылается ни одно соединение детей patch-узла.
+ * Покрытие собирается по соединениям при вызове, а не хранится в patch-узле
+ * \param this patch-узел
+ * \param treeNode Узел сравниваемого дерева, для которого строился patch-узел
+ * \return Непокрытые дети узла
+ */
+template <class Label>
+vector<BasicNode<Label>*> BasicPatchNode<Label>::findUncaughtChildren(const BasicNode<Label>* treeNode) const
 {
-	vector<Node*> uncaughtChildren = treeNode->getChildren();
+	size_t childrenCount = treeNode->getChildrenCount();
+	vector<bool> covered(childrenCount, false);
+	for (const auto& patchChild : this->children) {
+		for (const auto& connection : patchChild->connections) {
+			if (connection.targetIndex >= 0 && (size_t)connection.targetIndex < childrenCount)
+				covered[connection.targetIndex] = true;
+		}
+	}
+
+	vector<BasicNode<Label>*> uncaughtChildren;
+	for (size_t index = 0; index < childrenCount; index++) {
+		if (!covered[index])
+			uncaughtChildren.push_back(treeNode->getChild(index));
+	}
+
+	if (this->untrackedConnections == 0)
+		return uncaughtChildren;
+
+	// Соединения без номера целевого узла проверяются перебором
 	for (const auto& patchChild : this->children) {
-		for (const auto& patchChildConnection : patchChild->getConnections()) {
-			if (!treeNode->isChild(patchChildConnection.first)) {
+		for (const auto& patchChildConnection : patchChild->connections) {
+			if (patchChildConnection.targetIndex >= 0)
 				continue;
-			}
-			auto it = std::find_if(uncaughtChildren.begin(), uncaughtChildren.end(), [patchChildConnection](const Node* child) {
-				return patchChildConnection.first == child;
-				});
+			auto it = std::find(uncaughtChildren.begin(), uncaughtChildren.end(), patchChildConnection.target);
 			if (it != uncaughtChildren.end())
 				uncaughtChildren.erase(it);
 		}
@@ -575,6 +1745,13 @@ vector<Node*> PatchNode::findUncaughtChildren(const Node* treeNode) const
 }
 
 
+template class BasicNode<TextLabel>;
+template class BasicNode<uint32_t>;
+template class BasicNode<InternedLabel>;
+template class BasicPatchNode<TextLabel>;
+template class BasicPatchNode<uint32_t>;
+template class BasicPatchNode<InternedLabel>;
+
 class ExcForbiddenSymbol : public std::exception
 {
 public:
@@ -585,7 +1762,7 @@ public:
 
 	const char* what() const noexcept override
 	{
-		string msg = "Detected invalid character \'" + to_string(symbol) + "\'" + "in the file \'" + filename + "\'";
+		msg = "Detected invalid character \'" + to_string(symbol) + "\'" + "in the file \'" + filename + "\'";
 		return msg.c_str();
 	}
 
@@ -596,6 +1773,7 @@ public:
 protected:
 	unsigned char symbol;
 	string filename;
+	mutable std::string msg;
 };
 
 class ExcSeveralTrees : public std::exception
@@ -643,7 +1821,7 @@ public:
 	{
 		this->nodeType = type;
 	}
-	Lexem(LexemType type, const string& nodeName)
+	Lexem(LexemType type, string_view nodeName)
 	{
 		this->nodeType = type;
 		this->nodeName = nodeName;
@@ -651,7 +1829,7 @@ public:
 	string getName() const
 	{
 		if (nodeType == LexemType::Node)
-			return this->nodeName;
+			return string(this->nodeName);
 		else if (nodeType == LexemType::LeftBracket)
 			return "LEFT_BRACKET";
 		else if (nodeType == LexemType::RightBracket)
@@ -662,42 +1840,30 @@ public:
 	{
 		return this->nodeType;
 	}
+	// Имя узла, указывающее во входной текст
+	string_view getLabel() const
+	{
+		return this->nodeName;
+	}
 protected:
 	LexemType nodeType;
-	string nodeName;
+	string_view nodeName;
 };
 
 
+// Лексемы хранятся в векторе, память которого учитывается статистикой поиска
+using LexemVector = vector<Lexem, StatsAllocator<Lexem, StatsStructure::Lexems>>;
 
-bool readFile(const string& path, string& content)
-{
-	bool success = false;
-	string line;
-
-	ifstream in(path); // îêðûâàåì ôàéë äëÿ ÷òåíèÿ
-	if (in.is_open())
-	{
-		// ñ÷èòûâàåì òåêñòîâûé ôàéë è çàïèñûâàåì åãî â îäíó ñòðîêó
-		while (getline(in, line))
-		{
-			content += line;
-		}
-		success = true;
-	}
-	in.close();     // çàêðûâàåì ôàéë
-	return success;
-}
-
-string extractWord(const string& str, unsigned startIndex, const string& delimiters)
+string_view extractWord(string_view str, unsigned startIndex, const string& delimiters)
 {
 	// Найти конец слова
 	auto word_end = str.find_first_of(delimiters, startIndex);
 
-	// Вырезать слово
+	// Вырезать слово без копирования
 	return str.substr(startIndex, word_end - startIndex);
 }
 
-int countLexemOfType(const vector<Lexem>& lexems, LexemType targetType) 
+int countLexemOfType(const LexemVector& lexems, LexemType targetType) 
 {
 	int targetLexemsCount = 0;
 	for (const auto& lexem : lexems) {
@@ -707,12 +1873,20 @@ int countLexemOfType(const vector<Lexem>& lexems, LexemType targetType)
 	return targetLexemsCount;
 }
 
-vector<Lexem> strToLexems(const string& content, const string& delimiters)
+/**
+ * Выделить лексемы из части текста
+ * \param[in] content Текст
+ * \param[in] startIndex Номер символа, с которого начинается разбор
+ * \param[in] delimiters Разделители
+ * \param[in] complete Логический флаг, известен ли текст целиком; иначе слово, дошедшее до конца текста, откладывается
+ * \param[in,out] lexems Лексемы
+ * \return Номер первого неразобранного символа
+ */
+size_t appendLexems(string_view content, size_t startIndex, const string& delimiters, bool complete, LexemVector& lexems)
 {
-	vector<Lexem> lexems;
-	int i = 0;
-	int contentLength = content.length();
-	for (i; i < contentLength; i++)
+	size_t contentLength = content.length();
+	size_t i = startIndex;
+	for (; i < contentLength; i++)
 	{
 		const char curSymbol = content[i];
 		if (curSymbol == '(')
@@ -725,7 +1899,9 @@ vector<Lexem> strToLexems(const string& content, const string& delimiters)
 		}
 		else if (isalnum(curSymbol))
 		{
-			string nodeName = extractWord(content, i, delimiters);
+			string_view nodeName = extractWord(content, i, delimiters);
+			if (!complete && i + nodeName.length() == contentLength)
+				break;
 			lexems.emplace_back(LexemType::Node, nodeName);
 			i += nodeName.length() - 1;
 		}
@@ -736,19 +1912,33 @@ vector<Lexem> strToLexems(const string& content, const string& delimiters)
 		}
 		
 	}
+	return i;
+}
+
+void checkBracketBalance(const LexemVector& lexems)
+{
 	int bracketBalance = countLexemOfType(lexems, LexemType::LeftBracket) - countLexemOfType(lexems, LexemType::RightBracket);
 	if (bracketBalance != 0) {
 		ExcBadBrackets exception(bracketBalance);
 		throw exception;
 	}
+}
+
+LexemVector strToLexems(const string& content, const string& delimiters)
+{
+	LexemVector lexems;
+	appendLexems(content, 0, delimiters, true, lexems);
+	checkBracketBalance(lexems);
 	return lexems;
 }
 
-unique_ptr<Node> sexpToTree(vector<Lexem>& lexems, int& index) {
+unique_ptr<Node> sexpToTree(LexemVector& lexems, int& index, const shared_ptr<const string>& content, vector<unique_ptr<Node>>& pendingChildren) {
 
-	auto root = make_unique<Node>(lexems[index].getName());
+	auto root = make_unique<Node>(TextLabel{ lexems[index].getLabel(), content });
+	// Дети копятся в общем для всех уровней векторе и добавляются вместе, чтобы индекс детей по именам строился один раз
+	size_t firstChild = pendingChildren.size();
 	index++;
-	int lexemsSize = index < lexems.size();
+	int lexemsSize = lexems.size();
 	while (index < lexemsSize) {
 		Lexem curLexem = lexems[index];
 		Lexem nextLexem(LexemType::Unknown);
@@ -760,27 +1950,46 @@ unique_ptr<Node> sexpToTree(vector<Lexem>& lexems, int& index) {
 			unique_ptr<Node> child;
 
 			if (nextLexem.getType() == LexemType::LeftBracket)
-				child = sexpToTree(lexems, index);
+				child = sexpToTree(lexems, index, content, pendingChildren);
 			else
-				child = make_unique<Node>(curLexem.getName());
+				child = make_unique<Node>(TextLabel{ curLexem.getLabel(), content });
 
-			root->addChild(move(child));
+			pendingChildren.push_back(move(child));
 			index++;
 		}
 		else if (curLexem.getType() == LexemType::RightBracket)
-			return root;
+			break;
 		else
 			index++;
 	}
+	root->addChildren(pendingChildren, firstChild);
 	return root;
 }
 
 unique_ptr<Node> parseOnTree(const string& content, const string& delimiters, int startIndex)
+{
+	return parseOnTree(make_shared<const string>(content), delimiters, startIndex);
+}
+
+/**
+ * Разобрать дерево из текста, не копируя имена узлов: узлы ссылаются на текст и держат его живым
+ * \param[in] content Текст дерева
+ * \param[in] delimiters Разделители
+ * \param[in] startIndex Номер лексемы, с которой начинается разбор
+ * \return Построенное дерево
+ */
+unique_ptr<Node> parseOnTree(shared_ptr<const string> content, const string& delimiters, int startIndex)
 {
 	unique_ptr<Node> builtTree;
 	try {
-		vector<Lexem> lexems = strToLexems(content, delimiters);
-		builtTree = sexpToTree(lexems, startIndex);
+		LexemVector lexems;
+		{
+			PhaseTimer timer(StatsPhase::Lexing);
+			lexems = strToLexems(*content, delimiters);
+		}
+		PhaseTimer timer(StatsPhase::TreeBuilding);
+		vector<unique_ptr<Node>> pendingChildren;
+		builtTree = sexpToTree(lexems, startIndex, content, pendingChildren);
 	}
 	catch (ExcBadBrackets& bracketException) {
 		throw bracketException;
@@ -794,17 +2003,709 @@ unique_ptr<Node> parseOnTree(const string& content, const string& delimiters, in
 	return builtTree;
 }
 
+/**
+ * Разобрать дерево из читаемого файла. Лексемы выделяются из уже прочитанной части текста, пока файл дочитывается,
+ * поэтому к концу чтения остаётся только построить дерево
+ * \param[in] file Читаемый файл
+ * \param[in] delimiters Разделители
+ * \return Построенное дерево или nullptr, если файл не удалось прочитать или в нём нет узлов
+ */
+unique_ptr<Node> parseOnTree(AsyncFileReader& file, const string& delimiters)
+{
+	LexemVector lexems;
+	const char* buffer = file.getText(0).data();
+	size_t lexed = 0;
+	size_t available = 0;
+	for (size_t length = file.waitForText(0); length > available; length = file.waitForText(available)) {
+		available = length;
+		PhaseTimer timer(StatsPhase::Lexing);
+		lexed = appendLexems(file.getText(available), lexed, delimiters, false, lexems);
+	}
+
+	auto content = file.getContent();
+	{
+		PhaseTimer timer(StatsPhase::Lexing);
+		// Если файл вырос при чтении, буфер мог перевыделиться, и лексемы ссылаются на старый текст
+		if (content->data() != buffer) {
+			lexems.clear();
+			lexed = 0;
+		}
+		appendLexems(*content, lexed, delimiters, true, lexems);
+		checkBracketBalance(lexems);
+	}
+	if (lexems.empty())
+		return nullptr;
+
+	PhaseTimer timer(StatsPhase::TreeBuilding);
+	int startIndex = 0;
+	vector<unique_ptr<Node>> pendingChildren;
+	return sexpToTree(lexems, startIndex, content, pendingChildren);
+}
+
+/**
+ * Разобрать дерево из текста сразу в DAG одинаковых поддеревьев, не строя узлы обычного дерева.
+ * Лексемы разбираются так же, как в sexpToTree
+ * \param[in] content Текст дерева
+ * \param[in] delimiters Разделители
+ * \return DAG дерева
+ */
+TreeDag parseOnDag(shared_ptr<const string> content, const string& delimiters)
+{
+	LexemVector lexems;
+	{
+		PhaseTimer timer(StatsPhase::Lexing);
+		lexems = strToLexems(*content, delimiters);
+	}
+
+	PhaseTimer timer(StatsPhase::TreeBuilding);
+	TreeDag dag;
+	int lexemsSize = lexems.size();
+	if (lexemsSize == 0)
+		return dag;
+
+	int openCount = 1;
+	dag.openNode(TextLabel{ lexems[0].getLabel(), content });
+	for (int index = 1; index < lexemsSize && openCount > 0; index++) {
+		const Lexem& curLexem = lexems[index];
+		if (curLexem.getType() == LexemType::Node) {
+			dag.openNode(TextLabel{ curLexem.getLabel(), content });
+			if (index < lexemsSize - 1 && lexems[index + 1].getType() == LexemType::LeftBracket)
+				openCount++;
+			else
+				dag.closeNode();
+		}
+		else if (curLexem.getType() == LexemType::RightBracket) {
+			dag.closeNode();
+			openCount--;
+		}
+	}
+	for (; openCount > 0; openCount--)
+		dag.closeNode();
+	return dag;
+}
+
+/**
+ * Построить копию текстового дерева с метками другого типа.
+ * Так текстовый разборщик служит входом и для деревьев с числовыми или интернированными метками
+ * \param[in] tree Текстовое дерево
+ * \return Дерево с метками типа Label
+ */
+template <class Label>
+unique_ptr<BasicNode<Label>> convertTree(const Node* tree)
+{
+	auto root = make_unique<BasicNode<Label>>(tree->getName());
+	vector<unique_ptr<BasicNode<Label>>> children;
+	for (auto child : tree->getChildrenView()) {
+		children.push_back(convertTree<Label>(child));
+	}
+	root->addChildren(children);
+	return root;
+}
+
+template unique_ptr<IdNode> convertTree<uint32_t>(const Node* tree);
+template unique_ptr<InternedNode> convertTree<InternedLabel>(const Node* tree);
+
+/**
+ * Разобрать название способа сопоставления детей
+ * \param[in] note Название способа: unordered, subsequence или exact
+ * \param[out] policy Способ сопоставления детей
+ * \return Успешность разбора
+ */
+bool parseMatchPolicy(const string& note, MatchPolicy& policy)
+{
+	if (note == "unordered")
+		policy = MatchPolicy::Unordered;
+	else if (note == "subsequence")
+		policy = MatchPolicy::OrderedSubsequence;
+	else if (note == "exact")
+		policy = MatchPolicy::OrderedExact;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * Дочитать и разобрать файл с деревом, сообщая об ошибках в консоль
+ * \param[in] file Читаемый файл
+ * \param[in] delimiters Разделители
+ * \return Дерево или nullptr, если файл не удалось прочитать или разобрать
+ */
+unique_ptr<Node> loadTreeFile(AsyncFileReader& file, const string& delimiters)
+{
+	const string& path = file.getPath();
+	try {
+		auto tree = parseOnTree(file, delimiters);
+		if (tree == nullptr)
+			cout << "File '" << path << "' not exists or is empty" << endl;
+		return tree;
+	}
+	catch (ExcBadBrackets& bracketException) {
+		cout << bracketException.what() << endl;
+	}
+	catch (ExcForbiddenSymbol& symbolException) {
+		symbolException.setFilename(path);
+		cout << symbolException.what() << endl;
+	}
+	catch (...) {
+		cout << "Can't parse file '" + path + "'" << endl;
+	}
+	return nullptr;
+}
+
+/**
+ * Прочитать и разобрать файл с деревом, сообщая об ошибках в консоль
+ * \param[in] path Путь к файлу
+ * \param[in] delimiters Разделители
+ * \return Дерево или nullptr, если файл не удалось прочитать или разобрать
+ */
+unique_ptr<Node> loadTreeFile(const string& path, const string& delimiters)
+{
+	AsyncFileReader file(path);
+	return loadTreeFile(file, delimiters);
+}
+
+/**
+ * Вывести в консоль результат поиска поддерева
+ * \param[in] delta Количество недостающих узлов
+ * \param[in] deltaTree Дерево разности
+ */
+void printSearchResult(int delta, const Node* deltaTree)
+{
+	PhaseTimer timer(StatsPhase::Print);
+	if (delta != -1 && deltaTree == nullptr) {
+		cout << "The searched tree is completely contained in the given tree.";
+	}
+	else if (delta == -1 && deltaTree == nullptr) {
+		cout << "The searched tree is not in the given tree.";
+	}
+	else if (deltaTree != nullptr) {
+		cout << "The searched tree is partially contained in the given tree. \nCorresponding delta tree:" << endl;
+		cout << delta << endl;
+		deltaTree->print();
+	}
+}
+
+/**
+ * Построить индекс pq-грамм по файлам главных деревьев и сохранить его
+ * \param[in] indexPath Путь к файлу индекса
+ * \param[in] treePaths Пути к файлам главных деревьев
+ * \param[in] delimiters Разделители
+ * \return Код возврата программы
+ */
+int buildIndexFile(const string& indexPath, const vector<string>& treePaths, const string& delimiters)
+{
+	PqGramIndex index;
+	unique_ptr<AsyncFileReader> nextFile = make_unique<AsyncFileReader>(treePaths[0]);
+	for (size_t i = 0; i < treePaths.size(); i++) {
+		// Следующий файл читается, пока разбирается и индексируется текущий
+		auto file = move(nextFile);
+		if (i + 1 < treePaths.size())
+			nextFile = make_unique<AsyncFileReader>(treePaths[i + 1]);
+		auto tree = loadTreeFile(*file, delimiters);
+		if (tree == nullptr)
+			return -1;
+		index.addTree(treePaths[i], tree.get());
+	}
+
+	if (!index.save(indexPath)) {
+		cout << "Can't write index file '" << indexPath << "'" << endl;
+		return -1;
+	}
+	cout << "Indexed " << index.size() << " trees into '" << indexPath << "'" << endl;
+	return 0;
+}
+
+/**
+ * Отобрать по индексу pq-грамм похожие главные деревья и выполнить точный поиск только в них
+ * \param[in] indexPath Путь к файлу индекса
+ * \param[in] searchedTreePath Путь к файлу искомого дерева
+ * \param[in] maxTrees Наибольшее количество проверяемых главных деревьев
+ * \param[in] delimiters Разделители
+ * \param[in] policy Способ сопоставления детей
+ * \return Код возврата программы
+ */
+int searchIndexFile(const string& indexPath, const string& searchedTreePath, size_t maxTrees, const string& delimiters, MatchPolicy policy)
+{
+	const size_t maxRootsPerTree = 8;
+
+	// Искомое дерево читается одновременно с загрузкой индекса
+	AsyncFileReader searchedTreeFile(searchedTreePath);
+	PqGramIndex index;
+	if (!index.load(indexPath)) {
+		cout << "Can't read index file '" << indexPath << "'" << endl;
+		return -1;
+	}
+	auto searchedTree = loadTreeFile(searchedTreeFile, delimiters);
+	if (searchedTree == nullptr)
+		return -1;
+
+	auto candidates = index.shortlist(searchedTree.get(), maxTrees, maxRootsPerTree);
+	if (candidates.empty()) {
+		cout << "The searched tree is not in the indexed trees.";
+		return 0;
+	}
+
+	unique_ptr<AsyncFileReader> nextFile = make_unique<AsyncFileReader>(index.getPath(candidates[0].treeIndex));
+	for (size_t i = 0; i < candidates.size(); i++) {
+		const auto& candidate = candidates[i];
+		const string& mainTreePath = index.getPath(candidate.treeIndex);
+		cout << "'" << mainTreePath << "' (similarity " << candidate.score << "):" << endl;
+
+		// Следующее главное дерево читается, пока ищется поддерево в текущем
+		auto file = move(nextFile);
+		if (i + 1 < candidates.size())
+			nextFile = make_unique<AsyncFileReader>(index.getPath(candidates[i + 1].treeIndex));
+		auto mainTree = loadTreeFile(*file, delimiters);
+		if (mainTree == nullptr)
+			continue;
+
+		// Файл мог измениться после построения индекса, поэтому имена корней проверяются заново
+		vector<const Node*> roots;
+		for (const auto& root : findPreorderNodes(mainTree.get(), candidate.roots)) {
+			if (root->getLabel() == searchedTree->getLabel())
+				roots.push_back(root);
+		}
+
+		unique_ptr<Node> deltaTree;
+		int delta = mainTree->findSubTreeAmong(roots, searchedTree.get(), deltaTree, policy);
+		printSearchResult(delta, deltaTree.get());
+		cout << endl;
+	}
+	return 0;
+}
+
+/**
+ * Поиск поддерева в главном дереве, загруженном как DAG одинаковых поддеревьев.
+ * Выводятся результат поиска и пути до всех лучших вхождений
+ * \param[in] mainTreePath Путь к файлу главного дерева
+ * \param[in] searchedTreePath Путь к файлу искомого дерева
+ * \param[in] delimiters Разделители
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] countOnly Логический флаг, выводить ли только количество недостающих узлов
+ * \return Код возврата программы
+ */
+int searchDagFile(const string& mainTreePath, const string& searchedTreePath, const string& delimiters, MatchPolicy policy, bool countOnly)
+{
+	AsyncFileReader mainTreeFile(mainTreePath), searchedTreeFile(searchedTreePath);
+	if (mainTreeFile.isEmpty()) {
+		cout << "File '" << mainTreePath << "' not exists or is empty" << endl;
+		return -1;
+	}
+	TreeDag mainDag;
+	try {
+		mainDag = parseOnDag(mainTreeFile.getContent(), delimiters);
+	}
+	catch (ExcBadBrackets& bracketException) {
+		cout << bracketException.what() << endl;
+		return -1;
+	}
+	catch (ExcForbiddenSymbol& symbolException) {
+		symbolException.setFilename(mainTreePath);
+		cout << symbolException.what() << endl;
+		return -1;
+	}
+	auto searchedTree = loadTreeFile(searchedTreeFile, delimiters);
+	if (searchedTree == nullptr)
+		return -1;
+	cout << "Main tree: " << mainDag.getTreeSize() << " nodes, " << mainDag.size() << " distinct subtrees" << endl;
+
+	if (countOnly) {
+		int delta = mainDag.countMissingNodes(searchedTree.get(), policy);
+		if (delta == -1)
+			cout << "The searched tree is not in the given tree.";
+		else
+			cout << "Missing nodes: " << delta;
+		return 0;
+	}
+
+	unique_ptr<Node> deltaTree;
+	vector<TreeDag::Location> locations;
+	int delta = mainDag.findSubTree(searchedTree.get(), deltaTree, locations, policy);
+	printSearchResult(delta, deltaTree.get());
+	if (!locations.empty()) {
+		cout << endl << "Occurrences: " << locations.size() << endl;
+		for (const auto& location : locations) {
+			cout << "/";
+			for (size_t i = 0; i < location.size(); i++)
+				cout << (i == 0 ? "" : "/") << location[i];
+			cout << endl;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Поиск нескольких искомых деревьев в одном главном дереве за один обход
+ * \param[in] mainTreePath Путь к файлу главного дерева
+ * \param[in] searchedTreePaths Пути к файлам искомых деревьев
+ * \param[in] delimiters Разделители
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] countOnly Логический флаг, выводить ли только количество недостающих узлов
+ * \param[in] compact Логический флаг, укладывать ли главное дерево для последовательного доступа к памяти
+ * \return Код возврата программы
+ */
+int searchPatternFiles(const string& mainTreePath, const vector<string>& searchedTreePaths, const string& delimiters, MatchPolicy policy, bool countOnly, bool compact)
+{
+	// Первое искомое дерево читается вместе с главным, каждое следующее - пока разбирается предыдущее
+	AsyncFileReader mainTreeFile(mainTreePath);
+	unique_ptr<AsyncFileReader> nextFile = make_unique<AsyncFileReader>(searchedTreePaths[0]);
+	auto loadedTree = loadTreeFile(mainTreeFile, delimiters);
+	if (loadedTree == nullptr)
+		return -1;
+	unique_ptr<CompactTree> compactTree;
+	if (compact) {
+		compactTree = make_unique<CompactTree>(loadedTree.get());
+		loadedTree.reset();
+	}
+	const Node* mainTree = compact ? compactTree->getRoot() : loadedTree.get();
+
+	vector<unique_ptr<Node>> searchedTrees;
+	MultiPatternSearch engine(policy);
+	for (size_t i = 0; i < searchedTreePaths.size(); i++) {
+		auto file = move(nextFile);
+		if (i + 1 < searchedTreePaths.size())
+			nextFile = make_unique<AsyncFileReader>(searchedTreePaths[i + 1]);
+		searchedTrees.push_back(loadTreeFile(*file, delimiters));
+		if (searchedTrees.back() == nullptr)
+			return -1;
+		engine.addPattern(searchedTrees.back().get());
+	}
+
+	auto matches = engine.search(mainTree);
+	for (size_t i = 0; i < matches.size(); i++) {
+		cout << "'" << searchedTreePaths[i] << "':" << endl;
+		if (countOnly) {
+			if (matches[i].delta == -1)
+				cout << "The searched tree is not in the given tree.";
+			else
+				cout << "Missing nodes: " << matches[i].delta;
+		}
+		else {
+			unique_ptr<Node> deltaTree;
+			int delta = engine.buildDeltaTree(mainTree, i, matches[i], deltaTree);
+			printSearchResult(delta, deltaTree.get());
+		}
+		cout << endl;
+	}
+	return 0;
+}
+
+/**
+ * Поиск искомого дерева в каждом дереве потока. Результаты выводятся по мере чтения,
+ * а каждое главное дерево освобождается до чтения следующего
+ * \param[in] streamPath Путь к файлу с последовательностью главных деревьев ("-" - стандартный ввод)
+ * \param[in] searchedTreePath Путь к файлу искомого дерева
+ * \param[in] delimiters Разделители
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] countOnly Логический флаг, выводить ли только количество недостающих узлов
+ * \return Код возврата программы
+ */
+int searchStreamFile(const string& streamPath, const string& searchedTreePath, const string& delimiters, MatchPolicy policy, bool countOnly)
+{
+	auto searchedTree = loadTreeFile(searchedTreePath, delimiters);
+	if (searchedTree == nullptr)
+		return -1;
+
+	ifstream file;
+	if (streamPath != "-") {
+		file.open(streamPath);
+		if (!file.is_open()) {
+			cout << "File '" << streamPath << "' not exists" << endl;
+			return -1;
+		}
+	}
+	TreeStreamReader reader(streamPath == "-" ? cin : file, delimiters);
+
+	while (!reader.isFinished()) {
+		unique_ptr<Node> mainTree;
+		try {
+			mainTree = reader.next();
+		}
+		catch (ExcBadBrackets& bracketException) {
+			cout << "Tree " << reader.getTreesRead() << ": " << bracketException.what() << endl;
+			continue;
+		}
+		catch (ExcForbiddenSymbol& symbolException) {
+			symbolException.setFilename(streamPath);
+			cout << "Tree " << reader.getTreesRead() << ": " << symbolException.what() << endl;
+			continue;
+		}
+		catch (...) {
+			cout << "Tree " << reader.getTreesRead() << ": can't parse the tree" << endl;
+			continue;
+		}
+		if (mainTree == nullptr)
+			break;
+
+		cout << "Tree " << reader.getTreesRead() << ": ";
+		if (countOnly) {
+			int delta = mainTree->countMissingNodes(searchedTree.get(), policy);
+			if (delta == -1)
+				cout << "The searched tree is not in the given tree.";
+			else
+				cout << "Missing nodes: " << delta;
+		}
+		else {
+			unique_ptr<Node> deltaTree;
+			int delta = mainTree->findSubTree(searchedTree.get(), deltaTree, policy);
+			printSearchResult(delta, deltaTree.get());
+		}
+		cout << endl;
+	}
+	return 0;
+}
+
+/**
+ * Поиск первого в прямом порядке вхождения, которому недостаёт не больше заданного количества узлов.
+ * Кандидаты после найденного вхождения не оцениваются
+ * \param[in] mainTreePath Путь к файлу главного дерева
+ * \param[in] searchedTreePath Путь к файлу искомого дерева
+ * \param[in] delimiters Разделители
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] maxDelta Наибольшее допустимое количество недостающих узлов
+ * \param[in] countOnly Логический флаг, выводить ли только количество недостающих узлов
+ * \return Код возврата программы
+ */
+int searchFirstMatch(const string& mainTreePath, const string& searchedTreePath, const string& delimiters, MatchPolicy policy, int maxDelta, bool countOnly)
+{
+	AsyncFileReader mainTreeFile(mainTreePath), searchedTreeFile(searchedTreePath);
+	auto mainTree = loadTreeFile(mainTreeFile, delimiters);
+	auto searchedTree = loadTreeFile(searchedTreeFile, delimiters);
+	if (mainTree == nullptr || searchedTree == nullptr)
+		return -1;
+
+	MatchEnumerator matches(mainTree.get(), searchedTree.get(), policy);
+	for (const auto& match : matches) {
+		if (match.delta > maxDelta)
+			continue;
+		if (countOnly) {
+			cout << "Missing nodes: " << match.delta;
+		}
+		else {
+			unique_ptr<Node> deltaTree;
+			int delta = matches.buildDeltaTree(match, deltaTree);
+			printSearchResult(delta, deltaTree.get());
+		}
+		return 0;
+	}
+	cout << "The searched tree is not in the given tree.";
+	return 0;
+}
+
+/**
+ * Разложить главное дерево в файл для поиска без загрузки дерева в память
+ * \param[in] layoutPath Путь к файлу раскладки
+ * \param[in] mainTreePath Путь к файлу главного дерева
+ * \param[in] delimiters Разделители
+ * \param[in] memoryBudget Ограничение памяти в байтах
+ * \return Код возврата программы
+ */
+int buildLayoutFile(const string& layoutPath, const string& mainTreePath, const string& delimiters, size_t memoryBudget)
+{
+	ifstream in(mainTreePath);
+	if (!in.is_open()) {
+		cout << "File '" << mainTreePath << "' not exists" << endl;
+		return -1;
+	}
+
+	string error;
+	if (!TreeLayout::build(in, layoutPath, delimiters, error, memoryBudget)) {
+		cout << error << endl;
+		return -1;
+	}
+	TreeLayout layout;
+	layout.open(layoutPath);
+	cout << "Laid out " << layout.size() << " nodes (" << layout.getLabelsCount() << " labels) into '" << layoutPath << "'" << endl;
+	return 0;
+}
+
+/**
+ * Поиск поддерева в главном дереве, разложенном в файл. В памяти находится только один кандидат
+ * \param[in] layoutPath Путь к файлу раскладки
+ * \param[in] searchedTreePath Путь к файлу искомого дерева
+ * \param[in] delimiters Разделители
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] countOnly Логический флаг, выводить ли только количество недостающих узлов
+ * \param[in] memoryBudget Ограничение памяти в байтах
+ * \return Код возврата программы
+ */
+int searchLayoutFile(const string& layoutPath, const string& searchedTreePath, const string& delimiters, MatchPolicy policy, bool countOnly, size_t memoryBudget)
+{
+	AsyncFileReader searchedTreeFile(searchedTreePath);
+	TreeLayout layout;
+	if (!layout.open(layoutPath)) {
+		cout << "Can't read layout file '" << layoutPath << "'" << endl;
+		return -1;
+	}
+	layout.setMemoryBudget(memoryBudget);
+	auto searchedTree = loadTreeFile(searchedTreeFile, delimiters);
+	if (searchedTree == nullptr)
+		return -1;
+
+	if (countOnly) {
+		int delta = layout.countMissingNodes(searchedTree.get(), policy);
+		if (delta == -1)
+			cout << "The searched tree is not in the given tree.";
+		else
+			cout << "Missing nodes: " << delta;
+	}
+	else {
+		unique_ptr<Node> deltaTree;
+		int delta = layout.findSubTree(searchedTree.get(), deltaTree, policy);
+		printSearchResult(delta, deltaTree.get());
+	}
+	if (layout.getSkippedCandidates() > 0)
+		cout << endl << "Warning: " << layout.getSkippedCandidates() << " candidates exceed the memory budget and were not checked";
+	return 0;
+}
+
+/**
+ * Завершить работу программы, выведя собранную статистику, если она собиралась
+ * \param[in] exitCode Код возврата программы
+ * \param[in] json Логический флаг, выводить ли статистику в формате JSON
+ * \return Код возврата программы
+ */
+int finishRun(int exitCode, bool json)
+{
+	if (SearchStats::isEnabled()) {
+		cout << endl;
+		SearchStats::report(cerr, json);
+	}
+	return exitCode;
+}
 
 int main(int argc, char* argv[])
 {
-	
-	if (argc != 3) {
-		cout << "There must be 2 command-line arguments(recieved "<< to_string(argc - 1) <<") : \n\t1.path to main tree \n\t2.path to searched tree \n\t3.path to result delta tree";
+	const string orderOption = "--order=";
+	const string metricOption = "--metric=";
+	const string buildIndexOption = "--build-index=";
+	const string indexOption = "--index=";
+	const string topOption = "--top=";
+	const string statsOption = "--stats";
+	const string dagOption = "--dag";
+	const string streamOption = "--stream";
+	const string firstOption = "--first";
+	const string compactOption = "--compact";
+	const string buildLayoutOption = "--build-layout=";
+	const string layoutOption = "--layout=";
+	const string memoryOption = "--memory=";
+	const string delimiters = "() \t\n\r";
+	MatchPolicy policy = MatchPolicy::Unordered;
+	SearchMetric metric = SearchMetric::MissingNodes;
+	string buildIndexPath, indexPath, buildLayoutPath, layoutPath;
+	size_t memoryBudget = TreeLayout::DEFAULT_MEMORY_BUDGET;
+	size_t maxIndexedTrees = 10;
+	bool statsJson = false;
+	bool dagMode = false;
+	bool streamMode = false;
+	bool firstMode = false;
+	bool compactMode = false;
+	int maxFirstDelta = INT_MAX;
+	vector<string> paths;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg.rfind(buildIndexOption, 0) == 0) {
+			buildIndexPath = arg.substr(buildIndexOption.length());
+		}
+		else if (arg.rfind(indexOption, 0) == 0) {
+			indexPath = arg.substr(indexOption.length());
+		}
+		else if (arg.rfind(buildLayoutOption, 0) == 0) {
+			buildLayoutPath = arg.substr(buildLayoutOption.length());
+		}
+		else if (arg.rfind(layoutOption, 0) == 0) {
+			layoutPath = arg.substr(layoutOption.length());
+		}
+		else if (arg.rfind(memoryOption, 0) == 0) {
+			memoryBudget = strtoul(arg.substr(memoryOption.length()).c_str(), nullptr, 10) * 1024 * 1024;
+		}
+		else if (arg.rfind(topOption, 0) == 0) {
+			maxIndexedTrees = strtoul(arg.substr(topOption.length()).c_str(), nullptr, 10);
+		}
+		else if (arg == statsOption || arg == statsOption + "=text" || arg == statsOption + "=json") {
+			SearchStats::enable(true);
+			statsJson = arg == statsOption + "=json";
+		}
+		else if (arg == dagOption) {
+			dagMode = true;
+		}
+		else if (arg == streamOption) {
+			streamMode = true;
+		}
+		else if (arg == compactOption) {
+			compactMode = true;
+		}
+		else if (arg == firstOption || arg.rfind(firstOption + "=", 0) == 0) {
+			firstMode = true;
+			if (arg != firstOption)
+				maxFirstDelta = atoi(arg.substr(firstOption.length() + 1).c_str());
+		}
+		else if (arg.rfind(orderOption, 0) == 0) {
+			if (!parseMatchPolicy(arg.substr(orderOption.length()), policy)) {
+				cout << "Unknown children order '" << arg.substr(orderOption.length()) << "' (expected unordered, subsequence or exact)" << endl;
+				return -1;
+			}
+		}
+		else if (arg.rfind(metricOption, 0) == 0) {
+			if (!parseSearchMetric(arg.substr(metricOption.length()), metric)) {
+				cout << "Unknown metric '" << arg.substr(metricOption.length()) << "' (expected delta, count or ted)" << endl;
+				return -1;
+			}
+		}
+		else {
+			paths.push_back(arg);
+		}
+	}
+
+	if (!buildIndexPath.empty()) {
+		if (paths.empty()) {
+			cout << "There must be at least one main tree to index";
+			return -1;
+		}
+		return finishRun(buildIndexFile(buildIndexPath, paths, delimiters), statsJson);
+	}
+	if (!indexPath.empty()) {
+		if (paths.size() != 1) {
+			cout << "There must be exactly one searched tree when searching by index";
+			return -1;
+		}
+		return finishRun(searchIndexFile(indexPath, paths[0], maxIndexedTrees, delimiters, policy), statsJson);
+	}
+
+	if (!buildLayoutPath.empty()) {
+		if (paths.size() != 1) {
+			cout << "There must be exactly one main tree to lay out";
+			return -1;
+		}
+		return finishRun(buildLayoutFile(buildLayoutPath, paths[0], delimiters, memoryBudget), statsJson);
+	}
+	if (!layoutPath.empty()) {
+		if (paths.size() != 1) {
+			cout << "There must be exactly one searched tree when searching a laid out tree";
+			return -1;
+		}
+		return finishRun(searchLayoutFile(layoutPath, paths[0], delimiters, policy, metric == SearchMetric::MissingCount, memoryBudget), statsJson);
+	}
+
+	if (streamMode) {
+		if (paths.size() != 2) {
+			cout << "There must be a stream of main trees (a file or - for stdin) and a searched tree";
+			return -1;
+		}
+		return finishRun(searchStreamFile(paths[0], paths[1], delimiters, policy, metric == SearchMetric::MissingCount), statsJson);
+	}
+	if (paths.size() > 2 && metric != SearchMetric::EditDistance && !dagMode)
+		return finishRun(searchPatternFiles(paths[0], vector<string>(paths.begin() + 1, paths.end()), delimiters, policy, metric == SearchMetric::MissingCount, compactMode), statsJson);
+
+	if (paths.size() != 2) {
+		cout << "There must be 2 command-line arguments(recieved "<< to_string(paths.size()) <<") : \n\t1.path to main tree \n\t2.path to searched tree (several searched trees are matched in one pass) \n\t[--order=unordered|subsequence|exact] children matching order \n\t[--metric=delta|count|ted] delta tree, missing nodes count only or tree edit distance \n\t[--stats[=text|json]] phase timings and work counters \n\t[--dag] share repeated subtrees of the main tree and report every occurrence \n\t[--stream] the main tree file (or - for stdin) holds a sequence of trees searched one by one \n\t[--first[=<delta>]] stop at the first occurrence missing at most <delta> nodes \n\t[--compact] lay the main tree out contiguously in memory before searching (pays off for many searched trees)"
+			"\nIndex modes: --build-index=<index> <main trees...> | --index=<index> [--top=<count>] <searched tree>"
+			"\nOut-of-core modes: --build-layout=<layout> <main tree> | --layout=<layout> [--memory=<MB>] <searched tree>";
 		return -1;
 	}
 
-	string mainTreePath = argv[1];
-	string searchedTreePath = argv[2];
+	string mainTreePath = paths[0];
+	string searchedTreePath = paths[1];
 	if (!std::filesystem::exists(mainTreePath)) {
 		cout << "File with the main tree not exists" << endl;
 		return -1;
@@ -813,24 +2714,26 @@ int main(int argc, char* argv[])
 		cout << "File with the searched tree not exists" << endl;
 		return -1;
 	}
+	if (firstMode && metric != SearchMetric::EditDistance)
+		return finishRun(searchFirstMatch(mainTreePath, searchedTreePath, delimiters, policy, maxFirstDelta, metric == SearchMetric::MissingCount), statsJson);
+	if (dagMode && metric != SearchMetric::EditDistance)
+		return finishRun(searchDagFile(mainTreePath, searchedTreePath, delimiters, policy, metric == SearchMetric::MissingCount), statsJson);
 	
 		
-	string mainTreeNote, searchedTreeNote;
+	// Узлы деревьев ссылаются на имена прямо в прочитанном тексте, поэтому текст хранится в общем буфере.
+	// Оба файла читаются одновременно, а главное дерево разбирается по мере чтения
 	// string mainTreePath = "E:\\was\\FindSubTree\\x64\\Release\\mainTree.txt";
 	// string searchedTreePath = "E:\\was\\FindSubTree\\x64\\Release\\searchedTree.txt";
-	readFile(mainTreePath, mainTreeNote);
-	readFile(searchedTreePath, searchedTreeNote);
+	AsyncFileReader mainTreeFile(mainTreePath), searchedTreeFile(searchedTreePath);
 
-	if (mainTreeNote.empty() || searchedTreeNote.empty()) {
+	if (mainTreeFile.isEmpty() || searchedTreeFile.isEmpty()) {
 		cout << "One or both files are empty";
 		return -1;
 	}
-	
-	string delimiters = "() \t\n\r";
 
 	unique_ptr<Node> mainTree, searchedTree, deltaTree;
 	try {
-		mainTree = parseOnTree(mainTreeNote, delimiters);
+		mainTree = parseOnTree(mainTreeFile, delimiters);
 	}
 	catch (ExcBadBrackets& bracketException) {
 		cout << bracketException.what() << endl;
@@ -845,7 +2748,7 @@ int main(int argc, char* argv[])
 	}
 
 	try {
-		searchedTree = parseOnTree(searchedTreeNote, delimiters);
+		searchedTree = parseOnTree(searchedTreeFile, delimiters);
 	}
 	catch (ExcBadBrackets& bracketException) {
 		cout << bracketException.what() << endl;
@@ -859,18 +2762,39 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	int delta = mainTree->findSubTree(searchedTree.get(), deltaTree);
-	if (delta != -1 && deltaTree.get() == nullptr) {
-		cout << "The searched tree is completely contained in the given tree.";
+	if (metric == SearchMetric::EditDistance) {
+		const Node* closestTree = nullptr;
+		int distance = findClosestSubTree(mainTree.get(), searchedTree.get(), &closestTree);
+		if (closestTree == nullptr) {
+			cout << "The searched tree is not in the given tree.";
+		}
+		else {
+			cout << "Tree edit distance to the closest subtree: " << distance << endl;
+			closestTree->print();
+		}
+		return finishRun(0, statsJson);
 	}
-	else if (delta == -1 && deltaTree.get() == nullptr) {
-		cout << "The searched tree is not in the given tree.";
+
+	// Плотная укладка заменяет разобранное главное дерево
+	unique_ptr<CompactTree> compactTree;
+	if (compactMode) {
+		compactTree = make_unique<CompactTree>(mainTree.get());
+		mainTree.reset();
 	}
-	else if (deltaTree.get() != nullptr) {
-		cout << "The searched tree is partially contained in the given tree. \nCorresponding delta tree:" << endl;
-		cout << delta << endl;
-		deltaTree->print();
+	const Node* searchedMainTree = compactMode ? compactTree->getRoot() : mainTree.get();
+
+	// Для одного количества недостающих узлов patch-графы и дерево разности не строятся
+	if (metric == SearchMetric::MissingCount) {
+		int delta = searchedMainTree->countMissingNodes(searchedTree.get(), policy);
+		if (delta == -1)
+			cout << "The searched tree is not in the given tree.";
+		else
+			cout << "Missing nodes: " << delta;
+		return finishRun(0, statsJson);
 	}
-	return 0;
+
+	int delta = searchedMainTree->findSubTree(searchedTree.get(), deltaTree, policy);
+	printSearchResult(delta, deltaTree.get());
+	return finishRun(0, statsJson);
 
 }
\ No newline at end of file
@@ -0,0 +1,382 @@
+﻿#include "findSubTreeApi.h"
+#include "findSubTree.h"
+#include "pqGramIndex.h"
+
+using namespace std;
+
+// Объекты интерфейса C - обёртки над объектами библиотеки
+struct fst_tree
+{
+	unique_ptr<Node> root;
+};
+
+struct fst_result
+{
+	int delta;
+	unique_ptr<Node> deltaTree;
+};
+
+struct fst_index
+{
+	PqGramIndex index;
+	// Главные деревья принадлежат вызывающему и должны жить, пока используется индекс
+	vector<const Node*> trees;
+};
+
+namespace {
+	const string DEFAULT_DELIMITERS = "() \t\n\r";
+	// Количество корней, проверяемых в каждом главном дереве, отобранном индексом (как в режиме --index)
+	const size_t MAX_INDEXED_ROOTS = 8;
+
+	const Node* toNode(const fst_node* node)
+	{
+		return reinterpret_cast<const Node*>(node);
+	}
+
+	const fst_node* fromNode(const Node* node)
+	{
+		return reinterpret_cast<const fst_node*>(node);
+	}
+
+	bool toPolicy(fst_policy policy, MatchPolicy& matchPolicy)
+	{
+		switch (policy) {
+		case FST_UNORDERED:
+			matchPolicy = MatchPolicy::Unordered;
+			return true;
+		case FST_SUBSEQUENCE:
+			matchPolicy = MatchPolicy::OrderedSubsequence;
+			return true;
+		case FST_EXACT:
+			matchPolicy = MatchPolicy::OrderedExact;
+			return true;
+		}
+		return false;
+	}
+}
+
+/**
+ * Версия интерфейса; меняется только при несовместимых изменениях
+ * \return Версия интерфейса
+ */
+int fst_api_version(void)
+{
+	return FST_API_VERSION;
+}
+
+/**
+ * Описание кода возврата
+ * \param[in] status Код возврата
+ * \return Строка описания (статическая)
+ */
+const char* fst_status_message(fst_status status)
+{
+	switch (status) {
+	case FST_OK:
+		return "Success";
+	case FST_ERROR_ARGUMENT:
+		return "Invalid argument";
+	case FST_ERROR_PARSE:
+		return "Can't parse the tree";
+	case FST_ERROR_MEMORY:
+		return "Out of memory";
+	case FST_ERROR_INTERNAL:
+		return "Internal error";
+	}
+	return "Unknown status";
+}
+
+/**
+ * Разобрать дерево из буфера в памяти. Текст копируется, поэтому буфер можно освободить сразу после вызова
+ * \param[in] text Текст дерева в виде s-выражения
+ * \param[in] length Длина текста
+ * \param[in] delimiters Разделители (NULL - пробельные символы и скобки)
+ * \param[out] tree Разобранное дерево, освобождаемое fst_free_tree
+ * \return Код возврата
+ */
+fst_status fst_parse_tree(const char* text, size_t length, const char* delimiters, fst_tree** tree)
+{
+	if (text == nullptr || tree == nullptr)
+		return FST_ERROR_ARGUMENT;
+	*tree = nullptr;
+	try {
+		auto content = make_shared<const string>(text, length);
+		string treeDelimiters = delimiters == nullptr ? DEFAULT_DELIMITERS : string(delimiters);
+		// Разборщик требует хотя бы одну лексему
+		if (content->find_first_not_of(treeDelimiters) == string::npos)
+			return FST_ERROR_PARSE;
+		auto root = parseOnTree(content, treeDelimiters);
+		*tree = new fst_tree{ move(root) };
+		return FST_OK;
+	}
+	catch (const bad_alloc&) {
+		return FST_ERROR_MEMORY;
+	}
+	catch (...) {
+		return FST_ERROR_PARSE;
+	}
+}
+
+/**
+ * Освободить дерево
+ * \param[in] tree Дерево (NULL допускается)
+ */
+void fst_free_tree(fst_tree* tree)
+{
+	delete tree;
+}
+
+/**
+ * Количество узлов дерева
+ * \param[in] tree Дерево
+ * \return Количество узлов
+ */
+size_t fst_tree_size(const fst_tree* tree)
+{
+	return tree == nullptr ? 0 : tree->root->descendantsCount() + 1;
+}
+
+/**
+ * Корень дерева; узлы действительны, пока дерево не освобождено
+ * \param[in] tree Дерево
+ * \return Корень дерева
+ */
+const fst_node* fst_tree_root(const fst_tree* tree)
+{
+	return tree == nullptr ? nullptr : fromNode(tree->root.get());
+}
+
+/**
+ * Метка узла. Строка не завершается нулём
+ * \param[in] node Узел
+ * \param[out] length Длина метки
+ * \return Начало метки
+ */
+const char* fst_node_label(const fst_node* node, size_t* length)
+{
+	if (node == nullptr) {
+		if (length != nullptr)
+			*length = 0;
+		return nullptr;
+	}
+	string_view label = toNode(node)->getLabel();
+	if (length != nullptr)
+		*length = label.size();
+	return label.data();
+}
+
+/**
+ * Количество детей узла
+ * \param[in] node Узел
+ * \return Количество детей
+ */
+size_t fst_node_children_count(const fst_node* node)
+{
+	return node == nullptr ? 0 : toNode(node)->getChildrenCount();
+}
+
+/**
+ * Ребёнок узла по номеру
+ * \param[in] node Узел
+ * \param[in] index Номер ребёнка
+ * \return Ребёнок или NULL, если номер вне диапазона
+ */
+const fst_node* fst_node_child(const fst_node* node, size_t index)
+{
+	if (node == nullptr || index >= toNode(node)->getChildrenCount())
+		return nullptr;
+	return fromNode(toNode(node)->getChildrenView()[index]);
+}
+
+/**
+ * Поиск поддерева в главном дереве (см. BasicNode::findSubTree)
+ * \param[in] main_tree Главное дерево
+ * \param[in] searched_tree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \param[out] result Результат поиска, освобождаемый fst_free_result
+ * \return Код возврата
+ */
+fst_status fst_find_subtree(const fst_tree* main_tree, const fst_tree* searched_tree, fst_policy policy, fst_result** result)
+{
+	MatchPolicy matchPolicy;
+	if (main_tree == nullptr || searched_tree == nullptr || result == nullptr || !toPolicy(policy, matchPolicy))
+		return FST_ERROR_ARGUMENT;
+	*result = nullptr;
+	try {
+		auto found = make_unique<fst_result>();
+		found->delta = main_tree->root->findSubTree(searched_tree->root.get(), found->deltaTree, matchPolicy);
+		*result = found.release();
+		return FST_OK;
+	}
+	catch (const bad_alloc&) {
+		return FST_ERROR_MEMORY;
+	}
+	catch (...) {
+		return FST_ERROR_INTERNAL;
+	}
+}
+
+/**
+ * Подсчёт недостающих узлов без построения дерева разности (см. BasicNode::countMissingNodes)
+ * \param[in] main_tree Главное дерево
+ * \param[in] searched_tree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \param[out] delta Количество недостающих узлов или -1, если поддерево не найдено
+ * \return Код возврата
+ */
+fst_status fst_count_missing_nodes(const fst_tree* main_tree, const fst_tree* searched_tree, fst_policy policy, int* delta)
+{
+	MatchPolicy matchPolicy;
+	if (main_tree == nullptr || searched_tree == nullptr || delta == nullptr || !toPolicy(policy, matchPolicy))
+		return FST_ERROR_ARGUMENT;
+	try {
+		*delta = main_tree->root->countMissingNodes(searched_tree->root.get(), matchPolicy);
+		return FST_OK;
+	}
+	catch (const bad_alloc&) {
+		return FST_ERROR_MEMORY;
+	}
+	catch (...) {
+		return FST_ERROR_INTERNAL;
+	}
+}
+
+/**
+ * Количество узлов, которые необходимо добавить к главному дереву
+ * \param[in] result Результат поиска
+ * \return Количество узлов или -1, если поддерево не найдено
+ */
+int fst_result_delta(const fst_result* result)
+{
+	return result == nullptr ? -1 : result->delta;
+}
+
+/**
+ * Дерево разности; узлы действительны, пока результат не освобождён
+ * \param[in] result Результат поиска
+ * \return Корень дерева разности или NULL, если дерево разности пусто или поддерево не найдено
+ */
+const fst_node* fst_result_delta_tree(const fst_result* result)
+{
+	return result == nullptr ? nullptr : fromNode(result->deltaTree.get());
+}
+
+/**
+ * Освободить результат поиска
+ * \param[in] result Результат (NULL допускается)
+ */
+void fst_free_result(fst_result* result)
+{
+	delete result;
+}
+
+/**
+ * Создать пустой индекс pq-грамм
+ * \param[in] p Длина основы pq-граммы
+ * \param[in] q Длина основания pq-граммы
+ * \param[out] index Индекс, освобождаемый fst_free_index
+ * \return Код возврата
+ */
+fst_status fst_index_create(int p, int q, fst_index** index)
+{
+	if (index == nullptr || p <= 0 || q <= 0)
+		return FST_ERROR_ARGUMENT;
+	*index = nullptr;
+	try {
+		*index = new fst_index{ PqGramIndex(p, q), {} };
+		return FST_OK;
+	}
+	catch (const bad_alloc&) {
+		return FST_ERROR_MEMORY;
+	}
+	catch (...) {
+		return FST_ERROR_INTERNAL;
+	}
+}
+
+/**
+ * Освободить индекс. Проиндексированные деревья не освобождаются
+ * \param[in] index Индекс (NULL допускается)
+ */
+void fst_free_index(fst_index* index)
+{
+	delete index;
+}
+
+/**
+ * Добавить главное дерево в индекс. Дерево не копируется и должно жить, пока используется индекс
+ * \param[in,out] index Индекс
+ * \param[in] tree Главное дерево
+ * \param[out] tree_index Номер дерева в индексе (NULL - не нужен)
+ * \return Код возврата
+ */
+fst_status fst_index_add_tree(fst_index* index, const fst_tree* tree, size_t* tree_index)
+{
+	if (index == nullptr || tree == nullptr)
+		return FST_ERROR_ARGUMENT;
+	try {
+		// Место под дерево резервируется заранее, чтобы индекс и список деревьев не разошлись при нехватке памяти
+		if (index->trees.size() == index->trees.capacity())
+			index->trees.reserve(max<size_t>(8, index->trees.size() * 2));
+		size_t added = index->index.addTree(to_string(index->trees.size()), tree->root.get());
+		index->trees.push_back(tree->root.get());
+		if (tree_index != nullptr)
+			*tree_index = added;
+		return FST_OK;
+	}
+	catch (const bad_alloc&) {
+		return FST_ERROR_MEMORY;
+	}
+	catch (...) {
+		return FST_ERROR_INTERNAL;
+	}
+}
+
+/**
+ * Отобрать по индексу похожие главные деревья и найти лучшее вхождение искомого дерева среди них.
+ * Проверяются те же корни, что и в режиме --index; при равных результатах выбирается более похожее дерево
+ * \param[in] index Индекс
+ * \param[in] searched_tree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \param[in] max_trees Наибольшее количество проверяемых главных деревьев
+ * \param[out] result Результат поиска, освобождаемый fst_free_result
+ * \param[out] tree_index Номер главного дерева с лучшим вхождением (NULL - не нужен)
+ * \return Код возврата
+ */
+fst_status fst_index_search(const fst_index* index, const fst_tree* searched_tree, fst_policy policy, size_t max_trees, fst_result** result, size_t* tree_index)
+{
+	MatchPolicy matchPolicy;
+	if (index == nullptr || searched_tree == nullptr || result == nullptr || !toPolicy(policy, matchPolicy))
+		return FST_ERROR_ARGUMENT;
+	*result = nullptr;
+	try {
+		const Node* searchedTree = searched_tree->root.get();
+		auto best = make_unique<fst_result>();
+		best->delta = -1;
+		for (const auto& candidate : index->index.shortlist(searchedTree, max_trees, MAX_INDEXED_ROOTS)) {
+			const Node* mainTree = index->trees[candidate.treeIndex];
+			vector<const Node*> roots;
+			for (const auto& root : findPreorderNodes(mainTree, candidate.roots)) {
+				if (root->getLabel() == searchedTree->getLabel())
+					roots.push_back(root);
+			}
+
+			unique_ptr<Node> deltaTree;
+			int delta = mainTree->findSubTreeAmong(roots, searchedTree, deltaTree, matchPolicy);
+			if (delta != -1 && (best->delta == -1 || delta < best->delta)) {
+				best->delta = delta;
+				best->deltaTree = move(deltaTree);
+				if (tree_index != nullptr)
+					*tree_index = candidate.treeIndex;
+			}
+		}
+		*result = best.release();
+		return FST_OK;
+	}
+	catch (const bad_alloc&) {
+		return FST_ERROR_MEMORY;
+	}
+	catch (...) {
+		return FST_ERROR_INTERNAL;
+	}
+}
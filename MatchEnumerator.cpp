@@ -0,0 +1,112 @@
+﻿#include "matchEnumerator.h"
+#include "searchStats.h"
+
+using namespace std;
+
+/**
+ * Создать перебор вхождений. Деревья не копируются и должны жить, пока идёт перебор
+ * \param[in] mainTree Главное дерево
+ * \param[in] cmpTree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ */
+template <class Label>
+BasicMatchEnumerator<Label>::BasicMatchEnumerator(const TreeNode* mainTree, const TreeNode* cmpTree, MatchPolicy policy)
+	: mainTree(mainTree), cmpTree(cmpTree), policy(policy)
+{
+	this->pendingNode = mainTree;
+	this->candidatesEvaluated = 0;
+}
+
+/**
+ * Найти следующее вхождение искомого дерева в прямом порядке обхода главного дерева.
+ * Оцениваются только кандидаты между предыдущим и найденным вхождениями
+ * \param[out] match Вхождение: количество недостающих узлов и корень кандидата
+ * \return Логический флаг, найдено ли вхождение (false - главное дерево обойдено до конца)
+ */
+template <class Label>
+bool BasicMatchEnumerator<Label>::next(Match& match)
+{
+	PhaseTimer timer(StatsPhase::PatchBuilding);
+	while (this->pendingNode != nullptr) {
+		const TreeNode* node = this->pendingNode;
+		SearchStats::count(StatsCounter::NodesVisited);
+
+		// Следующий узел - первый ребёнок или ближайший непросмотренный ребёнок одного из предков
+		this->pendingNode = nullptr;
+		if (!node->isLeaf()) {
+			this->path.emplace_back(node, 1);
+			this->pendingNode = node->getChildrenView()[0];
+		}
+		while (this->pendingNode == nullptr && !this->path.empty()) {
+			auto& ancestor = this->path.back();
+			auto children = ancestor.first->getChildrenView();
+			if (ancestor.second < children.size())
+				this->pendingNode = children[ancestor.second++];
+			else
+				this->path.pop_back();
+		}
+
+		if (node->getLabel() != this->cmpTree->getLabel())
+			continue;
+		SearchStats::count(StatsCounter::CandidatesEvaluated);
+		this->candidatesEvaluated++;
+		int delta = node->evaluatePatchWrap(this->cmpTree, this->policy);
+		if (delta != -1) {
+			match = Match{ delta, node };
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Узнать, обойдено ли главное дерево до конца
+ * \return Логический флаг, что вхождений больше нет
+ */
+template <class Label>
+bool BasicMatchEnumerator<Label>::isFinished() const
+{
+	return this->pendingNode == nullptr;
+}
+
+/**
+ * Количество кандидатов, оценённых с начала перебора
+ * \return Количество кандидатов
+ */
+template <class Label>
+size_t BasicMatchEnumerator<Label>::getCandidatesEvaluated() const
+{
+	return this->candidatesEvaluated;
+}
+
+/**
+ * Построить дерево разности для вхождения, выданного перебором
+ * \param[in] match Вхождение
+ * \param[out] deltaTree Дерево разности с родословной от корня главного дерева
+ * \return Количество узлов, которые необходимо добавить к главному дереву
+ */
+template <class Label>
+int BasicMatchEnumerator<Label>::buildDeltaTree(const Match& match, unique_ptr<TreeNode>& deltaTree) const
+{
+	if (match.root == nullptr) {
+		deltaTree = nullptr;
+		return -1;
+	}
+	return this->mainTree->findSubTreeAmong({ match.root }, this->cmpTree, deltaTree, this->policy);
+}
+
+template <class Label>
+typename BasicMatchEnumerator<Label>::iterator BasicMatchEnumerator<Label>::begin()
+{
+	return iterator(this);
+}
+
+template <class Label>
+typename BasicMatchEnumerator<Label>::iterator BasicMatchEnumerator<Label>::end()
+{
+	return iterator();
+}
+
+template class BasicMatchEnumerator<TextLabel>;
+template class BasicMatchEnumerator<uint32_t>;
+template class BasicMatchEnumerator<InternedLabel>;
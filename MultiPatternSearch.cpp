@@ -0,0 +1,228 @@
+﻿#include "multiPatternSearch.h"
+#include "searchStats.h"
+
+using namespace std;
+
+template <class Label>
+BasicWeightMemo<Label>::BasicWeightMemo()
+{
+	this->hits = 0;
+}
+
+/**
+ * Разбить искомое дерево на классы одинаковых поддеревьев, общие для всех добавленных деревьев
+ * \param[in] pattern Искомое дерево (должно жить, пока используются веса)
+ * \return Класс искомого дерева
+ */
+template <class Label>
+unsigned BasicWeightMemo<Label>::addPattern(const TreeNode* pattern)
+{
+	unsigned patternClass = this->patterns.addTree(pattern, &this->classes);
+	this->uses.resize(this->patterns.size(), 0);
+	vector<const TreeNode*> path{ pattern };
+	while (!path.empty()) {
+		const TreeNode* node = path.back();
+		path.pop_back();
+		this->uses[this->classes[node]]++;
+		for (auto child : node->getChildrenView())
+			path.push_back(child);
+	}
+	return patternClass;
+}
+
+/**
+ * Найти вычисленный вес пары узлов
+ * \param[in] mainNode Узел главного дерева
+ * \param[in] cmpNode Узел одного из искомых деревьев
+ * \param[out] weight Вес пары
+ * \return Логический флаг, известен ли вес
+ */
+template <class Label>
+bool BasicWeightMemo<Label>::find(const TreeNode* mainNode, const TreeNode* cmpNode, int& weight)
+{
+	auto cmpClass = this->sharedClasses.find(cmpNode);
+	if (cmpClass == this->sharedClasses.end())
+		return false;
+
+	auto found = this->weights.find(Key{ mainNode, cmpClass->second });
+	if (found == this->weights.end())
+		return false;
+	this->hits++;
+	weight = found->second;
+	return true;
+}
+
+/**
+ * Запомнить вес пары узлов для всех одинаковых поддеревьев искомых деревьев
+ * \param[in] mainNode Узел главного дерева
+ * \param[in] cmpNode Узел одного из искомых деревьев
+ * \param[in] weight Вес пары
+ */
+template <class Label>
+void BasicWeightMemo<Label>::store(const TreeNode* mainNode, const TreeNode* cmpNode, int weight)
+{
+	auto cmpClass = this->sharedClasses.find(cmpNode);
+	if (cmpClass != this->sharedClasses.end())
+		this->weights[Key{ mainNode, cmpClass->second }] = weight;
+}
+
+/**
+ * Забыть веса, вычисленные для прежнего главного дерева, и отобрать узлы повторяющихся классов
+ * для следующего поиска. Классы искомых деревьев сохраняются
+ */
+template <class Label>
+void BasicWeightMemo<Label>::clearWeights()
+{
+	this->weights.clear();
+	this->hits = 0;
+	this->sharedClasses.clear();
+	for (const auto& classified : this->classes) {
+		if (this->uses[classified.second] > 1)
+			this->sharedClasses.insert(classified);
+	}
+}
+
+template <class Label>
+size_t BasicWeightMemo<Label>::getClassesCount() const
+{
+	return this->patterns.size();
+}
+
+template <class Label>
+size_t BasicWeightMemo<Label>::size() const
+{
+	return this->weights.size();
+}
+
+template <class Label>
+size_t BasicWeightMemo<Label>::getHits() const
+{
+	return this->hits;
+}
+
+template <class Label>
+bool BasicWeightMemo<Label>::Key::operator==(const Key& other) const
+{
+	return this->mainNode == other.mainNode && this->cmpClass == other.cmpClass;
+}
+
+template <class Label>
+size_t BasicWeightMemo<Label>::KeyHash::operator()(const Key& key) const
+{
+	return hash<const void*>()(key.mainNode) ^ (key.cmpClass * 0x9e3779b97f4a7c15ull);
+}
+
+/**
+ * Создать пустой поиск множества искомых деревьев
+ * \param[in] policy Способ сопоставления детей
+ */
+template <class Label>
+BasicMultiPatternSearch<Label>::BasicMultiPatternSearch(MatchPolicy policy)
+{
+	this->policy = policy;
+}
+
+/**
+ * Добавить искомое дерево
+ * \param[in] pattern Искомое дерево (должно жить, пока используется поиск)
+ * \return Номер искомого дерева в результатах поиска
+ */
+template <class Label>
+size_t BasicMultiPatternSearch<Label>::addPattern(const TreeNode* pattern)
+{
+	this->patterns.push_back(pattern);
+	this->patternClasses.push_back(this->memo.addPattern(pattern));
+	return this->patterns.size() - 1;
+}
+
+template <class Label>
+size_t BasicMultiPatternSearch<Label>::size() const
+{
+	return this->patterns.size();
+}
+
+/**
+ * Найти лучшее вхождение каждого искомого дерева за один обход главного дерева.
+ * Одинаковые искомые деревья оцениваются один раз, а при равенстве выбирается кандидат, раньше встреченный
+ * в прямом обходе, как и в Node::findSubTree
+ * \param[in] mainTree Главное дерево
+ * \return Лучшие вхождения в порядке добавления искомых деревьев
+ */
+template <class Label>
+vector<BasicPatternMatch<Label>> BasicMultiPatternSearch<Label>::search(const TreeNode* mainTree)
+{
+	this->memo.clearWeights();
+
+	// По одному представителю каждого класса искомых деревьев, сгруппированных по хешу имени корня
+	unordered_map<unsigned, Match> bestByClass;
+	unordered_map<size_t, vector<size_t>> patternsByLabel;
+	for (size_t i = 0; i < this->patterns.size(); i++) {
+		if (bestByClass.emplace(this->patternClasses[i], Match{ -1, nullptr }).second)
+			patternsByLabel[LabelTraits<Label>::hash(this->patterns[i]->getLabel())].push_back(i);
+	}
+
+	PhaseTimer timer(StatsPhase::PatchBuilding);
+	vector<const TreeNode*> path;
+	if (mainTree != nullptr)
+		path.push_back(mainTree);
+	while (!path.empty()) {
+		const TreeNode* node = path.back();
+		path.pop_back();
+		SearchStats::count(StatsCounter::NodesVisited);
+
+		auto bucket = patternsByLabel.find(LabelTraits<Label>::hash(node->getLabel()));
+		if (bucket != patternsByLabel.end()) {
+			for (size_t patternIndex : bucket->second) {
+				const TreeNode* pattern = this->patterns[patternIndex];
+				if (pattern->getLabel() != node->getLabel())
+					continue;
+				SearchStats::count(StatsCounter::CandidatesEvaluated);
+				int delta = node->evaluatePatchWrap(pattern, this->policy, &this->memo);
+				Match& best = bestByClass[this->patternClasses[patternIndex]];
+				if (delta != -1 && (best.delta == -1 || delta < best.delta))
+					best = Match{ delta, node };
+			}
+		}
+
+		auto children = node->getChildrenView();
+		for (size_t i = children.size(); i > 0; i--)
+			path.push_back(children[i - 1]);
+	}
+
+	vector<Match> matches;
+	matches.reserve(this->patterns.size());
+	for (unsigned patternClass : this->patternClasses)
+		matches.push_back(bestByClass[patternClass]);
+	return matches;
+}
+
+/**
+ * Построить дерево разности для найденного вхождения искомого дерева
+ * \param[in] mainTree Главное дерево, в котором выполнялся поиск
+ * \param[in] patternIndex Номер искомого дерева
+ * \param[in] match Найденное вхождение
+ * \param[out] deltaTree Дерево разности
+ * \return Количество узлов, которые необходимо добавить к главному дереву, или -1, если дерево не найдено
+ */
+template <class Label>
+int BasicMultiPatternSearch<Label>::buildDeltaTree(const TreeNode* mainTree, size_t patternIndex, const Match& match, unique_ptr<TreeNode>& deltaTree) const
+{
+	if (match.root == nullptr) {
+		deltaTree = nullptr;
+		return -1;
+	}
+	return mainTree->findSubTreeAmong({ match.root }, this->patterns[patternIndex], deltaTree, this->policy);
+}
+
+template <class Label>
+const BasicWeightMemo<Label>& BasicMultiPatternSearch<Label>::getMemo() const
+{
+	return this->memo;
+}
+
+template class BasicWeightMemo<TextLabel>;
+template class BasicWeightMemo<uint32_t>;
+template class BasicWeightMemo<InternedLabel>;
+template class BasicMultiPatternSearch<TextLabel>;
+template class BasicMultiPatternSearch<uint32_t>;
+template class BasicMultiPatternSearch<InternedLabel>;
@@ -0,0 +1,148 @@
+﻿#include "patchArena.h"
+#include "searchStats.h"
+#include <new>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+namespace {
+	thread_local PatchArena* currentArena = nullptr;
+	thread_local PatchArena* currentNodeArena = nullptr;
+	// Блоки растут вдвое до этого размера, чтобы их оставалось немного
+	const size_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+}
+
+/**
+ * Создать пустую арену
+ * \param[in] firstChunkSize Размер первого блока памяти, запрашиваемого ареной
+ * \param[in] structure Структура, к которой статистика относит память арены
+ */
+PatchArena::PatchArena(size_t firstChunkSize, StatsStructure structure)
+{
+	this->structure = structure;
+	this->chunkIndex = 0;
+	this->offset = 0;
+	this->chunkSize = firstChunkSize;
+}
+
+PatchArena::~PatchArena()
+{
+	for (const auto& chunk : this->chunks) {
+		SearchStats::released(this->structure, chunk.size);
+		::operator delete(chunk.data);
+	}
+}
+
+/**
+ * Освободить всю память арены. Блоки остаются за ареной и используются заново
+ * \param[in] this Арена
+ */
+void PatchArena::reset()
+{
+	this->chunkIndex = 0;
+	this->offset = 0;
+}
+
+/**
+ * Узнать, выделена ли память из данной арены
+ * \param[in] this Арена
+ * \param[in] pointer Адрес памяти
+ * \return Логический флаг, принадлежит ли память арене
+ */
+bool PatchArena::owns(const void* pointer) const
+{
+	const char* address = static_cast<const char*>(pointer);
+	for (const auto& chunk : this->chunks) {
+		if (less_equal<const char*>()(chunk.data, address) && less<const char*>()(address, chunk.data + chunk.size))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Объём памяти, запрошенной ареной
+ * \param[in] this Арена
+ * \return Объём в байтах
+ */
+size_t PatchArena::getCapacity() const
+{
+	size_t capacity = 0;
+	for (const auto& chunk : this->chunks) {
+		capacity += chunk.size;
+	}
+	return capacity;
+}
+
+/**
+ * Текущая арена потока
+ * \return Арена или nullptr, если patch-узлы создаются в общей куче
+ */
+PatchArena* PatchArena::current()
+{
+	return currentArena;
+}
+
+/**
+ * Текущая арена узлов деревьев в потоке
+ * \return Арена или nullptr, если узлы создаются в общей куче
+ */
+PatchArena* PatchArena::currentForNodes()
+{
+	return currentNodeArena;
+}
+
+PatchArena::Scope::Scope(PatchArena& arena)
+{
+	this->previous = currentArena;
+	currentArena = &arena;
+}
+
+PatchArena::Scope::~Scope()
+{
+	currentArena = this->previous;
+}
+
+PatchArena::NodeScope::NodeScope(PatchArena& arena)
+{
+	this->previous = currentNodeArena;
+	currentNodeArena = &arena;
+}
+
+PatchArena::NodeScope::~NodeScope()
+{
+	currentNodeArena = this->previous;
+}
+
+void* PatchArena::do_allocate(size_t bytes, size_t alignment)
+{
+	while (this->chunkIndex < this->chunks.size()) {
+		Chunk& chunk = this->chunks[this->chunkIndex];
+		uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data);
+		size_t alignedOffset = (size_t)(((base + this->offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+		if (alignedOffset + bytes <= chunk.size) {
+			this->offset = alignedOffset + bytes;
+			return chunk.data + alignedOffset;
+		}
+		this->chunkIndex++;
+		this->offset = 0;
+	}
+
+	// Свободных блоков не осталось: запросить новый, достаточный и для крупных выделений
+	size_t size = max(this->chunkSize, bytes + alignment);
+	this->chunks.push_back(Chunk{ static_cast<char*>(::operator new(size)), size });
+	SearchStats::allocated(this->structure, size);
+	this->chunkSize = min(this->chunkSize * 2, MAX_CHUNK_SIZE);
+	this->chunkIndex = this->chunks.size() - 1;
+	this->offset = 0;
+	return this->do_allocate(bytes, alignment);
+}
+
+void PatchArena::do_deallocate(void*, size_t, size_t)
+{
+}
+
+bool PatchArena::do_is_equal(const pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
@@ -0,0 +1,416 @@
+﻿#include "pqGramIndex.h"
+
+using namespace std;
+
+namespace {
+	const uint64_t FNV_OFFSET = 14695981039346656037ull;
+	const uint64_t FNV_PRIME = 1099511628211ull;
+	// Хеш отсутствующего узла (заполнитель '*' в pq-граммах)
+	const uint64_t NULL_LABEL = 0x9e3779b97f4a7c15ull;
+	// Метка, отличающая одиночные имена узлов от pq-грамм
+	const uint64_t LABEL_GRAM_SEED = 0xc2b2ae3d27d4eb4full;
+	const char INDEX_MAGIC[4] = { 'P', 'Q', 'G', 'I' };
+	const uint32_t INDEX_VERSION = 1;
+
+	uint64_t mixHash(uint64_t seed, uint64_t value)
+	{
+		seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+		return seed * FNV_PRIME;
+	}
+
+	uint64_t labelGram(uint64_t labelHash)
+	{
+		return mixHash(LABEL_GRAM_SEED, labelHash);
+	}
+
+	template <class T>
+	void writeValue(ofstream& out, const T& value)
+	{
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <class T>
+	bool readValue(ifstream& in, T& value)
+	{
+		in.read(reinterpret_cast<char*>(&value), sizeof(T));
+		return (bool)in;
+	}
+
+	// Прочитать длину списка, убедившись, что столько элементов умещается в остатке файла:
+	// длина из повреждённого индекса не должна приводить к огромному выделению памяти
+	bool readLength(ifstream& in, uint64_t fileSize, uint64_t elementSize, uint64_t& length)
+	{
+		if (!readValue(in, length))
+			return false;
+		uint64_t position = (uint64_t)in.tellg();
+		return position <= fileSize && length <= (fileSize - position) / elementSize;
+	}
+
+	void collectPreorder(const Node* node, vector<const Node*>& nodes)
+	{
+		nodes.push_back(node);
+		for (auto child : node->getChildrenView()) {
+			collectPreorder(child, nodes);
+		}
+	}
+}
+
+/**
+ * Хеш имени узла (FNV-1a)
+ * \param[in] label Имя узла
+ * \return 64-битный хеш
+ */
+uint64_t hashLabel(string_view label)
+{
+	uint64_t hash = FNV_OFFSET;
+	for (unsigned char symbol : label) {
+		hash ^= symbol;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/**
+ * Найти узлы дерева по их номерам в прямом порядке обхода
+ * \param[in] tree Дерево
+ * \param[in] preorderIndices Номера узлов
+ * \return Узлы дерева в порядке номеров; несуществующие номера пропускаются
+ */
+vector<const Node*> findPreorderNodes(const Node* tree, const vector<int>& preorderIndices)
+{
+	vector<const Node*> preorder;
+	collectPreorder(tree, preorder);
+
+	vector<const Node*> foundNodes;
+	for (int index : preorderIndices) {
+		if (index >= 0 && index < (int)preorder.size())
+			foundNodes.push_back(preorder[index]);
+	}
+	return foundNodes;
+}
+
+/**
+ * Создать пустой индекс
+ * \param[in] p Длина стебля pq-граммы (узел и p-1 его предков)
+ * \param[in] q Ширина окна по детям узла
+ */
+PqGramIndex::PqGramIndex(int p, int q)
+{
+	this->p = p;
+	this->q = q;
+}
+
+/**
+ * Собрать pq-граммы поддерева, записывая их подряд для каждого узла-якоря в прямом порядке обхода
+ * \param[in] node Узел-якорь
+ * \param[in,out] stem Хеши имён предков узла
+ * \param[in,out] tree Индексируемое дерево
+ * \param[in,out] labels Хеши имён всех узлов дерева
+ */
+void PqGramIndex::collectGrams(const Node* node, vector<uint64_t>& stem, IndexedTree& tree, vector<uint64_t>& labels) const
+{
+	uint64_t nodeHash = hashLabel(node->getLabel());
+	labels.push_back(nodeHash);
+
+	size_t nodeIndex = tree.nodes.size();
+	tree.nodes.push_back({ nodeHash, (uint32_t)tree.grams.size(), 0 });
+
+	stem.push_back(nodeHash);
+	uint64_t stemHash = FNV_OFFSET;
+	for (int i = p; i > 0; i--) {
+		stemHash = mixHash(stemHash, (int)stem.size() >= i ? stem[stem.size() - i] : NULL_LABEL);
+	}
+
+	auto children = node->getChildrenView();
+	vector<uint64_t> window(q, NULL_LABEL);
+	auto pushGram = [&]() {
+		uint64_t gram = stemHash;
+		for (uint64_t label : window)
+			gram = mixHash(gram, label);
+		tree.grams.push_back(gram);
+	};
+
+	if (children.empty()) {
+		pushGram();
+	}
+	else {
+		for (const auto& child : children) {
+			window.erase(window.begin());
+			window.push_back(hashLabel(child->getLabel()));
+			pushGram();
+		}
+		for (int i = 1; i < q; i++) {
+			window.erase(window.begin());
+			window.push_back(NULL_LABEL);
+			pushGram();
+		}
+	}
+
+	for (const auto& child : children) {
+		collectGrams(child, stem, tree, labels);
+	}
+	stem.pop_back();
+	tree.nodes[nodeIndex].gramEnd = (uint32_t)tree.grams.size();
+}
+
+/**
+ * Профиль образца: pq-граммы с якорями во всех узлах, кроме корня, и имя корня.
+ * Граммы корня не учитываются, так как в главном дереве у кандидата есть предки
+ * \param[in] pattern Образец
+ * \return Отсортированный мультимножественный профиль
+ */
+vector<uint64_t> PqGramIndex::patternProfile(const Node* pattern) const
+{
+	IndexedTree patternTree;
+	vector<uint64_t> stem, labels;
+	collectGrams(pattern, stem, patternTree, labels);
+
+	size_t childGramsBegin = patternTree.nodes.size() > 1 ? patternTree.nodes[1].gramBegin : patternTree.grams.size();
+	vector<uint64_t> profile(patternTree.grams.begin() + childGramsBegin, patternTree.grams.end());
+	profile.push_back(labelGram(patternTree.nodes[0].labelHash));
+	sort(profile.begin(), profile.end());
+	return profile;
+}
+
+/**
+ * Добавить профиль дерева в инвертированный индекс
+ * \param[in] treeIndex Номер дерева
+ * \param[in] profile Профиль дерева
+ */
+void PqGramIndex::addPostings(uint32_t treeIndex, vector<uint64_t> profile)
+{
+	sort(profile.begin(), profile.end());
+	for (size_t i = 0; i < profile.size();) {
+		size_t j = i;
+		while (j < profile.size() && profile[j] == profile[i])
+			j++;
+		postings[profile[i]].emplace_back(treeIndex, (uint32_t)(j - i));
+		i = j;
+	}
+}
+
+/**
+ * Добавить главное дерево в индекс
+ * \param[in] path Путь к файлу главного дерева
+ * \param[in] tree Главное дерево
+ * \return Номер дерева в индексе
+ */
+size_t PqGramIndex::addTree(const string& path, const Node* tree)
+{
+	IndexedTree indexedTree;
+	indexedTree.path = path;
+	vector<uint64_t> stem, labels;
+	collectGrams(tree, stem, indexedTree, labels);
+
+	vector<uint64_t> profile = indexedTree.grams;
+	for (uint64_t label : labels)
+		profile.push_back(labelGram(label));
+
+	uint32_t treeIndex = (uint32_t)trees.size();
+	trees.push_back(move(indexedTree));
+	addPostings(treeIndex, move(profile));
+	return treeIndex;
+}
+
+/**
+ * Отобрать главные деревья и корни поддеревьев, наиболее похожие на образец.
+ * Похожесть - доля pq-грамм образца, найденных в дереве (поддереве)
+ * \param[in] pattern Образец
+ * \param[in] maxTrees Наибольшее количество отбираемых деревьев
+ * \param[in] maxRoots Наибольшее количество отбираемых корней в каждом дереве
+ * \return Кандидаты в порядке убывания похожести
+ */
+vector<PqGramCandidate> PqGramIndex::shortlist(const Node* pattern, size_t maxTrees, size_t maxRoots) const
+{
+	vector<uint64_t> profile = patternProfile(pattern);
+	uint64_t rootHash = hashLabel(pattern->getLabel());
+
+	// Пересечение профиля образца с профилями деревьев по инвертированному индексу
+	unordered_map<uint32_t, uint32_t> commonGrams;
+	for (size_t i = 0; i < profile.size();) {
+		size_t j = i;
+		while (j < profile.size() && profile[j] == profile[i])
+			j++;
+		auto found = postings.find(profile[i]);
+		if (found != postings.end()) {
+			for (const auto& posting : found->second)
+				commonGrams[posting.first] += min((uint32_t)(j - i), posting.second);
+		}
+		i = j;
+	}
+
+	vector<pair<double, uint32_t>> treeScores;
+	for (const auto& common : commonGrams)
+		treeScores.emplace_back((double)common.second / profile.size(), common.first);
+	sort(treeScores.begin(), treeScores.end(), [](const auto& a, const auto& b) {
+		return a.first > b.first || (a.first == b.first && a.second < b.second);
+	});
+
+	// Поддеревья оцениваются только в самых похожих деревьях, пока не наберётся нужное количество кандидатов
+	vector<PqGramCandidate> candidates;
+	for (const auto& treeScore : treeScores) {
+		if (candidates.size() >= maxTrees)
+			break;
+
+		const IndexedTree& tree = trees[treeScore.second];
+		vector<pair<double, int>> roots;
+		for (size_t nodeIndex = 0; nodeIndex < tree.nodes.size(); nodeIndex++) {
+			const IndexedNode& node = tree.nodes[nodeIndex];
+			if (node.labelHash != rootHash)
+				continue;
+
+			// Граммы с якорем в самом корне поддерева не учитываются, как и в профиле образца
+			uint32_t childGramsBegin = nodeIndex + 1 < tree.nodes.size() ? tree.nodes[nodeIndex + 1].gramBegin : node.gramEnd;
+			childGramsBegin = min(childGramsBegin, node.gramEnd);
+			vector<uint64_t> subTreeGrams(tree.grams.begin() + childGramsBegin, tree.grams.begin() + node.gramEnd);
+			sort(subTreeGrams.begin(), subTreeGrams.end());
+
+			vector<uint64_t> intersection;
+			set_intersection(profile.begin(), profile.end(), subTreeGrams.begin(), subTreeGrams.end(), back_inserter(intersection));
+			roots.emplace_back((double)(intersection.size() + 1) / profile.size(), (int)nodeIndex);
+		}
+		if (roots.empty())
+			continue;
+
+		stable_sort(roots.begin(), roots.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		PqGramCandidate candidate{ treeScore.second, roots[0].first, {} };
+		for (size_t i = 0; i < roots.size() && i < maxRoots; i++)
+			candidate.roots.push_back(roots[i].second);
+		candidates.push_back(move(candidate));
+	}
+
+	stable_sort(candidates.begin(), candidates.end(), [](const PqGramCandidate& a, const PqGramCandidate& b) {
+		return a.score > b.score;
+	});
+	return candidates;
+}
+
+const string& PqGramIndex::getPath(size_t treeIndex) const
+{
+	return trees[treeIndex].path;
+}
+
+size_t PqGramIndex::size() const
+{
+	return trees.size();
+}
+
+/**
+ * Сохранить индекс в файл
+ * \param[in] path Путь к файлу индекса
+ * \return Успешность сохранения
+ */
+bool PqGramIndex::save(const string& path) const
+{
+	ofstream out(path, ios::binary);
+	if (!out.is_open())
+		return false;
+
+	out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	writeValue(out, INDEX_VERSION);
+	writeValue(out, (int32_t)p);
+	writeValue(out, (int32_t)q);
+	writeValue(out, (uint64_t)trees.size());
+	for (const auto& tree : trees) {
+		writeValue(out, (uint64_t)tree.path.size());
+		out.write(tree.path.data(), tree.path.size());
+		writeValue(out, (uint64_t)tree.nodes.size());
+		out.write(reinterpret_cast<const char*>(tree.nodes.data()), tree.nodes.size() * sizeof(IndexedNode));
+		writeValue(out, (uint64_t)tree.grams.size());
+		out.write(reinterpret_cast<const char*>(tree.grams.data()), tree.grams.size() * sizeof(uint64_t));
+	}
+
+	// Инвертированный индекс записывается в порядке возрастания грамм, чтобы файл не зависел от порядка хеш-таблицы
+	vector<uint64_t> grams;
+	grams.reserve(postings.size());
+	for (const auto& posting : postings)
+		grams.push_back(posting.first);
+	sort(grams.begin(), grams.end());
+
+	writeValue(out, (uint64_t)grams.size());
+	for (uint64_t gram : grams) {
+		const auto& treeCounts = postings.at(gram);
+		writeValue(out, gram);
+		writeValue(out, (uint64_t)treeCounts.size());
+		out.write(reinterpret_cast<const char*>(treeCounts.data()), treeCounts.size() * sizeof(pair<uint32_t, uint32_t>));
+	}
+	return (bool)out;
+}
+
+/**
+ * Загрузить индекс из файла, заменив текущее содержимое
+ * \param[in] path Путь к файлу индекса
+ * \return Успешность загрузки
+ */
+bool PqGramIndex::load(const string& path)
+{
+	ifstream in(path, ios::binary | ios::ate);
+	if (!in.is_open())
+		return false;
+	uint64_t fileSize = (uint64_t)in.tellg();
+	in.seekg(0);
+
+	char magic[sizeof(INDEX_MAGIC)];
+	uint32_t version;
+	int32_t loadedP, loadedQ;
+	uint64_t treesCount;
+	in.read(magic, sizeof(magic));
+	if (!in || !equal(begin(magic), end(magic), begin(INDEX_MAGIC)))
+		return false;
+	if (!readValue(in, version) || version != INDEX_VERSION)
+		return false;
+	// Запись дерева занимает не меньше трёх длин списков
+	if (!readValue(in, loadedP) || !readValue(in, loadedQ) || loadedP <= 0 || loadedQ <= 0)
+		return false;
+	if (!readLength(in, fileSize, 3 * sizeof(uint64_t), treesCount))
+		return false;
+
+	vector<IndexedTree> loadedTrees(treesCount);
+	for (auto& tree : loadedTrees) {
+		uint64_t length;
+		if (!readLength(in, fileSize, sizeof(char), length))
+			return false;
+		tree.path.resize(length);
+		in.read(tree.path.data(), length);
+		if (!readLength(in, fileSize, sizeof(IndexedNode), length))
+			return false;
+		tree.nodes.resize(length);
+		in.read(reinterpret_cast<char*>(tree.nodes.data()), length * sizeof(IndexedNode));
+		if (!readLength(in, fileSize, sizeof(uint64_t), length))
+			return false;
+		tree.grams.resize(length);
+		in.read(reinterpret_cast<char*>(tree.grams.data()), length * sizeof(uint64_t));
+		// Граммы узла должны лежать в списке грамм его дерева
+		for (const auto& node : tree.nodes) {
+			if (node.gramBegin > node.gramEnd || node.gramEnd > tree.grams.size())
+				return false;
+		}
+	}
+
+	// Запись pq-граммы - её хеш и длина списка деревьев
+	uint64_t gramsCount;
+	if (!readLength(in, fileSize, 2 * sizeof(uint64_t), gramsCount))
+		return false;
+	unordered_map<uint64_t, vector<pair<uint32_t, uint32_t>>> loadedPostings;
+	loadedPostings.reserve(gramsCount);
+	for (uint64_t i = 0; i < gramsCount; i++) {
+		uint64_t gram, length;
+		if (!readValue(in, gram) || !readLength(in, fileSize, sizeof(pair<uint32_t, uint32_t>), length))
+			return false;
+		auto& treeCounts = loadedPostings[gram];
+		treeCounts.resize(length);
+		in.read(reinterpret_cast<char*>(treeCounts.data()), length * sizeof(pair<uint32_t, uint32_t>));
+		for (const auto& treeCount : treeCounts) {
+			if (treeCount.first >= treesCount)
+				return false;
+		}
+	}
+	if (!in)
+		return false;
+
+	p = loadedP;
+	q = loadedQ;
+	trees = move(loadedTrees);
+	postings = move(loadedPostings);
+	return true;
+}
@@ -0,0 +1,265 @@
+﻿#include "searchCache.h"
+
+using namespace std;
+
+namespace {
+	uint64_t mixHash(uint64_t seed, uint64_t value)
+	{
+		seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+		return seed * 1099511628211ull;
+	}
+}
+
+/**
+ * Создать пустой кэш
+ * \param[in] capacity Максимальное количество хранимых результатов
+ */
+template <class Label>
+BasicSearchCache<Label>::BasicSearchCache(size_t capacity)
+{
+	this->capacity = capacity;
+	this->hits = 0;
+	this->misses = 0;
+	this->evictions = 0;
+	this->invalidations = 0;
+}
+
+/**
+ * Поиск поддерева с использованием кэша. Повторный запрос того же искомого дерева к неизменённому
+ * главному дереву возвращает сохранённый результат без повторного поиска
+ * \param[in] mainTree Главное дерево
+ * \param[in] cmpTree Искомое дерево
+ * \param[out] deltaTree Дерево разности
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву
+ */
+template <class Label>
+int BasicSearchCache<Label>::findSubTree(const TreeNode* mainTree, const TreeNode* cmpTree, unique_ptr<TreeNode>& deltaTree, MatchPolicy policy)
+{
+	// Результаты для прежних версий главного дерева больше не действительны
+	auto state = this->mainTrees.find(mainTree);
+	if (state != this->mainTrees.end() && state->second.revision != mainTree->getRevision())
+		this->invalidate(mainTree);
+
+	Key key{ mainTree, policy, hashTree(cmpTree) };
+	auto found = this->entryByKey.find(key);
+	if (found != this->entryByKey.end()) {
+		if (sameTree(found->second->searchedTree, cmpTree)) {
+			this->hits++;
+			this->entries.splice(this->entries.begin(), this->entries, found->second);
+			deltaTree = decodeTree(found->second->deltaTree);
+			return found->second->delta;
+		}
+		// Совпадение хешей разных деревьев: старый результат вытесняется новым
+		this->erase(found->second);
+	}
+
+	this->misses++;
+	int delta = mainTree->findSubTree(cmpTree, deltaTree, policy);
+	if (this->capacity == 0)
+		return delta;
+
+	if (this->entries.size() >= this->capacity) {
+		this->erase(prev(this->entries.end()));
+		this->evictions++;
+	}
+
+	Entry entry{ key, {}, delta, {} };
+	encodeTree(cmpTree, entry.searchedTree);
+	encodeTree(deltaTree.get(), entry.deltaTree);
+	this->entries.push_front(move(entry));
+	this->entryByKey[key] = this->entries.begin();
+	auto& mainState = this->mainTrees[mainTree];
+	mainState.revision = mainTree->getRevision();
+	mainState.entriesCount++;
+	return delta;
+}
+
+/**
+ * Удалить все результаты
+ * \param[in] this Кэш
+ */
+template <class Label>
+void BasicSearchCache<Label>::clear()
+{
+	this->entries.clear();
+	this->entryByKey.clear();
+	this->mainTrees.clear();
+}
+
+template <class Label>
+size_t BasicSearchCache<Label>::size() const
+{
+	return this->entries.size();
+}
+
+template <class Label>
+size_t BasicSearchCache<Label>::getHits() const
+{
+	return this->hits;
+}
+
+template <class Label>
+size_t BasicSearchCache<Label>::getMisses() const
+{
+	return this->misses;
+}
+
+template <class Label>
+size_t BasicSearchCache<Label>::getEvictions() const
+{
+	return this->evictions;
+}
+
+template <class Label>
+size_t BasicSearchCache<Label>::getInvalidations() const
+{
+	return this->invalidations;
+}
+
+template <class Label>
+bool BasicSearchCache<Label>::Key::operator==(const Key& other) const
+{
+	return this->mainTree == other.mainTree && this->policy == other.policy && this->searchedHash == other.searchedHash;
+}
+
+template <class Label>
+size_t BasicSearchCache<Label>::KeyHash::operator()(const Key& key) const
+{
+	uint64_t hash = mixHash(std::hash<const void*>()(key.mainTree), (uint64_t)key.policy);
+	return (size_t)mixHash(hash, key.searchedHash);
+}
+
+/**
+ * Структурный хеш дерева: метки и количество детей в прямом порядке обхода
+ * \param[in] tree Дерево
+ * \return Хеш дерева
+ */
+template <class Label>
+uint64_t BasicSearchCache<Label>::hashTree(const TreeNode* tree)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	vector<const TreeNode*> path{ tree };
+	while (!path.empty()) {
+		const TreeNode* node = path.back();
+		path.pop_back();
+		size_t childrenCount = node->getChildrenCount();
+		hash = mixHash(mixHash(hash, LabelTraits<Label>::hash(node->getLabel())), childrenCount);
+		for (size_t i = childrenCount; i > 0; i--) {
+			path.push_back(node->getChild(i - 1));
+		}
+	}
+	return hash;
+}
+
+/**
+ * Записать дерево в прямом порядке обхода
+ * \param[in] tree Дерево (nullptr - пустое дерево)
+ * \param[out] encoded Записанное дерево
+ */
+template <class Label>
+void BasicSearchCache<Label>::encodeTree(const TreeNode* tree, vector<EncodedNode>& encoded)
+{
+	if (tree == nullptr)
+		return;
+
+	vector<const TreeNode*> path{ tree };
+	while (!path.empty()) {
+		const TreeNode* node = path.back();
+		path.pop_back();
+		size_t childrenCount = node->getChildrenCount();
+		encoded.push_back(EncodedNode{ LabelTraits<Label>::own(node->getLabel()), (unsigned)childrenCount });
+		for (size_t i = childrenCount; i > 0; i--) {
+			path.push_back(node->getChild(i - 1));
+		}
+	}
+}
+
+/**
+ * Сравнить записанное дерево с деревом
+ * \param[in] encoded Записанное дерево
+ * \param[in] tree Дерево
+ * \return Логический флаг, совпадают ли деревья
+ */
+template <class Label>
+bool BasicSearchCache<Label>::sameTree(const vector<EncodedNode>& encoded, const TreeNode* tree)
+{
+	size_t index = 0;
+	vector<const TreeNode*> path{ tree };
+	while (!path.empty()) {
+		const TreeNode* node = path.back();
+		path.pop_back();
+		size_t childrenCount = node->getChildrenCount();
+		if (index == encoded.size() || encoded[index].childrenCount != childrenCount)
+			return false;
+		if (!(LabelTraits<Label>::view(encoded[index].label) == node->getLabel()))
+			return false;
+		index++;
+		for (size_t i = childrenCount; i > 0; i--) {
+			path.push_back(node->getChild(i - 1));
+		}
+	}
+	return index == encoded.size();
+}
+
+/**
+ * Восстановить дерево из записи в прямом порядке обхода
+ * \param[in] encoded Записанное дерево
+ * \return Дерево или nullptr, если запись пуста
+ */
+template <class Label>
+unique_ptr<typename BasicSearchCache<Label>::TreeNode> BasicSearchCache<Label>::decodeTree(const vector<EncodedNode>& encoded)
+{
+	if (encoded.empty())
+		return nullptr;
+
+	auto root = make_unique<TreeNode>(encoded[0].label);
+	// Узлы, которым ещё не хватает детей, и количество недостающих детей
+	vector<pair<TreeNode*, unsigned>> path{ { root.get(), encoded[0].childrenCount } };
+	for (size_t i = 1; i < encoded.size(); i++) {
+		while (path.back().second == 0)
+			path.pop_back();
+		path.back().second--;
+		TreeNode* child = path.back().first->addChild(encoded[i].label);
+		path.emplace_back(child, encoded[i].childrenCount);
+	}
+	return root;
+}
+
+/**
+ * Удалить все результаты, полученные для заданного главного дерева
+ * \param[in] this Кэш
+ * \param[in] mainTree Главное дерево
+ */
+template <class Label>
+void BasicSearchCache<Label>::invalidate(const TreeNode* mainTree)
+{
+	for (auto entry = this->entries.begin(); entry != this->entries.end();) {
+		auto next = std::next(entry);
+		if (entry->key.mainTree == mainTree) {
+			this->erase(entry);
+			this->invalidations++;
+		}
+		entry = next;
+	}
+	this->mainTrees.erase(mainTree);
+}
+
+/**
+ * Удалить результат из кэша
+ * \param[in] this Кэш
+ * \param[in] entry Удаляемый результат
+ */
+template <class Label>
+void BasicSearchCache<Label>::erase(typename list<Entry>::iterator entry)
+{
+	auto state = this->mainTrees.find(entry->key.mainTree);
+	if (state != this->mainTrees.end() && --state->second.entriesCount == 0)
+		this->mainTrees.erase(state);
+	this->entryByKey.erase(entry->key);
+	this->entries.erase(entry);
+}
+
+template class BasicSearchCache<TextLabel>;
+template class BasicSearchCache<uint32_t>;
+template class BasicSearchCache<InternedLabel>;
@@ -0,0 +1,272 @@
+﻿#include "searchStats.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <ctime>
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+atomic<bool> SearchStats::enabled{ false };
+thread_local uint64_t SearchStats::counters[(int)StatsCounter::Count] = {};
+thread_local uint64_t SearchStats::calls[(int)StatsPhase::Count] = {};
+thread_local uint64_t SearchStats::wallTimes[(int)StatsPhase::Count] = {};
+thread_local uint64_t SearchStats::cpuTimes[(int)StatsPhase::Count] = {};
+thread_local uint64_t SearchStats::allocations[(int)StatsStructure::Count] = {};
+thread_local uint64_t SearchStats::allocatedBytes[(int)StatsStructure::Count] = {};
+thread_local uint64_t SearchStats::liveBytes[(int)StatsStructure::Count] = {};
+thread_local uint64_t SearchStats::peakBytes[(int)StatsStructure::Count] = {};
+thread_local uint64_t SearchStats::liveTotalBytes = 0;
+thread_local int SearchStats::currentPhase = -1;
+thread_local uint64_t SearchStats::phaseAllocations[(int)StatsPhase::Count] = {};
+thread_local uint64_t SearchStats::phaseAllocatedBytes[(int)StatsPhase::Count] = {};
+thread_local uint64_t SearchStats::phasePeakBytes[(int)StatsPhase::Count] = {};
+
+namespace {
+	const char* PHASE_NAMES[(int)StatsPhase::Count] = {
+		"file_read", "lexing", "tree_building", "candidate_lookup", "patch_building", "delta_construction", "pedigree", "print"
+	};
+	const char* COUNTER_NAMES[(int)StatsCounter::Count] = {
+		"nodes_visited", "patch_nodes_allocated", "connections_created", "candidates_evaluated"
+	};
+	const char* STRUCTURE_NAMES[(int)StatsStructure::Count] = {
+		"lexems", "nodes", "patch_nodes"
+	};
+
+	double toMilliseconds(uint64_t nanoseconds)
+	{
+		return nanoseconds / 1e6;
+	}
+}
+
+/**
+ * Включить или выключить сбор статистики
+ * \param[in] enabled Логический флаг, собирать ли статистику
+ */
+void SearchStats::enable(bool enabled)
+{
+	SearchStats::enabled = enabled;
+}
+
+/**
+ * Учесть очередной замер этапа
+ * \param[in] phase Этап
+ * \param[in] wallNanoseconds Прошедшее время
+ * \param[in] cpuNanoseconds Процессорное время процесса
+ */
+void SearchStats::addTime(StatsPhase phase, uint64_t wallNanoseconds, uint64_t cpuNanoseconds)
+{
+	calls[(int)phase]++;
+	wallTimes[(int)phase] += wallNanoseconds;
+	cpuTimes[(int)phase] += cpuNanoseconds;
+}
+
+uint64_t SearchStats::getCounter(StatsCounter counter)
+{
+	return counters[(int)counter];
+}
+
+uint64_t SearchStats::getCalls(StatsPhase phase)
+{
+	return calls[(int)phase];
+}
+
+uint64_t SearchStats::getAllocations(StatsStructure structure)
+{
+	return allocations[(int)structure];
+}
+
+uint64_t SearchStats::getLiveBytes(StatsStructure structure)
+{
+	return liveBytes[(int)structure];
+}
+
+uint64_t SearchStats::getPeakBytes(StatsStructure structure)
+{
+	return peakBytes[(int)structure];
+}
+
+uint64_t SearchStats::getPhaseAllocations(StatsPhase phase)
+{
+	return phaseAllocations[(int)phase];
+}
+
+/**
+ * Сделать этап текущим: выделения памяти будут относиться к нему
+ * \param[in] phase Этап
+ * \return Предыдущий текущий этап, который нужно восстановить по завершении
+ */
+int SearchStats::enterPhase(StatsPhase phase)
+{
+	int previousPhase = currentPhase;
+	currentPhase = (int)phase;
+	if (liveTotalBytes > phasePeakBytes[currentPhase])
+		phasePeakBytes[currentPhase] = liveTotalBytes;
+	return previousPhase;
+}
+
+void SearchStats::leavePhase(int previousPhase)
+{
+	currentPhase = previousPhase;
+}
+
+/**
+ * Наибольший объём памяти, занимавшийся процессом (peak RSS)
+ * \return Объём в байтах или 0, если система его не сообщает
+ */
+uint64_t SearchStats::peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss;
+#else
+	// В Linux ru_maxrss измеряется в килобайтах
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/**
+ * Обнулить все замеры и счётчики. Объём живой памяти сохраняется, а её пик начинается с текущего объёма
+ */
+void SearchStats::reset()
+{
+	for (int i = 0; i < (int)StatsCounter::Count; i++)
+		counters[i] = 0;
+	for (int i = 0; i < (int)StatsPhase::Count; i++) {
+		calls[i] = 0;
+		wallTimes[i] = 0;
+		cpuTimes[i] = 0;
+		phaseAllocations[i] = 0;
+		phaseAllocatedBytes[i] = 0;
+		phasePeakBytes[i] = 0;
+	}
+	for (int i = 0; i < (int)StatsStructure::Count; i++) {
+		allocations[i] = 0;
+		allocatedBytes[i] = 0;
+		peakBytes[i] = liveBytes[i];
+	}
+}
+
+/**
+ * Вывести отчёт о собранной статистике
+ * \param[in] out Поток вывода
+ * \param[in] json Логический флаг, выводить ли отчёт в формате JSON
+ */
+void SearchStats::report(ostream& out, bool json)
+{
+	if (json) {
+		out << "{\"phases\":{";
+		for (int i = 0; i < (int)StatsPhase::Count; i++) {
+			out << (i ? "," : "") << "\"" << PHASE_NAMES[i] << "\":{\"calls\":" << calls[i]
+				<< ",\"wall_ms\":" << toMilliseconds(wallTimes[i]) << ",\"cpu_ms\":" << toMilliseconds(cpuTimes[i])
+				<< ",\"allocations\":" << phaseAllocations[i] << ",\"allocated_bytes\":" << phaseAllocatedBytes[i]
+				<< ",\"peak_live_bytes\":" << phasePeakBytes[i] << "}";
+		}
+		out << "},\"counters\":{";
+		for (int i = 0; i < (int)StatsCounter::Count; i++) {
+			out << (i ? "," : "") << "\"" << COUNTER_NAMES[i] << "\":" << counters[i];
+		}
+		out << "},\"memory\":{";
+		for (int i = 0; i < (int)StatsStructure::Count; i++) {
+			out << (i ? "," : "") << "\"" << STRUCTURE_NAMES[i] << "\":{\"allocations\":" << allocations[i]
+				<< ",\"allocated_bytes\":" << allocatedBytes[i] << ",\"peak_live_bytes\":" << peakBytes[i] << "}";
+		}
+		out << "},\"peak_rss_bytes\":" << peakResidentBytes() << "}" << endl;
+		return;
+	}
+
+	out << "phase                 calls      wall ms       cpu ms   allocations  allocated B  peak live B" << endl;
+	for (int i = 0; i < (int)StatsPhase::Count; i++) {
+		out.width(20);
+		out << left << PHASE_NAMES[i] << right;
+		out.width(8);
+		out << calls[i];
+		out.width(13);
+		out << toMilliseconds(wallTimes[i]);
+		out.width(13);
+		out << toMilliseconds(cpuTimes[i]);
+		out.width(14);
+		out << phaseAllocations[i];
+		out.width(13);
+		out << phaseAllocatedBytes[i];
+		out.width(13);
+		out << phasePeakBytes[i] << endl;
+	}
+	for (int i = 0; i < (int)StatsCounter::Count; i++) {
+		out.width(22);
+		out << left << COUNTER_NAMES[i] << right << counters[i] << endl;
+	}
+	out << "structure       allocations  allocated B  peak live B" << endl;
+	for (int i = 0; i < (int)StatsStructure::Count; i++) {
+		out.width(14);
+		out << left << STRUCTURE_NAMES[i] << right;
+		out.width(13);
+		out << allocations[i];
+		out.width(13);
+		out << allocatedBytes[i];
+		out.width(13);
+		out << peakBytes[i] << endl;
+	}
+	out << "peak RSS B            " << peakResidentBytes() << endl;
+}
+
+/**
+ * Процессорное время, израсходованное процессом
+ * \return Время в наносекундах
+ */
+uint64_t SearchStats::cpuTime()
+{
+#ifdef _WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0;
+	uint64_t kernel = ((uint64_t)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+	uint64_t user = ((uint64_t)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+	// FILETIME измеряется в интервалах по 100 наносекунд
+	return (kernel + user) * 100;
+#else
+	timespec time;
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+		return 0;
+	return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+#endif
+}
+
+/**
+ * Начать замер этапа (если сбор статистики включён)
+ * \param[in] phase Этап
+ */
+PhaseTimer::PhaseTimer(StatsPhase phase)
+{
+	this->phase = phase;
+	this->active = SearchStats::isEnabled();
+	if (this->active) {
+		this->previousPhase = SearchStats::enterPhase(phase);
+		this->wallStart = chrono::steady_clock::now();
+		this->cpuStart = SearchStats::cpuTime();
+	}
+}
+
+/**
+ * Завершить замер этапа
+ */
+PhaseTimer::~PhaseTimer()
+{
+	if (!this->active)
+		return;
+	auto wallTime = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - this->wallStart).count();
+	SearchStats::addTime(this->phase, (uint64_t)wallTime, SearchStats::cpuTime() - this->cpuStart);
+	SearchStats::leavePhase(this->previousPhase);
+}
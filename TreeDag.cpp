@@ -0,0 +1,548 @@
+﻿#include "treeDag.h"
+#include "searchStats.h"
+#include "assignmentEngine.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+	uint64_t mixHash(uint64_t seed, uint64_t value)
+	{
+		seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+		return seed * 1099511628211ull;
+	}
+}
+
+/**
+ * Создать пустой DAG, который заполняется вызовами openNode и closeNode
+ */
+template <class Label>
+BasicTreeDag<Label>::BasicTreeDag()
+{
+	this->root = 0;
+}
+
+/**
+ * Построить DAG по готовому дереву
+ * \param[in] tree Главное дерево
+ */
+template <class Label>
+BasicTreeDag<Label>::BasicTreeDag(const TreeNode* tree)
+	: BasicTreeDag()
+{
+	this->addTree(tree);
+}
+
+/**
+ * Начать узел дерева: следующие узлы до парного closeNode становятся его потомками
+ * \param[in] label Метка узла
+ */
+template <class Label>
+void BasicTreeDag<Label>::openNode(const Label& label)
+{
+	this->openNodes.push_back(OpenNode{ label, this->closedChildren.size() });
+}
+
+/**
+ * Закончить последний начатый узел. Если такое же поддерево уже встречалось, узел заменяется его классом
+ */
+template <class Label>
+void BasicTreeDag<Label>::closeNode()
+{
+	const OpenNode& node = this->openNodes.back();
+	unsigned id = this->intern(node.label, node.firstChild);
+	this->closedChildren.resize(node.firstChild);
+	this->openNodes.pop_back();
+
+	if (this->openNodes.empty())
+		this->root = id;
+	else
+		this->closedChildren.push_back(id);
+}
+
+/**
+ * Найти класс поддерева с заданной меткой и закрытыми детьми или завести новый
+ * \param[in] label Метка корня поддерева
+ * \param[in] firstChild Начало детей в стеке закрытых детей
+ * \return Номер класса
+ */
+template <class Label>
+unsigned BasicTreeDag<Label>::intern(const Label& label, size_t firstChild)
+{
+	auto labelView = LabelTraits<Label>::view(label);
+	auto childrenBegin = this->closedChildren.begin() + firstChild;
+	auto childrenEnd = this->closedChildren.end();
+
+	uint64_t hash = LabelTraits<Label>::hash(labelView);
+	for (auto it = childrenBegin; it != childrenEnd; ++it)
+		hash = mixHash(hash, *it);
+
+	auto sameHash = this->idsByHash.equal_range(hash);
+	for (auto it = sameHash.first; it != sameHash.second; ++it) {
+		const DagNode& node = this->nodes[it->second];
+		if (LabelTraits<Label>::view(node.label) == labelView && node.childrenCount == (size_t)(childrenEnd - childrenBegin)
+			&& equal(childrenBegin, childrenEnd, this->childIds.begin() + node.firstChild))
+			return it->second;
+	}
+
+	unsigned long long treeSize = 1;
+	for (auto it = childrenBegin; it != childrenEnd; ++it)
+		treeSize += this->nodes[*it].treeSize;
+
+	unsigned id = (unsigned)this->nodes.size();
+	this->nodes.push_back(DagNode{ label, (unsigned)this->childIds.size(), (unsigned)(childrenEnd - childrenBegin), treeSize });
+	this->childIds.insert(this->childIds.end(), childrenBegin, childrenEnd);
+	this->idsByHash.emplace(hash, id);
+	return id;
+}
+
+/**
+ * Добавить в DAG дерево целиком
+ * \param[in] tree Дерево
+ * \param[out] classes Если задан, в него записывается класс каждого узла дерева
+ * \return Класс дерева
+ */
+template <class Label>
+unsigned BasicTreeDag<Label>::addTree(const TreeNode* tree, unordered_map<const TreeNode*, unsigned>* classes)
+{
+	this->openNode(LabelTraits<Label>::own(tree->getLabel()));
+	for (auto child : tree->getChildrenView())
+		this->addTree(child, classes);
+	this->closeNode();
+
+	unsigned id = this->openNodes.empty() ? this->root : this->closedChildren.back();
+	if (classes != nullptr)
+		(*classes)[tree] = id;
+	return id;
+}
+
+/**
+ * Узнать, пуст ли DAG
+ * \param[in] this DAG
+ * \return Логический флаг, что ни одно дерево не было построено
+ */
+template <class Label>
+bool BasicTreeDag<Label>::isEmpty() const
+{
+	return this->nodes.empty();
+}
+
+template <class Label>
+unsigned BasicTreeDag<Label>::getRoot() const
+{
+	return this->root;
+}
+
+/**
+ * Количество различных поддеревьев
+ * \param[in] this DAG
+ * \return Количество классов
+ */
+template <class Label>
+size_t BasicTreeDag<Label>::size() const
+{
+	return this->nodes.size();
+}
+
+/**
+ * Количество узлов в развёрнутом дереве
+ * \param[in] this DAG
+ * \return Количество узлов
+ */
+template <class Label>
+unsigned long long BasicTreeDag<Label>::getTreeSize() const
+{
+	return this->nodes.empty() ? 0 : this->nodes[this->root].treeSize;
+}
+
+template <class Label>
+typename BasicTreeDag<Label>::LabelView BasicTreeDag<Label>::getLabel(unsigned id) const
+{
+	return LabelTraits<Label>::view(this->nodes[id].label);
+}
+
+/**
+ * Дети класса поддеревьев
+ * \param[in] id Номер класса
+ * \return Диапазон номеров классов детей
+ */
+template <class Label>
+pair<vector<unsigned>::const_iterator, vector<unsigned>::const_iterator> BasicTreeDag<Label>::getChildren(unsigned id) const
+{
+	auto begin = this->childIds.begin() + this->nodes[id].firstChild;
+	return make_pair(begin, begin + this->nodes[id].childrenCount);
+}
+
+/**
+ * Развернуть класс в самостоятельное дерево
+ * \param[in] id Номер класса
+ * \return Дерево
+ */
+template <class Label>
+unique_ptr<BasicNode<Label>> BasicTreeDag<Label>::materialize(unsigned id) const
+{
+	auto tree = make_unique<TreeNode>(this->nodes[id].label);
+	auto children = this->getChildren(id);
+	for (auto it = children.first; it != children.second; ++it)
+		tree->addChild(this->materialize(*it));
+	return tree;
+}
+
+/**
+ * Все вхождения класса в дерево в прямом порядке обхода
+ * \param[in] id Номер класса
+ * \return Пути от корня до вхождений
+ */
+template <class Label>
+vector<typename BasicTreeDag<Label>::Location> BasicTreeDag<Label>::findOccurrences(unsigned id) const
+{
+	vector<bool> targets(this->nodes.size(), false);
+	targets[id] = true;
+	return this->collectOccurrences(targets);
+}
+
+/**
+ * Пути до вхождений заданных классов в прямом порядке обхода.
+ * Обходятся только классы, в поддеревьях которых есть искомые
+ * \param[in] targets Флаги искомых классов
+ * \return Пути от корня до вхождений
+ */
+template <class Label>
+vector<typename BasicTreeDag<Label>::Location> BasicTreeDag<Label>::collectOccurrences(const vector<bool>& targets) const
+{
+	vector<Location> locations;
+	if (this->nodes.empty())
+		return locations;
+
+	// Дети получают номера раньше родителей, поэтому достижимость считается одним проходом
+	vector<bool> reaches(targets);
+	for (unsigned id = 0; id < this->nodes.size(); id++) {
+		auto children = this->getChildren(id);
+		for (auto it = children.first; it != children.second && !reaches[id]; ++it)
+			reaches[id] = reaches[*it];
+	}
+	if (!reaches[this->root])
+		return locations;
+
+	struct Frame {
+		unsigned id;
+		unsigned nextChild;
+	};
+	vector<Frame> path{ { this->root, 0 } };
+	Location location;
+	if (targets[this->root])
+		locations.push_back(location);
+	while (!path.empty()) {
+		Frame& top = path.back();
+		if (top.nextChild == this->nodes[top.id].childrenCount) {
+			path.pop_back();
+			if (!location.empty())
+				location.pop_back();
+			continue;
+		}
+
+		unsigned childPosition = top.nextChild++;
+		unsigned child = this->childIds[this->nodes[top.id].firstChild + childPosition];
+		if (!reaches[child])
+			continue;
+		location.push_back(childPosition);
+		if (targets[child])
+			locations.push_back(location);
+		path.push_back(Frame{ child, 0 });
+	}
+	return locations;
+}
+
+template <class Label>
+bool BasicTreeDag<Label>::MemoKey::operator==(const MemoKey& other) const
+{
+	return this->id == other.id && this->cmpNode == other.cmpNode;
+}
+
+template <class Label>
+size_t BasicTreeDag<Label>::MemoKeyHash::operator()(const MemoKey& key) const
+{
+	return hash<const void*>()(key.cmpNode) ^ (key.id * 0x9e3779b97f4a7c15ull);
+}
+
+/**
+ * Вычислить вес соединения класса с одноимённым узлом искомого дерева (см. BasicNode::evaluateConnection)
+ * \param[in] id Номер класса
+ * \param[in] cmpChild Узел искомого дерева
+ * \param[in,out] memo Веса уже оценённых пар
+ * \return Количество недостающих узлов или -1, если сопоставление невозможно
+ */
+template <class Label>
+template <MatchPolicy policy>
+int BasicTreeDag<Label>::evaluateConnection(unsigned id, const TreeNode* cmpChild, WeightMemo& memo) const
+{
+	bool isLeaf = this->nodes[id].childrenCount == 0;
+	if (isLeaf && cmpChild->isLeaf())
+		return 0;
+	if (isLeaf)
+		return cmpChild->descendantsCount();
+	if (cmpChild->isLeaf())
+		return -1;
+	return this->template evaluateClass<policy>(id, cmpChild, memo);
+}
+
+/**
+ * Вычислить вес сопоставления класса с узлом искомого дерева прямо по DAG, не разворачивая класс.
+ * Значение то же, что у BasicNode::evaluatePatch для любого вхождения класса, а каждая пара
+ * (класс, узел искомого дерева) оценивается один раз, сколько бы раз класс ни встречался в дереве
+ * \param[in] id Номер класса
+ * \param[in] cmpTree Узел искомого дерева
+ * \param[in,out] memo Веса уже оценённых пар
+ * \return Количество недостающих узлов или -1, если сопоставление невозможно
+ */
+template <class Label>
+template <MatchPolicy policy>
+int BasicTreeDag<Label>::evaluateClass(unsigned id, const TreeNode* cmpTree, WeightMemo& memo) const
+{
+	auto found = memo.find(MemoKey{ id, cmpTree });
+	if (found != memo.end())
+		return found->second;
+	SearchStats::count(StatsCounter::NodesVisited);
+
+	auto children = this->getChildren(id);
+	size_t childrenCount = children.second - children.first;
+	size_t cmpChildrenCount = cmpTree->getChildrenCount();
+	int weight = 0;
+	if constexpr (policy == MatchPolicy::OrderedExact) {
+		// Лист главного дерева - как в BasicNode::buildPatch
+		if (childrenCount == 0)
+			weight = cmpTree->descendantsCount();
+		else if (childrenCount != cmpChildrenCount)
+			weight = -1;
+		for (size_t i = 0; i < childrenCount && weight != -1; i++) {
+			unsigned mainChild = children.first[i];
+			const TreeNode* cmpChild = cmpTree->getChild(i);
+			int curWeight = -1;
+			if (this->getLabel(mainChild) == cmpChild->getLabel())
+				curWeight = this->template evaluateConnection<policy>(mainChild, cmpChild, memo);
+			weight = curWeight == -1 ? -1 : weight + curWeight;
+		}
+	}
+	else if constexpr (policy == MatchPolicy::OrderedSubsequence) {
+		size_t cmpIndex = 0;
+		for (auto it = children.first; it != children.second && weight != -1; ++it) {
+			int curWeight = -1;
+			while (curWeight == -1 && cmpIndex < cmpChildrenCount) {
+				const TreeNode* cmpChild = cmpTree->getChild(cmpIndex++);
+				if (this->getLabel(*it) == cmpChild->getLabel())
+					curWeight = this->template evaluateConnection<policy>(*it, cmpChild, memo);
+				if (curWeight == -1)
+					weight += 1 + cmpChild->descendantsCount();
+			}
+			weight = curWeight == -1 ? -1 : weight + curWeight;
+		}
+		for (; cmpIndex < cmpChildrenCount && weight != -1; cmpIndex++)
+			weight += 1 + cmpTree->getChild(cmpIndex)->descendantsCount();
+	}
+	else {
+		// Дети класса раскладываются по группам одноимённых детей искомого узла (группа - номер её первого ребёнка);
+		// ребёнку без одноимённой группы сопоставить нечего
+		vector<pair<unsigned, unsigned>> rows;
+		rows.reserve(childrenCount);
+		for (auto it = children.first; it != children.second && weight != -1; ++it) {
+			auto cmpRange = cmpTree->findChildrenNamed(this->getLabel(*it));
+			if (cmpRange.first == cmpRange.second)
+				weight = -1;
+			else
+				rows.emplace_back(*cmpRange.first, *it);
+		}
+		sort(rows.begin(), rows.end());
+
+		auto groupRows = rows.begin();
+		for (unsigned cmpIndex = 0; cmpIndex < cmpChildrenCount && weight != -1; cmpIndex++) {
+			auto colsRange = cmpTree->findChildrenNamed(cmpTree->getChild(cmpIndex)->getLabel());
+			if (*colsRange.first != cmpIndex)
+				continue;
+
+			auto rowsEnd = groupRows;
+			while (rowsEnd != rows.end() && rowsEnd->first == cmpIndex)
+				++rowsEnd;
+			size_t rowsCount = rowsEnd - groupRows;
+			size_t colsCount = colsRange.second - colsRange.first;
+			int missingSum = 0;
+			int maxMissingCost = 0;
+			for (auto colIt = colsRange.first; colIt != colsRange.second; ++colIt) {
+				int missingCost = 1 + cmpTree->getChild(*colIt)->descendantsCount();
+				missingSum += missingCost;
+				maxMissingCost = max(maxMissingCost, missingCost);
+			}
+
+			if (rowsCount == 0) {
+				weight += missingSum;
+			}
+			else if (rowsCount == 1) {
+				int minWeight = -1;
+				int minMissingCost = 0;
+				for (auto colIt = colsRange.first; colIt != colsRange.second; ++colIt) {
+					const TreeNode* cmpChild = cmpTree->getChild(*colIt);
+					int curWeight = this->template evaluateConnection<policy>(groupRows->second, cmpChild, memo);
+					if (curWeight != -1 && (minWeight == -1 || curWeight < minWeight)) {
+						minWeight = curWeight;
+						minMissingCost = 1 + cmpChild->descendantsCount();
+					}
+				}
+				weight = minWeight == -1 ? -1 : weight + minWeight + missingSum - minMissingCost;
+			}
+			else {
+				SparseAssignment assignment((int)rowsCount, (int)colsCount);
+				for (size_t row = 0; row < rowsCount; row++) {
+					size_t col = 0;
+					for (auto colIt = colsRange.first; colIt != colsRange.second; ++colIt, col++) {
+						const TreeNode* cmpChild = cmpTree->getChild(*colIt);
+						int curWeight = this->template evaluateConnection<policy>(groupRows[row].second, cmpChild, memo);
+						if (curWeight != -1)
+							assignment.addEdge((int)row, (int)col, (long long)curWeight + maxMissingCost - 1 - cmpChild->descendantsCount());
+					}
+				}
+				if (assignment.solve())
+					weight += (int)(assignment.getCost() - (long long)rowsCount * maxMissingCost + missingSum);
+				else
+					weight = -1;
+			}
+			groupRows = rowsEnd;
+		}
+	}
+
+	memo.emplace(MemoKey{ id, cmpTree }, weight);
+	return weight;
+}
+
+/**
+ * Классы, входящие в дерево корня. Остальные классы принадлежат деревьям, добавленным раньше корня
+ * \return Флаги достижимости классов из корня
+ */
+template <class Label>
+vector<bool> BasicTreeDag<Label>::reachableClasses() const
+{
+	vector<bool> reachable(this->nodes.size(), false);
+	if (this->nodes.empty())
+		return reachable;
+
+	// Дети получают номера раньше родителей, поэтому достаточно одного прохода от корня к меньшим номерам
+	reachable[this->root] = true;
+	for (unsigned id = this->root + 1; id-- > 0;) {
+		if (!reachable[id])
+			continue;
+		auto children = this->getChildren(id);
+		for (auto it = children.first; it != children.second; ++it)
+			reachable[*it] = true;
+	}
+	return reachable;
+}
+
+/**
+ * Оценить каждый класс, метка которого совпадает с корнем искомого дерева, один раз для всех его вхождений.
+ * Классы оцениваются прямо по DAG: веса пар (класс, узел искомого дерева) общие для всех кандидатов.
+ * Кандидатами считаются только классы из дерева корня
+ * \param[in] cmpTree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество недостающих узлов для каждого класса (-1 - не кандидат или сопоставление невозможно)
+ */
+template <class Label>
+vector<int> BasicTreeDag<Label>::evaluateCandidates(const TreeNode* cmpTree, MatchPolicy policy) const
+{
+	vector<int> deltas(this->nodes.size(), -1);
+	PhaseTimer timer(StatsPhase::PatchBuilding);
+	WeightMemo memo;
+	vector<bool> reachable = this->reachableClasses();
+	for (unsigned id = 0; id < this->nodes.size(); id++) {
+		if (!reachable[id] || this->getLabel(id) != cmpTree->getLabel())
+			continue;
+		SearchStats::count(StatsCounter::CandidatesEvaluated);
+		switch (policy) {
+		case MatchPolicy::OrderedSubsequence:
+			deltas[id] = this->template evaluateClass<MatchPolicy::OrderedSubsequence>(id, cmpTree, memo);
+			break;
+		case MatchPolicy::OrderedExact:
+			deltas[id] = this->template evaluateClass<MatchPolicy::OrderedExact>(id, cmpTree, memo);
+			break;
+		default:
+			deltas[id] = this->template evaluateClass<MatchPolicy::Unordered>(id, cmpTree, memo);
+			break;
+		}
+	}
+	return deltas;
+}
+
+/**
+ * Подсчёт недостающих узлов без построения дерева разности
+ * \param[in] cmpTree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву, или -1, если поддерево не найдено
+ */
+template <class Label>
+int BasicTreeDag<Label>::countMissingNodes(const TreeNode* cmpTree, MatchPolicy policy) const
+{
+	int minDelta = -1;
+	for (int delta : this->evaluateCandidates(cmpTree, policy)) {
+		if (delta != -1 && (minDelta == -1 || delta < minDelta))
+			minDelta = delta;
+	}
+	return minDelta;
+}
+
+/**
+ * Поиск поддерева в DAG. Результат тот же, что у Node::findSubTree для развёрнутого дерева,
+ * но каждый класс оценивается один раз, а все вхождения лучших классов возвращаются путями
+ * \param[in] cmpTree Искомое дерево
+ * \param[out] deltaTree Дерево разности для первого вхождения (с родословной от корня)
+ * \param[out] locations Пути до всех вхождений с минимальным количеством недостающих узлов
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву, или -1, если поддерево не найдено
+ */
+template <class Label>
+int BasicTreeDag<Label>::findSubTree(const TreeNode* cmpTree, unique_ptr<TreeNode>& deltaTree, vector<Location>& locations, MatchPolicy policy) const
+{
+	deltaTree = nullptr;
+	locations.clear();
+
+	vector<int> deltas = this->evaluateCandidates(cmpTree, policy);
+	int minDelta = -1;
+	for (int delta : deltas) {
+		if (delta != -1 && (minDelta == -1 || delta < minDelta))
+			minDelta = delta;
+	}
+	if (minDelta == -1)
+		return -1;
+
+	vector<bool> targets(this->nodes.size(), false);
+	for (unsigned id = 0; id < this->nodes.size(); id++)
+		targets[id] = deltas[id] == minDelta;
+	locations = this->collectOccurrences(targets);
+	if (locations.empty())
+		return -1;
+
+	// Дерево разности строится для первого вхождения, как и в поиске по обычному дереву
+	const Location& first = locations.front();
+	unsigned id = this->root;
+	for (unsigned childPosition : first)
+		id = this->childIds[this->nodes[id].firstChild + childPosition];
+
+	auto candidate = this->materialize(id);
+	unique_ptr<TreeNode> candidateDelta;
+	int delta = candidate->buildDeltaTreeWrap(cmpTree, candidateDelta, policy);
+	if (candidateDelta == nullptr || first.empty()) {
+		deltaTree = move(candidateDelta);
+		return delta;
+	}
+
+	PhaseTimer timer(StatsPhase::Pedigree);
+	deltaTree = make_unique<TreeNode>(this->nodes[this->root].label);
+	TreeNode* ancestor = deltaTree.get();
+	id = this->root;
+	for (size_t i = 0; i + 1 < first.size(); i++) {
+		id = this->childIds[this->nodes[id].firstChild + first[i]];
+		ancestor = ancestor->addChild(make_unique<TreeNode>(this->nodes[id].label));
+	}
+	ancestor->addChild(move(candidateDelta));
+	return delta;
+}
+
+template class BasicTreeDag<TextLabel>;
+template class BasicTreeDag<uint32_t>;
+template class BasicTreeDag<InternedLabel>;
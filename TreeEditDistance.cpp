@@ -0,0 +1,227 @@
+﻿#include "treeEditDistance.h"
+
+using namespace std;
+
+/**
+ * Добавить имя узла в словарь
+ * \param[in] label Имя узла
+ * \return Номер имени в словаре
+ */
+int LabelDictionary::add(string_view label)
+{
+	auto it = ids.find(label);
+	if (it != ids.end())
+		return it->second;
+	names.emplace_back(label);
+	return ids.emplace(names.back(), (int)names.size() - 1).first->second;
+}
+
+/**
+ * Найти номер имени узла в словаре
+ * \param[in] label Имя узла
+ * \return Номер имени или -1, если имени нет в словаре
+ */
+int LabelDictionary::find(string_view label) const
+{
+	auto it = ids.find(label);
+	if (it == ids.end())
+		return -1;
+	return it->second;
+}
+
+/**
+ * Разложить дерево в массивы обратного порядка обхода, пополняя словарь имён
+ * \param[in] root Корень дерева
+ * \param[in,out] dictionary Словарь имён
+ */
+PostorderTree::PostorderTree(const Node* root, LabelDictionary& dictionary)
+{
+	build(root, dictionary);
+}
+
+/**
+ * Разложить дерево в массивы обратного порядка обхода по готовому словарю.
+ * Имена, которых нет в словаре, получают номер -1 и не совпадают ни с одним именем словаря
+ * \param[in] root Корень дерева
+ * \param[in] dictionary Словарь имён
+ */
+PostorderTree::PostorderTree(const Node* root, const LabelDictionary& dictionary)
+{
+	build(root, dictionary);
+}
+
+template <class Dictionary>
+void PostorderTree::build(const Node* root, Dictionary& dictionary)
+{
+	int count = root->descendantsCount() + 1;
+	labels.reserve(count);
+	leftmostLeaves.reserve(count);
+
+	// Обход без рекурсии: в стеке хранятся дети узла, индекс следующего ребёнка и номер первого узла поддерева
+	struct Frame {
+		const Node* node;
+		PointerView<Node> children;
+		size_t nextChild;
+		int leftmostLeaf;
+	};
+	vector<Frame> path;
+	path.push_back({ root, root->getChildrenView(), 0, 0 });
+	while (!path.empty()) {
+		Frame& top = path.back();
+		if (top.nextChild < top.children.size()) {
+			const Node* child = top.children[top.nextChild++];
+			path.push_back({ child, child->getChildrenView(), 0, (int)labels.size() });
+			continue;
+		}
+
+		if constexpr (is_const_v<Dictionary>)
+			labels.push_back(dictionary.find(top.node->getLabel()));
+		else
+			labels.push_back(dictionary.add(top.node->getLabel()));
+		leftmostLeaves.push_back(top.leftmostLeaf);
+		path.pop_back();
+	}
+
+	// Ключевые корни: узлы, у которых нет правого брата с тем же самым левым листом
+	vector<bool> seenLeftmost(labels.size(), false);
+	for (int i = (int)labels.size() - 1; i >= 0; i--) {
+		if (!seenLeftmost[leftmostLeaves[i]]) {
+			seenLeftmost[leftmostLeaves[i]] = true;
+			keyroots.push_back(i);
+		}
+	}
+	reverse(keyroots.begin(), keyroots.end());
+}
+
+int PostorderTree::size() const
+{
+	return (int)labels.size();
+}
+
+int PostorderTree::labelAt(int index) const
+{
+	return labels[index];
+}
+
+int PostorderTree::leftmostLeafAt(int index) const
+{
+	return leftmostLeaves[index];
+}
+
+const vector<int>& PostorderTree::getKeyroots() const
+{
+	return keyroots;
+}
+
+/**
+ * Редакционное расстояние между деревьями (алгоритм Жанга-Шаши) с единичной стоимостью
+ * вставки, удаления и переименования узла. Требует O(n*m) памяти
+ * \param[in] tree1 Первое дерево
+ * \param[in] tree2 Второе дерево
+ * \return Минимальное количество операций, переводящих первое дерево во второе
+ */
+int treeEditDistance(const PostorderTree& tree1, const PostorderTree& tree2)
+{
+	const int size1 = tree1.size();
+	const int size2 = tree2.size();
+	const int width = size2 + 1;
+
+	// Расстояния между поддеревьями и между лесами хранятся в плоских массивах со сдвигом индексов на единицу
+	vector<int> treeDistance((size1 + 1) * width, 0);
+	vector<int> forestDistance((size1 + 1) * width, 0);
+
+	for (int keyroot1 : tree1.getKeyroots()) {
+		for (int keyroot2 : tree2.getKeyroots()) {
+			const int left1 = tree1.leftmostLeafAt(keyroot1);
+			const int left2 = tree2.leftmostLeafAt(keyroot2);
+
+			forestDistance[left1 * width + left2] = 0;
+			for (int i = left1; i <= keyroot1; i++)
+				forestDistance[(i + 1) * width + left2] = forestDistance[i * width + left2] + 1;
+			for (int j = left2; j <= keyroot2; j++)
+				forestDistance[left1 * width + j + 1] = forestDistance[left1 * width + j] + 1;
+
+			for (int i = left1; i <= keyroot1; i++) {
+				const int leftI = tree1.leftmostLeafAt(i);
+				const int labelI = tree1.labelAt(i);
+				int* row = &forestDistance[(i + 1) * width];
+				const int* prevRow = &forestDistance[i * width];
+				for (int j = left2; j <= keyroot2; j++) {
+					const int leftJ = tree2.leftmostLeafAt(j);
+					int best = min(prevRow[j + 1], row[j]) + 1;
+					if (leftI == left1 && leftJ == left2) {
+						int relabel = prevRow[j] + (labelI == tree2.labelAt(j) ? 0 : 1);
+						best = min(best, relabel);
+						treeDistance[(i + 1) * width + j + 1] = best;
+					}
+					else {
+						best = min(best, forestDistance[leftI * width + leftJ] + treeDistance[(i + 1) * width + j + 1]);
+					}
+					row[j + 1] = best;
+				}
+			}
+		}
+	}
+
+	return treeDistance[size1 * width + size2];
+}
+
+/**
+ * Редакционное расстояние между деревьями
+ * \param[in] tree1 Первое дерево
+ * \param[in] tree2 Второе дерево
+ * \return Минимальное количество операций, переводящих первое дерево во второе
+ */
+int treeEditDistance(const Node* tree1, const Node* tree2)
+{
+	LabelDictionary dictionary;
+	PostorderTree postorder1(tree1, dictionary);
+	PostorderTree postorder2(tree2, dictionary);
+	return treeEditDistance(postorder1, postorder2);
+}
+
+/**
+ * Поиск поддерева главного дерева, ближайшего к искомому по редакционному расстоянию.
+ * Кандидаты отбираются так же, как в Node::findSubTree - по имени корня искомого дерева
+ * \param[in] mainTree Главное дерево
+ * \param[in] cmpTree Искомое дерево
+ * \param[out] closestTree Ближайшее поддерево или nullptr, если кандидатов нет
+ * \return Редакционное расстояние до ближайшего поддерева или -1, если кандидатов нет
+ */
+int findClosestSubTree(const Node* mainTree, const Node* cmpTree, const Node** closestTree)
+{
+	LabelDictionary dictionary;
+	PostorderTree searchedPostorder(cmpTree, dictionary);
+	const LabelDictionary& patternLabels = dictionary;
+
+	int minDistance = -1;
+	*closestTree = nullptr;
+	for (const auto& candidate : mainTree->findDescendants(cmpTree->getLabel())) {
+		PostorderTree candidatePostorder(candidate, patternLabels);
+		int distance = treeEditDistance(candidatePostorder, searchedPostorder);
+		if (minDistance == -1 || distance < minDistance) {
+			minDistance = distance;
+			*closestTree = candidate;
+		}
+	}
+	return minDistance;
+}
+
+/**
+ * Разобрать название метрики поиска
+ * \param[in] note Название метрики: delta, count (только количество недостающих узлов) или ted
+ * \param[out] metric Метрика поиска
+ * \return Успешность разбора
+ */
+bool parseSearchMetric(const string& note, SearchMetric& metric)
+{
+	if (note == "delta")
+		metric = SearchMetric::MissingNodes;
+	else if (note == "count")
+		metric = SearchMetric::MissingCount;
+	else if (note == "ted")
+		metric = SearchMetric::EditDistance;
+	else
+		return false;
+	return true;
+}
@@ -0,0 +1,613 @@
+﻿#include "treeLayout.h"
+#include "searchStats.h"
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+
+using namespace std;
+
+namespace {
+	const char LAYOUT_MAGIC[4] = { 'F', 'S', 'T', 'L' };
+	const uint32_t LAYOUT_VERSION = 1;
+	// Заголовок: сигнатура, версия, количество узлов и меток, смещения меток и списков узлов меток
+	const uint64_t HEADER_SIZE = sizeof(LAYOUT_MAGIC) + sizeof(uint32_t) + 4 * sizeof(uint64_t);
+	const uint64_t NO_PARENT = UINT64_MAX;
+	// Количество номеров узлов, читаемых из списка метки за раз
+	const size_t POSTINGS_BLOCK = 4096;
+
+	template <class T>
+	void writeValue(ostream& out, const T& value)
+	{
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <class T>
+	bool readValue(istream& in, T& value)
+	{
+		in.read(reinterpret_cast<char*>(&value), sizeof(T));
+		return (bool)in;
+	}
+
+	// Количество записей узлов в одной странице чтения или записи при заданном ограничении памяти
+	size_t pageRecords(size_t memoryBudget, size_t recordSize)
+	{
+		return min<size_t>(max<size_t>(memoryBudget / 4 / recordSize, 64), 65536);
+	}
+}
+
+// Запись раскладки за один проход по тексту дерева. Записи узлов копятся в странице и сбрасываются в файл;
+// последний потомок и число детей узла известны только после его закрытия, поэтому записи ещё открытых
+// (а значит, лежащих на пути от корня) узлов, уже сброшенных в файл, исправляются в конце
+class TreeLayout::Writer {
+public:
+	Writer(fstream& out, size_t memoryBudget)
+		: out(out), memoryBudget(memoryBudget)
+	{
+		this->nodesCount = 0;
+		this->pageStart = 0;
+		this->pageSize = pageRecords(memoryBudget, sizeof(LayoutNode));
+	}
+
+	void openNode(const string& label)
+	{
+		uint32_t id;
+		auto found = this->ids.find(label);
+		if (found == this->ids.end()) {
+			id = (uint32_t)this->labels.size();
+			this->labels.push_back(&this->ids.emplace(label, id).first->first);
+			this->counts.push_back(0);
+		}
+		else {
+			id = found->second;
+		}
+		this->counts[id]++;
+
+		uint64_t parent = NO_PARENT;
+		if (!this->openNodes.empty()) {
+			parent = this->openNodes.back().first;
+			this->openNodes.back().second++;
+		}
+		this->openNodes.emplace_back(this->nodesCount, 0);
+		this->page.push_back({ parent, this->nodesCount, id, 0 });
+		this->nodesCount++;
+		if (this->page.size() >= this->pageSize)
+			this->flushPage();
+	}
+
+	void closeNode()
+	{
+		auto node = this->openNodes.back();
+		this->openNodes.pop_back();
+		if (node.first >= this->pageStart) {
+			LayoutNode& record = this->page[node.first - this->pageStart];
+			record.last = this->nodesCount - 1;
+			record.childrenCount = node.second;
+		}
+		else {
+			this->patches.push_back({ node.first, this->nodesCount - 1, node.second });
+		}
+	}
+
+	bool finish()
+	{
+		this->flushPage();
+		for (const auto& patch : this->patches) {
+			this->out.seekp(HEADER_SIZE + patch.index * sizeof(LayoutNode) + offsetof(LayoutNode, last));
+			writeValue(this->out, patch.last);
+			this->out.seekp(HEADER_SIZE + patch.index * sizeof(LayoutNode) + offsetof(LayoutNode, childrenCount));
+			writeValue(this->out, patch.childrenCount);
+		}
+		this->patches.clear();
+
+		uint64_t postingsOffset = HEADER_SIZE + this->nodesCount * sizeof(LayoutNode);
+		uint64_t labelsOffset = postingsOffset + this->nodesCount * sizeof(uint64_t);
+		if (!this->out.flush() || !this->writePostings(postingsOffset))
+			return false;
+
+		this->out.seekp(labelsOffset);
+		for (const string* label : this->labels) {
+			writeValue(this->out, (uint32_t)label->size());
+			this->out.write(label->data(), label->size());
+		}
+		for (uint64_t count : this->counts)
+			writeValue(this->out, count);
+
+		this->out.seekp(0);
+		this->out.write(LAYOUT_MAGIC, sizeof(LAYOUT_MAGIC));
+		writeValue(this->out, LAYOUT_VERSION);
+		writeValue(this->out, this->nodesCount);
+		writeValue(this->out, (uint64_t)this->labels.size());
+		writeValue(this->out, labelsOffset);
+		writeValue(this->out, postingsOffset);
+		return (bool)this->out.flush();
+	}
+private:
+	struct Patch
+	{
+		uint64_t index;
+		uint64_t last;
+		uint32_t childrenCount;
+	};
+
+	void flushPage()
+	{
+		this->out.seekp(HEADER_SIZE + this->pageStart * sizeof(LayoutNode));
+		this->out.write(reinterpret_cast<const char*>(this->page.data()), this->page.size() * sizeof(LayoutNode));
+		this->pageStart += this->page.size();
+		this->page.clear();
+	}
+
+	// Списки узлов меток собираются повторными чтениями записей узлов: за один проход - группа меток,
+	// списки которых умещаются в ограничение памяти. Узлы каждой метки встречаются по возрастанию номеров,
+	// поэтому список слишком частой метки дописывается частями
+	bool writePostings(uint64_t postingsOffset)
+	{
+		vector<uint64_t> cursors(this->counts.size());
+		uint64_t cursor = 0;
+		for (size_t label = 0; label < this->counts.size(); label++) {
+			cursors[label] = cursor;
+			cursor += this->counts[label];
+		}
+
+		size_t limit = max<size_t>(this->memoryBudget / sizeof(uint64_t), POSTINGS_BLOCK);
+		vector<LayoutNode> records(this->pageSize);
+		size_t firstLabel = 0;
+		while (firstLabel < this->counts.size()) {
+			size_t lastLabel = firstLabel;
+			uint64_t total = 0;
+			while (lastLabel < this->counts.size() && (lastLabel == firstLabel || total + this->counts[lastLabel] <= limit))
+				total += this->counts[lastLabel++];
+
+			vector<vector<uint64_t>> lists(lastLabel - firstLabel);
+			size_t collected = 0;
+			auto flushLists = [&]() {
+				for (size_t i = 0; i < lists.size(); i++) {
+					if (lists[i].empty())
+						continue;
+					this->out.seekp(postingsOffset + cursors[firstLabel + i] * sizeof(uint64_t));
+					this->out.write(reinterpret_cast<const char*>(lists[i].data()), lists[i].size() * sizeof(uint64_t));
+					cursors[firstLabel + i] += lists[i].size();
+					lists[i].clear();
+				}
+				collected = 0;
+			};
+
+			for (uint64_t start = 0; start < this->nodesCount; start += records.size()) {
+				size_t count = (size_t)min<uint64_t>(records.size(), this->nodesCount - start);
+				this->out.seekg(HEADER_SIZE + start * sizeof(LayoutNode));
+				this->out.read(reinterpret_cast<char*>(records.data()), count * sizeof(LayoutNode));
+				if (!this->out)
+					return false;
+				for (size_t i = 0; i < count; i++) {
+					if (records[i].label < firstLabel || records[i].label >= lastLabel)
+						continue;
+					lists[records[i].label - firstLabel].push_back(start + i);
+					if (++collected >= limit)
+						flushLists();
+				}
+			}
+			flushLists();
+			firstLabel = lastLabel;
+		}
+		return (bool)this->out;
+	}
+
+	fstream& out;
+	size_t memoryBudget;
+	uint64_t nodesCount;
+	// Словарь меток: номера меток в порядке появления и количество узлов каждой метки
+	unordered_map<string, uint32_t> ids;
+	vector<const string*> labels;
+	vector<uint64_t> counts;
+	// Открытые узлы: номер и количество уже прочитанных детей
+	vector<pair<uint64_t, uint32_t>> openNodes;
+	vector<LayoutNode> page;
+	uint64_t pageStart;
+	size_t pageSize;
+	vector<Patch> patches;
+};
+
+/**
+ * Разложить главное дерево в файл за один проход по его тексту, не строя дерево в памяти.
+ * Лексемы разбираются так же, как в parseOnDag; переводы строк пропускаются, как при чтении файла дерева
+ * \param[in] in Поток с текстом дерева
+ * \param[in] layoutPath Путь к файлу раскладки
+ * \param[in] delimiters Разделители
+ * \param[out] error Описание ошибки, если раскладку построить не удалось
+ * \param[in] memoryBudget Ограничение памяти под страницы записей и списки узлов меток, в байтах
+ * \return Успешность построения
+ */
+bool TreeLayout::build(istream& in, const string& layoutPath, const string& delimiters, string& error, size_t memoryBudget)
+{
+	PhaseTimer timer(StatsPhase::TreeBuilding);
+	fstream out(layoutPath, ios::in | ios::out | ios::binary | ios::trunc);
+	if (!out.is_open()) {
+		error = "Can't create the layout file '" + layoutPath + "'";
+		return false;
+	}
+
+	Writer writer(out, memoryBudget);
+	auto isDelimiter = [&](int symbol) { return delimiters.find((char)symbol) != string::npos; };
+	bool started = false;
+	// Слово, после которого ещё не известно, открывает ли оно поддерево
+	bool pendingWord = false;
+	int openCount = 0;
+	int bracketBalance = 0;
+	string word;
+	auto addLexem = [&](char bracket, const string& label) {
+		if (!started) {
+			started = true;
+			openCount = 1;
+			writer.openNode(label);
+			return;
+		}
+		if (openCount == 0)
+			return;
+		if (pendingWord) {
+			pendingWord = false;
+			if (bracket == '(') {
+				openCount++;
+				return;
+			}
+			writer.closeNode();
+		}
+		if (bracket == ')') {
+			writer.closeNode();
+			openCount--;
+		}
+		else if (bracket == 0) {
+			writer.openNode(label);
+			pendingWord = true;
+		}
+	};
+
+	streambuf* source = in.rdbuf();
+	for (int symbol = source->sbumpc(); ; symbol = source->sbumpc()) {
+		if (symbol == '\n')
+			continue;
+		if (!word.empty() && (symbol == EOF || isDelimiter(symbol))) {
+			addLexem(0, word);
+			word.clear();
+		}
+		if (symbol == EOF)
+			break;
+
+		if (!word.empty()) {
+			word.push_back((char)symbol);
+		}
+		else if (symbol == '(' || symbol == ')') {
+			bracketBalance += symbol == '(' ? 1 : -1;
+			addLexem((char)symbol, "");
+		}
+		else if (isalnum((char)symbol)) {
+			word.push_back((char)symbol);
+		}
+		else if (!isDelimiter(symbol)) {
+			error = "Detected invalid character '" + to_string((unsigned char)symbol) + "' in the main tree";
+			return false;
+		}
+	}
+
+	if (bracketBalance != 0) {
+		error = "The balance of brackets is off: " + string(bracketBalance > 0 ? "Opening" : "Closing") + " brackets are " + to_string(abs(bracketBalance)) + " more";
+		return false;
+	}
+	if (!started) {
+		error = "The main tree is empty";
+		return false;
+	}
+	if (pendingWord)
+		writer.closeNode();
+	for (; openCount > 0; openCount--)
+		writer.closeNode();
+
+	if (!writer.finish()) {
+		error = "Can't write the layout file '" + layoutPath + "'";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Создать пустую (не открытую) раскладку
+ */
+TreeLayout::TreeLayout()
+{
+	this->nodesCount = 0;
+	this->postingsOffset = 0;
+	this->pageStart = 0;
+	this->memoryBudget = DEFAULT_MEMORY_BUDGET;
+	this->skippedCandidates = 0;
+}
+
+/**
+ * Открыть файл раскладки. В память читаются только заголовок и словарь меток
+ * \param[in] layoutPath Путь к файлу раскладки
+ * \return Успешность открытия
+ */
+bool TreeLayout::open(const string& layoutPath)
+{
+	this->file.close();
+	this->file.clear();
+	this->file.open(layoutPath, ios::binary);
+	if (!this->file.is_open())
+		return false;
+
+	char magic[sizeof(LAYOUT_MAGIC)];
+	uint32_t version;
+	uint64_t labelsCount, labelsOffset;
+	this->file.read(magic, sizeof(magic));
+	if (!this->file || !equal(begin(magic), end(magic), begin(LAYOUT_MAGIC)))
+		return false;
+	if (!readValue(this->file, version) || version != LAYOUT_VERSION)
+		return false;
+	if (!readValue(this->file, this->nodesCount) || !readValue(this->file, labelsCount) || !readValue(this->file, labelsOffset) || !readValue(this->file, this->postingsOffset))
+		return false;
+
+	auto text = make_shared<string>();
+	this->labelBounds.assign(labelsCount, { 0, 0 });
+	this->file.seekg(labelsOffset);
+	for (auto& bounds : this->labelBounds) {
+		uint32_t length;
+		if (!readValue(this->file, length))
+			return false;
+		bounds = { text->size(), length };
+		text->resize(text->size() + length);
+		this->file.read(text->data() + bounds.first, length);
+	}
+
+	this->postings.assign(labelsCount, { 0, 0 });
+	uint64_t first = 0;
+	for (auto& posting : this->postings) {
+		if (!readValue(this->file, posting.second))
+			return false;
+		posting.first = first;
+		first += posting.second;
+	}
+
+	this->labelsText = move(text);
+	this->labelIds.clear();
+	for (uint32_t id = 0; id < labelsCount; id++)
+		this->labelIds.emplace(LabelTraits<TextLabel>::view(this->makeLabel(id)), id);
+	this->page.clear();
+	this->pageStart = 0;
+	return true;
+}
+
+/**
+ * Узнать, открыт ли файл раскладки
+ * \return Логический флаг открытости
+ */
+bool TreeLayout::isOpen() const
+{
+	return this->file.is_open();
+}
+
+/**
+ * Количество узлов разложенного дерева
+ * \return Количество узлов
+ */
+uint64_t TreeLayout::size() const
+{
+	return this->nodesCount;
+}
+
+/**
+ * Количество различных меток разложенного дерева
+ * \return Количество меток
+ */
+size_t TreeLayout::getLabelsCount() const
+{
+	return this->labelBounds.size();
+}
+
+/**
+ * Задать ограничение памяти под страницу записей и загруженного кандидата
+ * \param[in] bytes Ограничение в байтах
+ */
+void TreeLayout::setMemoryBudget(size_t bytes)
+{
+	this->memoryBudget = bytes;
+	this->page.clear();
+}
+
+/**
+ * Количество кандидатов последнего поиска, которые не уместились в ограничение памяти и не были проверены
+ * \return Количество пропущенных кандидатов
+ */
+size_t TreeLayout::getSkippedCandidates() const
+{
+	return this->skippedCandidates;
+}
+
+/**
+ * Подсчёт недостающих узлов без построения дерева разности (см. BasicNode::countMissingNodes)
+ * \param[in] cmpTree Искомое дерево
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву, или -1, если поддерево не найдено
+ */
+int TreeLayout::countMissingNodes(const Node* cmpTree, MatchPolicy policy)
+{
+	uint64_t bestPosition;
+	return this->evaluateCandidates(cmpTree, policy, bestPosition);
+}
+
+/**
+ * Поиск поддерева в разложенном главном дереве (см. BasicNode::findSubTree).
+ * Дерево разности строится по лучшему кандидату и пути до него от корня, прочитанным из файла
+ * \param[in] cmpTree Искомое дерево
+ * \param[out] deltaTree Дерево разности
+ * \param[in] policy Способ сопоставления детей
+ * \return Количество узлов, которые необходимо добавить к главному дереву, или -1, если поддерево не найдено
+ */
+int TreeLayout::findSubTree(const Node* cmpTree, unique_ptr<Node>& deltaTree, MatchPolicy policy)
+{
+	deltaTree = nullptr;
+	uint64_t bestPosition;
+	if (this->evaluateCandidates(cmpTree, policy, bestPosition) == -1)
+		return -1;
+
+	// Файл мог измениться или перестать читаться после оценки кандидатов
+	unique_ptr<Node> candidate;
+	if (this->loadCandidate(bestPosition, this->describePattern(cmpTree), candidate) != LoadResult::Loaded)
+		return -1;
+	Node* deepestAncestor = nullptr;
+	auto ancestors = this->loadAncestors(bestPosition, &deepestAncestor);
+	if (ancestors == nullptr)
+		return candidate->findSubTreeAmong({ candidate.get() }, cmpTree, deltaTree, policy);
+
+	const Node* candidateRoot = deepestAncestor->addChild(move(candidate));
+	return ancestors->findSubTreeAmong({ candidateRoot }, cmpTree, deltaTree, policy);
+}
+
+const TreeLayout::LayoutNode& TreeLayout::readNode(uint64_t index)
+{
+	if (index < this->pageStart || index >= this->pageStart + this->page.size()) {
+		PhaseTimer timer(StatsPhase::FileRead);
+		size_t count = (size_t)min<uint64_t>(pageRecords(this->memoryBudget, sizeof(LayoutNode)), this->nodesCount - index);
+		this->page.resize(count);
+		this->pageStart = index;
+		this->file.clear();
+		this->file.seekg(HEADER_SIZE + index * sizeof(LayoutNode));
+		this->file.read(reinterpret_cast<char*>(this->page.data()), count * sizeof(LayoutNode));
+	}
+	return this->page[index - this->pageStart];
+}
+
+bool TreeLayout::readPostings(uint32_t label, uint64_t first, vector<uint64_t>& positions)
+{
+	const auto& posting = this->postings[label];
+	if (first >= posting.second)
+		return false;
+
+	PhaseTimer timer(StatsPhase::CandidateLookup);
+	positions.resize((size_t)min<uint64_t>(POSTINGS_BLOCK, posting.second - first));
+	this->file.clear();
+	this->file.seekg(this->postingsOffset + (posting.first + first) * sizeof(uint64_t));
+	this->file.read(reinterpret_cast<char*>(positions.data()), positions.size() * sizeof(uint64_t));
+	return (bool)this->file;
+}
+
+bool TreeLayout::findLabel(string_view label, uint32_t& id) const
+{
+	auto found = this->labelIds.find(label);
+	if (found == this->labelIds.end())
+		return false;
+	id = found->second;
+	return true;
+}
+
+TextLabel TreeLayout::makeLabel(uint32_t id) const
+{
+	const auto& bounds = this->labelBounds[id];
+	return TextLabel{ string_view(*this->labelsText).substr(bounds.first, bounds.second), this->labelsText };
+}
+
+// Для каждой глубины искомого дерева - наибольшее число детей и метки его узлов на этой глубине.
+// Узел главного дерева сопоставляется только узлу искомого дерева той же глубины и должен отдать каждого
+// ребёнка одноимённому ребёнку пары, поэтому кандидат, нарушающий эти ограничения, не подходит
+// (в частности, у кандидата не может быть узлов глубже искомого дерева)
+vector<TreeLayout::PatternLevel> TreeLayout::describePattern(const Node* cmpTree) const
+{
+	vector<PatternLevel> levels;
+	vector<const Node*> level = { cmpTree };
+	while (!level.empty()) {
+		PatternLevel description{ 0, {} };
+		vector<const Node*> nextLevel;
+		for (const Node* node : level) {
+			uint32_t id;
+			if (this->findLabel(node->getLabel(), id))
+				description.labels.insert(id);
+			description.maxChildren = max(description.maxChildren, node->getChildrenCount());
+			for (auto child : node->getChildrenView())
+				nextLevel.push_back(child);
+		}
+		levels.push_back(move(description));
+		level = move(nextLevel);
+	}
+	return levels;
+}
+
+// Загрузить поддерево кандидата из непрерывного отрезка записей, проверяя ограничения искомого дерева
+TreeLayout::LoadResult TreeLayout::loadCandidate(uint64_t position, const vector<PatternLevel>& levels, unique_ptr<Node>& candidate)
+{
+	struct OpenNode
+	{
+		Node* node;
+		uint64_t last;
+		size_t depth;
+	};
+
+	size_t maxNodes = max<size_t>(this->memoryBudget / (sizeof(Node) + sizeof(unique_ptr<Node>)), 1);
+	LayoutNode root = this->readNode(position);
+	if (root.childrenCount > levels[0].maxChildren)
+		return LoadResult::Impossible;
+
+	candidate = make_unique<Node>(this->makeLabel(root.label));
+	vector<OpenNode> openNodes = { { candidate.get(), root.last, 0 } };
+	size_t loadedCount = 1;
+	for (uint64_t index = position + 1; index <= root.last; index++) {
+		const LayoutNode& record = this->readNode(index);
+		while (index > openNodes.back().last)
+			openNodes.pop_back();
+
+		size_t depth = openNodes.back().depth + 1;
+		if (record.childrenCount > levels[depth].maxChildren || levels[depth].labels.count(record.label) == 0)
+			return LoadResult::Impossible;
+		if (++loadedCount > maxNodes)
+			return LoadResult::OverBudget;
+
+		Node* child = openNodes.back().node->addChild(make_unique<Node>(this->makeLabel(record.label)));
+		if (record.last > index)
+			openNodes.push_back({ child, record.last, depth });
+	}
+	return LoadResult::Loaded;
+}
+
+// Путь от корня до родителя узла в виде цепочки узлов (nullptr, если узел - корень)
+unique_ptr<Node> TreeLayout::loadAncestors(uint64_t position, Node** deepestAncestor)
+{
+	vector<uint32_t> labels;
+	for (uint64_t index = this->readNode(position).parent; index != NO_PARENT; index = this->readNode(index).parent)
+		labels.push_back(this->readNode(index).label);
+	if (labels.empty())
+		return nullptr;
+
+	auto ancestors = make_unique<Node>(this->makeLabel(labels.back()));
+	*deepestAncestor = ancestors.get();
+	for (auto label = labels.rbegin() + 1; label != labels.rend(); ++label)
+		*deepestAncestor = (*deepestAncestor)->addChild(make_unique<Node>(this->makeLabel(*label)));
+	return ancestors;
+}
+
+// Оценить всех кандидатов по одному, как findSubTreeAmong; при равных оценках выбирается первый в прямом порядке
+int TreeLayout::evaluateCandidates(const Node* cmpTree, MatchPolicy policy, uint64_t& bestPosition)
+{
+	this->skippedCandidates = 0;
+	uint32_t rootLabel;
+	if (!this->isOpen() || !this->findLabel(cmpTree->getLabel(), rootLabel))
+		return -1;
+
+	auto levels = this->describePattern(cmpTree);
+	int minDelta = -1;
+	vector<uint64_t> positions;
+	for (uint64_t first = 0; this->readPostings(rootLabel, first, positions); first += positions.size()) {
+		for (uint64_t position : positions) {
+			SearchStats::count(StatsCounter::CandidatesEvaluated);
+			unique_ptr<Node> candidate;
+			LoadResult result = this->loadCandidate(position, levels, candidate);
+			if (result == LoadResult::OverBudget)
+				this->skippedCandidates++;
+			if (result != LoadResult::Loaded)
+				continue;
+
+			PhaseTimer timer(StatsPhase::PatchBuilding);
+			int curDelta = candidate->evaluatePatchWrap(cmpTree, policy);
+			if (curDelta != -1 && (minDelta == -1 || curDelta < minDelta)) {
+				minDelta = curDelta;
+				bestPosition = position;
+			}
+		}
+	}
+	return minDelta;
+}
@@ -0,0 +1,314 @@
+﻿#include "treeSnapshot.h"
+
+using namespace std;
+
+/**
+ * Пустой снимок
+ */
+template <class Label>
+BasicTreeSnapshot<Label>::BasicTreeSnapshot()
+{
+}
+
+/**
+ * Снять снимок с дерева. Узлы снимка создаются один раз, после чего разделяются всеми копиями снимка.
+ * Дерево обходится без рекурсии, чтобы не переполнять стек на глубоких деревьях
+ * \param[in] tree Главное дерево (nullptr - пустой снимок)
+ */
+template <class Label>
+BasicTreeSnapshot<Label>::BasicTreeSnapshot(const TreeNode* tree)
+{
+	if (tree == nullptr)
+		return;
+
+	unsigned long long revision = nextRevision();
+	auto root = make_shared<SnapshotNode>(SnapshotNode{ tree->label, {}, revision });
+	vector<pair<const TreeNode*, SnapshotNode*>> families{ { tree, root.get() } };
+	while (!families.empty()) {
+		auto family = families.back();
+		families.pop_back();
+
+		family.second->children.reserve(family.first->getChildrenCount());
+		for (auto child : family.first->getChildrenView()) {
+			auto childCopy = make_shared<SnapshotNode>(SnapshotNode{ child->label, {}, revision });
+			families.emplace_back(child, childCopy.get());
+			family.second->children.push_back(move(childCopy));
+		}
+	}
+	this->root = move(root);
+}
+
+/**
+ * Снимок из одного листа
+ * \param[in] label Метка листа
+ */
+template <class Label>
+BasicTreeSnapshot<Label>::BasicTreeSnapshot(const Label& label)
+	: root(make_shared<SnapshotNode>(SnapshotNode{ label, {}, nextRevision() }))
+{
+}
+
+/**
+ * Создать копию снимка. Копия разделяет все узлы с исходным снимком, поэтому создаётся за O(1);
+ * дальнейшие изменения копии и исходного снимка друг друга не затрагивают
+ * \param[in] this Копируемый снимок
+ * \return Копия снимка
+ */
+template <class Label>
+BasicTreeSnapshot<Label> BasicTreeSnapshot<Label>::copy() const
+{
+	return *this;
+}
+
+/**
+ * Снимок поддерева узла. Поддерево не копируется, а разделяется с этим снимком
+ * \param[in] this Снимок
+ * \param[in] position Позиция корня поддерева
+ * \return Снимок поддерева или пустой снимок, если позиции нет в снимке
+ */
+template <class Label>
+BasicTreeSnapshot<Label> BasicTreeSnapshot<Label>::subtree(const Position& position) const
+{
+	BasicTreeSnapshot<Label> result;
+	const SnapshotNode* node = this->getNode(position);
+	if (node == nullptr)
+		return result;
+
+	// Ссылка на узел берётся у его родителя, чтобы поддерево осталось общим
+	const SnapshotNode* parent = this->getParent(position);
+	result.root = parent == nullptr ? this->root : parent->children[position.back()];
+	return result;
+}
+
+/**
+ * Узнать, пуст ли снимок
+ * \param[in] this Снимок
+ * \return Логический флаг, пуст ли снимок
+ */
+template <class Label>
+bool BasicTreeSnapshot<Label>::empty() const
+{
+	return this->root == nullptr;
+}
+
+/**
+ * Корень снимка
+ * \param[in] this Снимок
+ * \return Корень или nullptr, если снимок пуст
+ */
+template <class Label>
+const BasicSnapshotNode<Label>* BasicTreeSnapshot<Label>::getRoot() const
+{
+	return this->root.get();
+}
+
+/**
+ * Найти узел снимка по позиции
+ * \param[in] this Снимок
+ * \param[in] position Позиция узла
+ * \return Узел или nullptr, если позиции нет в снимке
+ */
+template <class Label>
+const BasicSnapshotNode<Label>* BasicTreeSnapshot<Label>::getNode(const Position& position) const
+{
+	const SnapshotNode* node = this->root.get();
+	for (unsigned index : position) {
+		if (node == nullptr || index >= node->children.size())
+			return nullptr;
+		node = node->children[index].get();
+	}
+	return node;
+}
+
+/**
+ * Родитель узла в этом снимке. Общий узел может стоять в других снимках под другими родителями,
+ * поэтому родитель определяется позицией, а не хранится в узле
+ * \param[in] this Снимок
+ * \param[in] position Позиция узла
+ * \return Родитель или nullptr, если узел - корень или позиции нет в снимке
+ */
+template <class Label>
+const BasicSnapshotNode<Label>* BasicTreeSnapshot<Label>::getParent(const Position& position) const
+{
+	if (position.empty() || this->getNode(position) == nullptr)
+		return nullptr;
+	return this->getNode(Position(position.begin(), position.end() - 1));
+}
+
+/**
+ * Узнать, содержится ли узел в поддереве другого узла этого снимка (включая сам узел)
+ * \param[in] this Снимок
+ * \param[in] ancestor Позиция корня поддерева
+ * \param[in] position Позиция проверяемого узла
+ * \return Логический флаг, содержится ли узел в поддереве
+ */
+template <class Label>
+bool BasicTreeSnapshot<Label>::contains(const Position& ancestor, const Position& position) const
+{
+	if (ancestor.size() > position.size() || this->getNode(position) == nullptr)
+		return false;
+	return equal(ancestor.begin(), ancestor.end(), position.begin());
+}
+
+/**
+ * Номер последнего изменения поддерева узла. Меняется при любом изменении поддерева в этом снимке
+ * и не меняется при изменении других снимков
+ * \param[in] this Снимок
+ * \param[in] position Позиция узла (по умолчанию - корень)
+ * \return Номер изменения или 0, если позиции нет в снимке
+ */
+template <class Label>
+unsigned long long BasicTreeSnapshot<Label>::getRevision(const Position& position) const
+{
+	const SnapshotNode* node = this->getNode(position);
+	return node == nullptr ? 0 : node->revision;
+}
+
+/**
+ * Добавить лист с заданной меткой к узлу снимка
+ * \param[in,out] this Снимок
+ * \param[in] parent Позиция родителя
+ * \param[in] newChildLabel Метка нового ребёнка
+ * \return Логический флаг, добавлен ли ребёнок (false, если позиции нет в снимке)
+ */
+template <class Label>
+bool BasicTreeSnapshot<Label>::addChild(const Position& parent, const Label& newChildLabel)
+{
+	return this->addChild(parent, BasicTreeSnapshot<Label>(newChildLabel));
+}
+
+/**
+ * Добавить поддерево к узлу снимка. Поддерево не копируется, а становится общим с добавляемым снимком
+ * \param[in,out] this Снимок
+ * \param[in] parent Позиция родителя
+ * \param[in] newChild Снимок добавляемого поддерева
+ * \return Логический флаг, добавлено ли поддерево (false, если позиции нет в снимке или поддерево пусто)
+ */
+template <class Label>
+bool BasicTreeSnapshot<Label>::addChild(const Position& parent, const BasicTreeSnapshot& newChild)
+{
+	if (newChild.empty())
+		return false;
+	shared_ptr<const SnapshotNode> addedChild = newChild.root;
+	return this->copyPath(parent, [&addedChild](SnapshotNode& node) {
+		node.children.push_back(move(addedChild));
+		return true;
+	});
+}
+
+/**
+ * Удалить узел снимка вместе с поддеревом
+ * \param[in,out] this Снимок
+ * \param[in] child Позиция удаляемого узла
+ * \return Логический флаг, удалён ли узел (false для корня и для позиции, которой нет в снимке)
+ */
+template <class Label>
+bool BasicTreeSnapshot<Label>::removeChild(const Position& child)
+{
+	if (child.empty())
+		return false;
+	unsigned removedIndex = child.back();
+	return this->copyPath(Position(child.begin(), child.end() - 1), [removedIndex](SnapshotNode& node) {
+		if (removedIndex >= node.children.size())
+			return false;
+		node.children.erase(node.children.begin() + removedIndex);
+		return true;
+	});
+}
+
+/**
+ * Вставка в снимок одного поддерева вместо другого. Как и у дерева, новое поддерево становится
+ * последним ребёнком родителя удаляемого узла
+ * \param[in,out] this Снимок
+ * \param[in] removingChild Позиция удаляемого узла
+ * \param[in] insertingTree Снимок вставляемого поддерева
+ * \return Логический флаг, выполнена ли вставка (false для корня, для позиции, которой нет в снимке, и для пустого поддерева)
+ */
+template <class Label>
+bool BasicTreeSnapshot<Label>::insertDescendant(const Position& removingChild, const BasicTreeSnapshot& insertingTree)
+{
+	if (removingChild.empty() || insertingTree.empty())
+		return false;
+	unsigned removedIndex = removingChild.back();
+	shared_ptr<const SnapshotNode> insertedChild = insertingTree.root;
+	return this->copyPath(Position(removingChild.begin(), removingChild.end() - 1), [removedIndex, &insertedChild](SnapshotNode& node) {
+		if (removedIndex >= node.children.size())
+			return false;
+		node.children.erase(node.children.begin() + removedIndex);
+		node.children.push_back(move(insertedChild));
+		return true;
+	});
+}
+
+/**
+ * Построить по снимку обычное дерево, например, для поиска в нём
+ * \param[in] this Снимок
+ * \return Дерево или nullptr, если снимок пуст
+ */
+template <class Label>
+unique_ptr<BasicNode<Label>> BasicTreeSnapshot<Label>::toTree() const
+{
+	if (this->root == nullptr)
+		return nullptr;
+
+	auto tree = make_unique<TreeNode>(this->root->label);
+	vector<pair<const SnapshotNode*, TreeNode*>> families{ { this->root.get(), tree.get() } };
+	vector<unique_ptr<TreeNode>> children;
+	while (!families.empty()) {
+		auto family = families.back();
+		families.pop_back();
+
+		// Дети добавляются разом, чтобы индекс детей по именам строился один раз
+		for (const auto& child : family.first->children)
+			children.push_back(make_unique<TreeNode>(child->label));
+		family.second->addChildren(children);
+		children.clear();
+		for (size_t i = 0; i < family.first->children.size(); i++)
+			families.emplace_back(family.first->children[i].get(), family.second->getChild(i));
+	}
+	return tree;
+}
+
+/**
+ * Изменить узел снимка, скопировав путь от корня до него. Копируются только узлы пути
+ * (их списки детей ссылаются на те же поддеревья), и все они получают новый номер изменения;
+ * остальные узлы остаются общими с другими снимками
+ * \param[in,out] this Снимок
+ * \param[in] position Позиция изменяемого узла
+ * \param[in] edit Изменение копии узла; возвращает false, если изменение невозможно
+ * \return Логический флаг, изменён ли снимок
+ */
+template <class Label>
+template <class Edit>
+bool BasicTreeSnapshot<Label>::copyPath(const Position& position, Edit edit)
+{
+	if (this->root == nullptr)
+		return false;
+
+	vector<const SnapshotNode*> path{ this->root.get() };
+	for (unsigned index : position) {
+		if (index >= path.back()->children.size())
+			return false;
+		path.push_back(path.back()->children[index].get());
+	}
+
+	auto nodeCopy = make_shared<SnapshotNode>(*path.back());
+	if (!edit(*nodeCopy))
+		return false;
+
+	unsigned long long revision = nextRevision();
+	nodeCopy->revision = revision;
+	shared_ptr<const SnapshotNode> pathCopy = move(nodeCopy);
+	for (size_t depth = position.size(); depth > 0; depth--) {
+		auto parentCopy = make_shared<SnapshotNode>(*path[depth - 1]);
+		parentCopy->children[position[depth - 1]] = move(pathCopy);
+		parentCopy->revision = revision;
+		pathCopy = move(parentCopy);
+	}
+	this->root = move(pathCopy);
+	return true;
+}
+
+template class BasicTreeSnapshot<TextLabel>;
+template class BasicTreeSnapshot<uint32_t>;
+template class BasicTreeSnapshot<InternedLabel>;
@@ -0,0 +1,112 @@
+﻿#include "treeStream.h"
+#include "searchStats.h"
+
+using namespace std;
+
+/**
+ * Создать читателя последовательности деревьев
+ * \param[in] in Поток с деревьями в виде s-выражений, записанных одно за другим
+ * \param[in] delimiters Разделители
+ */
+TreeStreamReader::TreeStreamReader(istream& in, const string& delimiters)
+	: in(in), delimiters(delimiters)
+{
+	this->pendingChar = EOF;
+	this->finished = false;
+	this->treesRead = 0;
+}
+
+/**
+ * Прочитать и разобрать следующее дерево потока. Дерево заканчивается закрывающей скобкой корня
+ * или, если у корня нет детей, началом следующего дерева.
+ * Если дерево разобрать не удалось, исключение разборщика пробрасывается, но его текст уже прочитан,
+ * поэтому чтение можно продолжить со следующего дерева
+ * \return Дерево или nullptr, если поток закончился
+ */
+unique_ptr<Node> TreeStreamReader::next()
+{
+	auto text = make_shared<string>();
+	{
+		PhaseTimer timer(StatsPhase::FileRead);
+		int depth = 0;
+		bool inWord = false;
+		bool rootClosed = false;
+		bool complete = false;
+		while (!complete) {
+			int symbol = this->readChar();
+			if (symbol == EOF)
+				break;
+
+			if (symbol == '(') {
+				depth++;
+				inWord = false;
+				rootClosed = false;
+				text->push_back((char)symbol);
+			}
+			else if (symbol == ')') {
+				depth--;
+				inWord = false;
+				text->push_back((char)symbol);
+				complete = depth <= 0;
+			}
+			else if (this->isDelimiter(symbol)) {
+				// Разделители до начала дерева пропускаются
+				if (text->empty())
+					continue;
+				if (inWord && depth == 0)
+					rootClosed = true;
+				inWord = false;
+				text->push_back((char)symbol);
+			}
+			else if (rootClosed) {
+				// Лист-корень закончился: символ начинает следующее дерево
+				this->pendingChar = symbol;
+				complete = true;
+			}
+			else {
+				inWord = true;
+				text->push_back((char)symbol);
+			}
+		}
+	}
+
+	if (text->empty()) {
+		this->finished = true;
+		return nullptr;
+	}
+	this->treesRead++;
+	return parseOnTree(shared_ptr<const string>(move(text)), this->delimiters);
+}
+
+/**
+ * Узнать, прочитан ли поток до конца
+ * \return Логический флаг, что деревьев больше нет
+ */
+bool TreeStreamReader::isFinished() const
+{
+	return this->finished;
+}
+
+/**
+ * Количество прочитанных деревьев, включая те, которые не удалось разобрать
+ * \return Количество деревьев
+ */
+size_t TreeStreamReader::getTreesRead() const
+{
+	return this->treesRead;
+}
+
+int TreeStreamReader::readChar()
+{
+	if (this->pendingChar != EOF) {
+		int symbol = this->pendingChar;
+		this->pendingChar = EOF;
+		return symbol;
+	}
+	return this->in.rdbuf()->sbumpc();
+}
+
+bool TreeStreamReader::isDelimiter(int symbol) const
+{
+	return symbol != '(' && symbol != ')' && this->delimiters.find((char)symbol) != string::npos;
+}
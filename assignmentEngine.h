@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <limits>
+using namespace std;
+
+
+// Разреженная задача о назначениях: каждой строке назначается свой столбец так,
+// чтобы суммарная стоимость выбранных рёбер была минимальной
+class SparseAssignment {
+public:
+	SparseAssignment(int rowsCount, int colsCount);
+	void addEdge(int row, int col, long long cost);
+	bool solve();
+	int getColumn(int row) const;
+	long long getCost() const;
+private:
+	struct Edge
+	{
+		int col;
+		long long cost;
+	};
+	bool augment(int startRow);
+	int rowsCount;
+	int colsCount;
+	vector<vector<Edge>> edges;
+	vector<long long> rowPotentials;
+	vector<long long> colPotentials;
+	vector<int> colOfRow;
+	vector<int> rowOfCol;
+	vector<long long> colDistances;
+	vector<int> prevRow;
+	vector<bool> finished;
+	long long totalCost;
+};
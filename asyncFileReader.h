@@ -0,0 +1,50 @@
+#pragma once
+#include "findSubTree.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+
+// Чтение файла с деревом в отдельном потоке. Чтение начинается при создании объекта, поэтому несколько файлов
+// читаются одновременно, а следующий файл можно начать читать, пока ищется поддерево в текущем.
+// Текст пишется в буфер размером с файл, который не перевыделяется, пока файл не изменился при чтении:
+// уже прочитанную часть можно разбирать, не дожидаясь конца файла, и ссылки на неё остаются верными.
+// Как и прежнее построчное чтение, текст складывается из строк файла без символов перевода строки
+class AsyncFileReader {
+public:
+	explicit AsyncFileReader(const string& path, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+	~AsyncFileReader();
+	AsyncFileReader(const AsyncFileReader&) = delete;
+	AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+	const string& getPath() const;
+	size_t waitForText(size_t length);
+	bool isEmpty();
+	string_view getText(size_t length) const;
+	bool wait();
+	shared_ptr<const string> getContent();
+
+	static const size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+private:
+	void run();
+
+	string path;
+	size_t chunkSize;
+	// Буфер текста: его начало длиной published уже прочитано и доступно без блокировки
+	shared_ptr<string> text;
+	char* buffer;
+	size_t capacity;
+	// Текст, не поместившийся в буфер, если файл вырос после определения его размера
+	string overflow;
+	mutex lock;
+	condition_variable changed;
+	size_t published;
+	// Длина всего прочитанного текста вместе с не поместившимся в буфер
+	size_t received;
+	bool finished;
+	bool opened;
+	atomic<bool> cancelled;
+	thread worker;
+};
+
+unique_ptr<Node> parseOnTree(AsyncFileReader& file, const string& delimiters);
@@ -0,0 +1,26 @@
+#pragma once
+#include "findSubTree.h"
+#include "patchArena.h"
+
+
+// Копия главного дерева, уложенная в памяти для оценки кандидатов.
+// Дети каждого узла лежат подряд, семейства - в порядке обхода в глубину, а текстовые метки скопированы
+// в общий буфер в том же порядке, поэтому перебор детей и сравнение их меток читают память последовательно.
+// Узлы принадлежат арене дерева; дерево доступно только для чтения
+template <class Label>
+class BasicCompactTree {
+public:
+	using TreeNode = BasicNode<Label>;
+
+	explicit BasicCompactTree(const TreeNode* tree);
+	~BasicCompactTree();
+	BasicCompactTree(const BasicCompactTree&) = delete;
+	BasicCompactTree& operator=(const BasicCompactTree&) = delete;
+	const TreeNode* getRoot() const;
+	size_t getCapacity() const;
+private:
+	PatchArena arena;
+	unique_ptr<TreeNode> root;
+};
+
+using CompactTree = BasicCompactTree<TextLabel>;
@@ -3,17 +3,23 @@
 #include <sstream>
 #include <fstream>
 #include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <stack>
 #include <locale.h>
 #include <list>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <optional>
 #include <filesystem>
 #include <cstdlib>
+#include <cstdint>
+#include <climits>
 using namespace std;
 
 
@@ -26,54 +32,301 @@ enum NODE_TYPES {
 	LEAFS, NODES, LEAF_NODE, NODE_LEAF, NILL
 };
 
-class PatchNode;
+// Способ сопоставления детей узла главного дерева с детьми узла искомого дерева
+enum class MatchPolicy
+{
+	Unordered, OrderedSubsequence, OrderedExact
+};
+
+// Метка узла, имя которой хранится в общем буфере (во входном тексте дерева или в собственной копии имени)
+struct TextLabel
+{
+	string_view text;
+	shared_ptr<const string> buffer;
+};
+
+// Метка узла из пула интернированных строк: одинаковые имена имеют один и тот же адрес,
+// поэтому сравнение меток сводится к сравнению указателей
+class InternedLabel
+{
+public:
+	InternedLabel();
+	explicit InternedLabel(string_view text);
+	const string& str() const;
+	bool operator==(const InternedLabel& other) const;
+	bool operator!=(const InternedLabel& other) const;
+	bool operator<(const InternedLabel& other) const;
+private:
+	const string* text;
+};
+
+// Операции над метками узлов, необходимые дереву и поиску.
+// View - лёгкое представление метки, которым сравниваются узлы; own - метка, не зависящая от чужого буфера
+template <class Label>
+struct LabelTraits;
+
+template <>
+struct LabelTraits<TextLabel>
+{
+	using View = string_view;
+	static View view(const TextLabel& label);
+	static TextLabel make(const string& name);
+	static TextLabel own(string_view label);
+	static string toString(const TextLabel& label);
+	static size_t hash(string_view label);
+};
+
+template <>
+struct LabelTraits<uint32_t>
+{
+	using View = uint32_t;
+	static View view(uint32_t label);
+	static uint32_t make(const string& name);
+	static uint32_t own(uint32_t label);
+	static string toString(uint32_t label);
+	static size_t hash(uint32_t label);
+};
+
+template <>
+struct LabelTraits<InternedLabel>
+{
+	using View = InternedLabel;
+	static View view(const InternedLabel& label);
+	static InternedLabel make(const string& name);
+	static InternedLabel own(const InternedLabel& label);
+	static string toString(const InternedLabel& label);
+	static size_t hash(const InternedLabel& label);
+};
 
-class Node {
+// Невладеющее представление массива unique_ptr (аналог span), выдающее обычные указатели на элементы.
+// Ничего не копирует и действительно, пока не изменён сам массив
+template <class T>
+class PointerView
+{
+public:
+	class iterator
+	{
+	public:
+		using iterator_category = forward_iterator_tag;
+		using value_type = T*;
+		using difference_type = ptrdiff_t;
+		using pointer = T* const*;
+		using reference = T*;
+
+		explicit iterator(const unique_ptr<T>* current) : current(current) {}
+		T* operator*() const { return current->get(); }
+		iterator& operator++() { ++current; return *this; }
+		bool operator==(const iterator& other) const { return current == other.current; }
+		bool operator!=(const iterator& other) const { return current != other.current; }
+	private:
+		const unique_ptr<T>* current;
+	};
+
+	PointerView(const unique_ptr<T>* first, size_t count) : first(first), count(count) {}
+	iterator begin() const { return iterator(first); }
+	iterator end() const { return iterator(first + count); }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T* operator[](size_t index) const { return first[index].get(); }
+private:
+	const unique_ptr<T>* first;
+	size_t count;
+};
+
+template <class Label>
+class BasicPatchNode;
+
+template <class Label>
+class BasicWeightMemo;
+template <class Label>
+class BasicCompactTree;
+template <class Label>
+class BasicTreeSnapshot;
+
+template <class Label>
+class BasicNode {
 public:
-	explicit Node(const string& data);
+	using LabelView = typename LabelTraits<Label>::View;
+
+	explicit BasicNode(const string& data);
+	explicit BasicNode(const Label& label);
+	// Память узлов учитывается статистикой поиска
+	static void* operator new(size_t size);
+	static void operator delete(void* pointer, size_t size);
 	bool isNode() const;
-	bool isChild(const Node* probablyChild) const;
+	bool isChild(const BasicNode* probablyChild) const;
 	bool isLeaf() const;
-	unique_ptr<Node> copy() const;
-	Node* addChild(const string& newChildName);
-	Node* addChild(unique_ptr<Node> newChild);
-	void removeChild(const Node* nodeToDelete);
+	unique_ptr<BasicNode> copy() const;
+	unique_ptr<BasicNode> copyNode() const;
+	BasicNode* addChild(const string& newChildName);
+	BasicNode* addChild(const Label& newChildLabel);
+	BasicNode* addChild(unique_ptr<BasicNode> newChild);
+	void addChildren(vector<unique_ptr<BasicNode>>& newChildren, size_t first = 0);
+	void removeChild(const BasicNode* nodeToDelete);
 	int descendantsCount() const;
 	string getName() const;
+	LabelView getLabel() const;
 	void print(int level = 0) const;
-	vector<const Node*> findDescendants(const string& searchedNodeName) const;
-	Node* insertDescendant(const Node* removingChild, unique_ptr<Node>& insertingNode);
-	vector<Node*> getChildren() const;
-	unique_ptr<Node> buildPedigree(const Node* child, Node** deepestChild) const;
-	int findSubTree(const Node* cmpTree, unique_ptr<Node>& deltaTree) const;
-	unique_ptr<PatchNode> buildPatchWrap(Node* cmpTree) const;
-	int buildPatch(const Node* cmpTree, PatchNode* patch) const;
-	int buildDeltaTreeWrap(const Node* cmpTree, unique_ptr<Node>& deltaTree) const;
+	vector<const BasicNode*> findDescendants(LabelView searchedNodeName) const;
+	BasicNode* insertDescendant(const BasicNode* removingChild, unique_ptr<BasicNode>& insertingNode);
+	vector<BasicNode*> getChildren() const;
+	PointerView<BasicNode> getChildrenView() const;
+	BasicNode* getChild(size_t index) const;
+	size_t getChildrenCount() const;
+	pair<vector<unsigned>::const_iterator, vector<unsigned>::const_iterator> findChildrenNamed(LabelView childName) const;
+	unique_ptr<BasicNode> buildPedigree(const BasicNode* child, BasicNode** deepestChild) const;
+	BasicNode* getParent() const;
+	vector<const BasicNode*> pathFromRoot() const;
+	void numberIntervals() const;
+	bool contains(const BasicNode* node) const;
+	unsigned long long getRevision() const;
+	int findSubTree(const BasicNode* cmpTree, unique_ptr<BasicNode>& deltaTree, MatchPolicy policy = MatchPolicy::Unordered) const;
+	int findSubTreeAmong(const vector<const BasicNode*>& probableCmpTrees, const BasicNode* cmpTree, unique_ptr<BasicNode>& deltaTree, MatchPolicy policy = MatchPolicy::Unordered) const;
+	int countMissingNodes(const BasicNode* cmpTree, MatchPolicy policy = MatchPolicy::Unordered) const;
+	int evaluatePatchWrap(const BasicNode* cmpTree, MatchPolicy policy = MatchPolicy::Unordered, BasicWeightMemo<Label>* memo = nullptr) const;
+	unique_ptr<BasicPatchNode<Label>> buildPatchWrap(const BasicNode* cmpTree, MatchPolicy policy = MatchPolicy::Unordered) const;
+	template <MatchPolicy policy>
+	int buildPatch(const BasicNode* cmpTree, BasicPatchNode<Label>* patch) const;
+	int buildDeltaTreeWrap(const BasicNode* cmpTree, unique_ptr<BasicNode>& deltaTree, MatchPolicy policy = MatchPolicy::Unordered) const;
 private:
-	string name;
-	vector<unique_ptr<Node>> children;
+	template <MatchPolicy policy>
+	int connectionWeight(const BasicNode* cmpChild, unique_ptr<BasicPatchNode<Label>>& pairPatch) const;
+	template <MatchPolicy policy>
+	int evaluateConnection(const BasicNode* cmpChild, BasicWeightMemo<Label>* memo) const;
+	template <MatchPolicy policy>
+	int evaluatePatch(const BasicNode* cmpTree, BasicWeightMemo<Label>* memo) const;
+	void touch();
+	void indexChildren();
+	friend class BasicCompactTree<Label>;
+	friend class BasicTreeSnapshot<Label>;
+
+	// Метка узла (для текстовых меток - имя, указывающее в буфер, который узел держит живым)
+	Label label;
+	vector<unique_ptr<BasicNode>> children;
+	BasicNode* parent;
+	// Номера детей, упорядоченные по имени (одноимённые - в порядке следования); поддерживается при изменении детей,
+	// поэтому поиск по нему не изменяет дерево
+	vector<unsigned> childrenByName;
+	// Интервал узла в прямом и обратном обходе и номер нумерации, в которой он получен (0 - узел не пронумерован)
+	mutable unsigned preorderIndex;
+	mutable unsigned postorderIndex;
+	mutable unsigned long long numbering;
+	// Номер последнего изменения поддерева узла (уникален среди всех деревьев)
+	unsigned long long revision;
 };
 
+// Дерево с текстовыми метками, которое строит разборщик
+using Node = BasicNode<TextLabel>;
+// Дерево с числовыми идентификаторами типов вместо имён
+using IdNode = BasicNode<uint32_t>;
+// Дерево с интернированными строковыми метками
+using InternedNode = BasicNode<InternedLabel>;
+
 unique_ptr<Node> parseOnTree(const string& content, const string& delimiters, int startIndex = 0);
+unique_ptr<Node> parseOnTree(shared_ptr<const string> content, const string& delimiters, int startIndex = 0);
+template <class Label>
+unique_ptr<BasicNode<Label>> convertTree(const Node* tree);
+bool parseMatchPolicy(const string& note, MatchPolicy& policy);
+// Номер изменения, общий для узлов деревьев и снимков, поэтому номера не повторяются между ними
+unsigned long long nextRevision();
+
+// Соединение patch-узла с узлом сравниваемого дерева
+template <class Label>
+struct BasicPatchConnection
+{
+	const BasicNode<Label>* target;
+	int weight;
+	// Patch-дерево для пары соединённых узлов (nullptr, если один из узлов - лист)
+	unique_ptr<BasicPatchNode<Label>> patch;
+	// Номер целевого узла среди детей его родителя (-1, если не известен)
+	int targetIndex;
+};
 
-class PatchNode {
+template <class Label>
+class BasicPatchNode {
 public:
-	PatchNode();
-	explicit PatchNode(const Node* rootSubTree);
-	explicit PatchNode(Node* rootSubTree);
-	PatchNode* addChild(unique_ptr<PatchNode> newChild);
-	void addConnection(int weight, Node* searchedSubTree);
-	vector<pair<Node*, int>> getConnections() const;
-	int deleteAllChildReferences(const Node* selectedNode) const;
-	vector<Node*> findUncaughtChildren(const Node* treeNode) const;
-	Node* getRoot() const;
-	vector<PatchNode*> getChildren() const;
-	vector<pair<Node*, int>>::const_iterator findConnection(const Node* searchedNode) const;
+	using TreeNode = BasicNode<Label>;
+	using Connection = BasicPatchConnection<Label>;
+
+	// Невладеющее представление действующих (не удалённых при назначении) соединений patch-узла
+	class ConnectionsView
+	{
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = forward_iterator_tag;
+			using value_type = Connection;
+			using difference_type = ptrdiff_t;
+			using pointer = const Connection*;
+			using reference = const Connection&;
+
+			iterator(const BasicPatchNode* owner, const Connection* current, const Connection* last)
+				: owner(owner), current(current), last(last) { skipRemoved(); }
+			const Connection& operator*() const { return *current; }
+			const Connection* operator->() const { return current; }
+			iterator& operator++() { ++current; skipRemoved(); return *this; }
+			bool operator==(const iterator& other) const { return current == other.current; }
+			bool operator!=(const iterator& other) const { return current != other.current; }
+		private:
+			void skipRemoved() { while (current != last && owner->isRemoved(*current)) ++current; }
+			const BasicPatchNode* owner;
+			const Connection* current;
+			const Connection* last;
+		};
+
+		explicit ConnectionsView(const BasicPatchNode* owner) : owner(owner) {}
+		iterator begin() const { return iterator(owner, owner->connections.data(), owner->connections.data() + owner->connections.size()); }
+		iterator end() const { auto last = owner->connections.data() + owner->connections.size(); return iterator(owner, last, last); }
+		bool empty() const { return begin() == end(); }
+		size_t size() const { return (size_t)distance(begin(), end()); }
+		const Connection& front() const { return *begin(); }
+	private:
+		const BasicPatchNode* owner;
+	};
+
+	BasicPatchNode();
+	explicit BasicPatchNode(const TreeNode* rootSubTree);
+	explicit BasicPatchNode(TreeNode* rootSubTree);
+	// Пока действует арена (PatchArena::Scope), patch-узлы и их списки размещаются в ней,
+	// иначе - в общей куче с учётом статистикой поиска
+	static void* operator new(size_t size);
+	static void operator delete(void* pointer, size_t size);
+	void reserveChildren(size_t childrenCount);
+	void reserveConnections(size_t connectionsCount);
+	BasicPatchNode* addChild(unique_ptr<BasicPatchNode> newChild);
+	void addConnection(int weight, const TreeNode* searchedSubTree, unique_ptr<BasicPatchNode> connectionPatch = nullptr, int targetIndex = -1);
+	vector<pair<const TreeNode*, int>> getConnections() const;
+	ConnectionsView getConnectionsView() const;
+	int deleteAllChildReferences(const TreeNode* selectedNode, int selectedIndex = -1);
+	vector<TreeNode*> findUncaughtChildren(const TreeNode* treeNode) const;
+	TreeNode* getRoot() const;
+	vector<BasicPatchNode*> getChildren() const;
+	PointerView<BasicPatchNode> getChildrenView() const;
+	typename pmr::vector<Connection>::const_iterator findConnection(const TreeNode* searchedNode) const;
 	int findMinValidConnection(int startIndex = 0) const;
-	int buildDeltaTree(Node* cmpTree) const;
+	void selectConnection(const TreeNode* searchedNode);
+	int findSelectedConnection() const;
+	int buildDeltaTree(const TreeNode* cmpTree, unique_ptr<TreeNode>& deltaTree);
 private:
-	Node* rootSubTree;
-	vector<pair<Node*, int>> connections;
-	vector<unique_ptr<PatchNode>> children;
+	void trackConnection(const Connection& connection);
+	void indexReferences(size_t targetsCount);
+	bool isRemoved(const Connection& connection) const;
+
+	TreeNode* rootSubTree;
+	// Узел, выбранный для этого patch-узла при назначении детей (nullptr - выбирается самое лёгкое соединение)
+	const TreeNode* selectedTarget;
+	pmr::vector<Connection> connections;
+	pmr::vector<unique_ptr<BasicPatchNode>> children;
+	BasicPatchNode* parent;
+	unsigned positionInParent;
+	// Строятся при первом удалении узла из дерева разности, поэтому есть только у обходимых им patch-узлов:
+	// битовое множество удалённых детей сравниваемого узла и количество соединений детей, ссылающихся на каждого из них
+	pmr::vector<uint64_t> removedChildren;
+	pmr::vector<unsigned> referenceCounts;
+	// Количество соединений детей, для которых не известен номер целевого узла
+	int untrackedConnections;
 };
 
+using PatchNode = BasicPatchNode<TextLabel>;
+using PatchConnection = BasicPatchConnection<TextLabel>;
@@ -0,0 +1,65 @@
+#pragma once
+#include <stddef.h>
+
+// Интерфейс библиотеки поиска поддеревьев для языка C.
+// Деревья разбираются из буферов в памяти и живут до явного освобождения, поэтому одно главное дерево
+// можно использовать для многих запросов. Все объекты непрозрачны; функции не бросают исключений
+// и сообщают об ошибках кодом fst_status (непредвиденные исключения библиотеки - FST_ERROR_INTERNAL)
+//
+// Потокобезопасность: функции, принимающие объекты только для чтения (const), можно вызывать из разных потоков
+// одновременно, в том числе над одними и теми же деревьями и индексом: поиск не изменяет их. Разбор и освобождение
+// деревьев и результатов в разных потоках независимы. Объект, передаваемый для изменения (fst_index_add_tree)
+// или освобождения, не должен одновременно использоваться другими потоками; синхронизацию таких вызовов
+// обеспечивает вызывающий
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FST_API_VERSION 1
+
+typedef struct fst_tree fst_tree;
+typedef struct fst_node fst_node;
+typedef struct fst_result fst_result;
+typedef struct fst_index fst_index;
+
+typedef enum fst_status {
+	FST_OK = 0,
+	FST_ERROR_ARGUMENT = -1,
+	FST_ERROR_PARSE = -2,
+	FST_ERROR_MEMORY = -3,
+	FST_ERROR_INTERNAL = -4
+} fst_status;
+
+typedef enum fst_policy {
+	FST_UNORDERED = 0,
+	FST_SUBSEQUENCE = 1,
+	FST_EXACT = 2
+} fst_policy;
+
+int fst_api_version(void);
+const char* fst_status_message(fst_status status);
+
+fst_status fst_parse_tree(const char* text, size_t length, const char* delimiters, fst_tree** tree);
+void fst_free_tree(fst_tree* tree);
+size_t fst_tree_size(const fst_tree* tree);
+const fst_node* fst_tree_root(const fst_tree* tree);
+
+const char* fst_node_label(const fst_node* node, size_t* length);
+size_t fst_node_children_count(const fst_node* node);
+const fst_node* fst_node_child(const fst_node* node, size_t index);
+
+fst_status fst_find_subtree(const fst_tree* main_tree, const fst_tree* searched_tree, fst_policy policy, fst_result** result);
+fst_status fst_count_missing_nodes(const fst_tree* main_tree, const fst_tree* searched_tree, fst_policy policy, int* delta);
+int fst_result_delta(const fst_result* result);
+const fst_node* fst_result_delta_tree(const fst_result* result);
+void fst_free_result(fst_result* result);
+
+fst_status fst_index_create(int p, int q, fst_index** index);
+void fst_free_index(fst_index* index);
+fst_status fst_index_add_tree(fst_index* index, const fst_tree* tree, size_t* tree_index);
+fst_status fst_index_search(const fst_index* index, const fst_tree* searched_tree, fst_policy policy, size_t max_trees, fst_result** result, size_t* tree_index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include "findSubTree.h"
+#include "multiPatternSearch.h"
+#include <iterator>
+
+
+// Перебор вхождений искомого дерева по мере их нахождения.
+// Главное дерево обходится в прямом порядке без предварительного сбора кандидатов: каждый следующий кандидат
+// оценивается только при запросе, поэтому перебор можно прекратить на первом подходящем вхождении.
+// Дерево разности строится лишь для вхождений, которые запросил вызывающий
+template <class Label>
+class BasicMatchEnumerator {
+public:
+	using TreeNode = BasicNode<Label>;
+	using Match = BasicPatternMatch<Label>;
+
+	// Входной итератор по вхождениям; продвижение итератора оценивает следующих кандидатов
+	class iterator {
+	public:
+		using iterator_category = input_iterator_tag;
+		using value_type = Match;
+		using difference_type = ptrdiff_t;
+		using pointer = const Match*;
+		using reference = const Match&;
+
+		iterator() : enumerator(nullptr), match{ -1, nullptr } {}
+		explicit iterator(BasicMatchEnumerator* enumerator) : enumerator(enumerator), match{ -1, nullptr } { ++*this; }
+		reference operator*() const { return this->match; }
+		pointer operator->() const { return &this->match; }
+		iterator& operator++()
+		{
+			if (this->enumerator != nullptr && !this->enumerator->next(this->match))
+				this->enumerator = nullptr;
+			return *this;
+		}
+		bool operator==(const iterator& other) const { return this->enumerator == other.enumerator; }
+		bool operator!=(const iterator& other) const { return this->enumerator != other.enumerator; }
+	private:
+		BasicMatchEnumerator* enumerator;
+		Match match;
+	};
+
+	BasicMatchEnumerator(const TreeNode* mainTree, const TreeNode* cmpTree, MatchPolicy policy = MatchPolicy::Unordered);
+	bool next(Match& match);
+	bool isFinished() const;
+	size_t getCandidatesEvaluated() const;
+	int buildDeltaTree(const Match& match, unique_ptr<TreeNode>& deltaTree) const;
+	iterator begin();
+	iterator end();
+private:
+	const TreeNode* mainTree;
+	const TreeNode* cmpTree;
+	MatchPolicy policy;
+	// Состояние обхода: следующий узел прямого порядка, узлы пути до него и номер следующего ребёнка каждого из них
+	const TreeNode* pendingNode;
+	vector<pair<const TreeNode*, size_t>> path;
+	size_t candidatesEvaluated;
+};
+
+using MatchEnumerator = BasicMatchEnumerator<TextLabel>;
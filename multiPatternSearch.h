@@ -0,0 +1,75 @@
+#pragma once
+#include "findSubTree.h"
+#include "treeDag.h"
+#include <unordered_map>
+
+
+// Веса пар (узел главного дерева, поддерево искомого дерева), общие для нескольких искомых деревьев.
+// Одинаковые поддеревья искомых деревьев получают один класс, поэтому вес пары вычисляется один раз.
+// Запоминаются только классы, встречающиеся в искомых деревьях больше одного раза: остальные веса не переиспользуются
+template <class Label>
+class BasicWeightMemo {
+public:
+	using TreeNode = BasicNode<Label>;
+
+	BasicWeightMemo();
+	unsigned addPattern(const TreeNode* pattern);
+	bool find(const TreeNode* mainNode, const TreeNode* cmpNode, int& weight);
+	void store(const TreeNode* mainNode, const TreeNode* cmpNode, int weight);
+	void clearWeights();
+	size_t getClassesCount() const;
+	size_t size() const;
+	size_t getHits() const;
+private:
+	struct Key
+	{
+		const TreeNode* mainNode;
+		unsigned cmpClass;
+		bool operator==(const Key& other) const;
+	};
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	BasicTreeDag<Label> patterns;
+	unordered_map<const TreeNode*, unsigned> classes;
+	// Количество вхождений каждого класса в искомые деревья и узлы повторяющихся классов
+	vector<unsigned> uses;
+	unordered_map<const TreeNode*, unsigned> sharedClasses;
+	unordered_map<Key, int, KeyHash> weights;
+	size_t hits;
+};
+
+// Лучшее вхождение одного искомого дерева: количество недостающих узлов (-1 - не найдено) и корень кандидата
+template <class Label>
+struct BasicPatternMatch
+{
+	int delta;
+	const BasicNode<Label>* root;
+};
+
+// Поиск множества искомых деревьев за один обход главного дерева.
+// Кандидаты перебираются один раз для всех искомых деревьев, а веса общих поддеревьев искомых деревьев переиспользуются
+template <class Label>
+class BasicMultiPatternSearch {
+public:
+	using TreeNode = BasicNode<Label>;
+	using Match = BasicPatternMatch<Label>;
+
+	explicit BasicMultiPatternSearch(MatchPolicy policy = MatchPolicy::Unordered);
+	size_t addPattern(const TreeNode* pattern);
+	size_t size() const;
+	vector<Match> search(const TreeNode* mainTree);
+	int buildDeltaTree(const TreeNode* mainTree, size_t patternIndex, const Match& match, unique_ptr<TreeNode>& deltaTree) const;
+	const BasicWeightMemo<Label>& getMemo() const;
+private:
+	MatchPolicy policy;
+	// Искомые деревья (принадлежат вызывающему) и классы их корней
+	vector<const TreeNode*> patterns;
+	vector<unsigned> patternClasses;
+	BasicWeightMemo<Label> memo;
+};
+
+using MultiPatternSearch = BasicMultiPatternSearch<TextLabel>;
+using PatternMatch = BasicPatternMatch<TextLabel>;
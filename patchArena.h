@@ -0,0 +1,61 @@
+#pragma once
+#include <memory_resource>
+#include <vector>
+#include <cstddef>
+#include "searchStats.h"
+using namespace std;
+
+
+// Арена для patch-графа: память выделяется последовательно из крупных блоков, освобождение отдельных
+// объектов ничего не делает, а сброс арены делает всю память снова свободной, сохраняя блоки для повторного использования.
+// Та же арена служит для плотной укладки узлов дерева (см. BasicCompactTree)
+class PatchArena : public pmr::memory_resource {
+public:
+	explicit PatchArena(size_t firstChunkSize = 64 * 1024, StatsStructure structure = StatsStructure::PatchNodes);
+	~PatchArena();
+	PatchArena(const PatchArena&) = delete;
+	PatchArena& operator=(const PatchArena&) = delete;
+	void reset();
+	bool owns(const void* pointer) const;
+	size_t getCapacity() const;
+	static PatchArena* current();
+	static PatchArena* currentForNodes();
+
+	// Делает арену текущей: пока объект жив, patch-узлы создаются в ней
+	class Scope {
+	public:
+		explicit Scope(PatchArena& arena);
+		~Scope();
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		PatchArena* previous;
+	};
+
+	// Делает арену текущей для узлов деревьев: пока объект жив, узлы создаются и удаляются в ней
+	class NodeScope {
+	public:
+		explicit NodeScope(PatchArena& arena);
+		~NodeScope();
+		NodeScope(const NodeScope&) = delete;
+		NodeScope& operator=(const NodeScope&) = delete;
+	private:
+		PatchArena* previous;
+	};
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const pmr::memory_resource& other) const noexcept override;
+
+	struct Chunk
+	{
+		char* data;
+		size_t size;
+	};
+	vector<Chunk> chunks;
+	size_t chunkIndex;
+	size_t offset;
+	size_t chunkSize;
+	// Структура, к которой статистика относит блоки арены
+	StatsStructure structure;
+};
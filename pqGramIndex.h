@@ -0,0 +1,50 @@
+#pragma once
+#include "findSubTree.h"
+#include <unordered_map>
+#include <cstdint>
+
+
+// Кандидат, отобранный индексом: главное дерево и корни его поддеревьев, наиболее похожих на образец
+struct PqGramCandidate
+{
+	size_t treeIndex;
+	double score;
+	vector<int> roots;
+};
+
+// Индекс pq-грамм для приближённого поиска поддеревьев по множеству главных деревьев
+class PqGramIndex {
+public:
+	explicit PqGramIndex(int p = 2, int q = 3);
+	size_t addTree(const string& path, const Node* tree);
+	vector<PqGramCandidate> shortlist(const Node* pattern, size_t maxTrees, size_t maxRoots) const;
+	const string& getPath(size_t treeIndex) const;
+	size_t size() const;
+	bool save(const string& path) const;
+	bool load(const string& path);
+private:
+	// Узел главного дерева в прямом порядке обхода
+	struct IndexedNode
+	{
+		uint64_t labelHash;
+		uint32_t gramBegin;
+		uint32_t gramEnd;
+	};
+	// Главное дерево: путь к файлу, его узлы и pq-граммы, упорядоченные по узлам-якорям
+	struct IndexedTree
+	{
+		string path;
+		vector<IndexedNode> nodes;
+		vector<uint64_t> grams;
+	};
+	void collectGrams(const Node* node, vector<uint64_t>& stem, IndexedTree& tree, vector<uint64_t>& labels) const;
+	vector<uint64_t> patternProfile(const Node* pattern) const;
+	void addPostings(uint32_t treeIndex, vector<uint64_t> profile);
+	int p;
+	int q;
+	vector<IndexedTree> trees;
+	unordered_map<uint64_t, vector<pair<uint32_t, uint32_t>>> postings;
+};
+
+uint64_t hashLabel(string_view label);
+vector<const Node*> findPreorderNodes(const Node* tree, const vector<int>& preorderIndices);
@@ -0,0 +1,73 @@
+#pragma once
+#include "findSubTree.h"
+#include <unordered_map>
+#include <list>
+#include <cstdint>
+
+
+// Ограниченный LRU-кэш результатов поиска поддеревьев.
+// Ключ - главное дерево с номером его изменения, способ сопоставления и структурный хеш искомого дерева
+template <class Label>
+class BasicSearchCache {
+public:
+	using TreeNode = BasicNode<Label>;
+
+	explicit BasicSearchCache(size_t capacity);
+	int findSubTree(const TreeNode* mainTree, const TreeNode* cmpTree, unique_ptr<TreeNode>& deltaTree, MatchPolicy policy = MatchPolicy::Unordered);
+	void clear();
+	size_t size() const;
+	size_t getHits() const;
+	size_t getMisses() const;
+	size_t getEvictions() const;
+	size_t getInvalidations() const;
+private:
+	// Узел дерева в прямом порядке обхода: метка и количество детей
+	struct EncodedNode
+	{
+		Label label;
+		unsigned childrenCount;
+	};
+	struct Key
+	{
+		const TreeNode* mainTree;
+		MatchPolicy policy;
+		uint64_t searchedHash;
+		bool operator==(const Key& other) const;
+	};
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+	struct Entry
+	{
+		Key key;
+		vector<EncodedNode> searchedTree;
+		int delta;
+		vector<EncodedNode> deltaTree;
+	};
+	// Номер изменения главного дерева, для которого хранятся результаты, и количество этих результатов
+	struct MainTreeState
+	{
+		unsigned long long revision;
+		size_t entriesCount;
+	};
+
+	static uint64_t hashTree(const TreeNode* tree);
+	static void encodeTree(const TreeNode* tree, vector<EncodedNode>& encoded);
+	static bool sameTree(const vector<EncodedNode>& encoded, const TreeNode* tree);
+	static unique_ptr<TreeNode> decodeTree(const vector<EncodedNode>& encoded);
+	void invalidate(const TreeNode* mainTree);
+	void erase(typename list<Entry>::iterator entry);
+
+	size_t capacity;
+	// Результаты от недавно использованных к давно использованным
+	list<Entry> entries;
+	unordered_map<Key, typename list<Entry>::iterator, KeyHash> entryByKey;
+	unordered_map<const TreeNode*, MainTreeState> mainTrees;
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t invalidations;
+};
+
+using SearchCache = BasicSearchCache<TextLabel>;
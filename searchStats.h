@@ -0,0 +1,152 @@
+#pragma once
+#include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+using namespace std;
+
+
+// Этапы работы программы, время которых измеряется
+enum class StatsPhase
+{
+	FileRead, Lexing, TreeBuilding, CandidateLookup, PatchBuilding, DeltaConstruction, Pedigree, Print, Count
+};
+
+// Счётчики проделанной работы
+enum class StatsCounter
+{
+	NodesVisited, PatchNodesAllocated, ConnectionsCreated, CandidatesEvaluated, Count
+};
+
+// Структуры данных, память которых учитывается
+enum class StatsStructure
+{
+	Lexems, Nodes, PatchNodes, Count
+};
+
+// Сбор времени этапов и счётчиков работы. Пока сбор выключен, замеры и счётчики сводятся к проверке одного флага.
+// Флаг общий для всех потоков, а замеры и счётчики у каждого потока свои: отчёт показывает работу вызывающего потока
+class SearchStats {
+public:
+	static void enable(bool enabled);
+	static bool isEnabled()
+	{
+		return enabled;
+	}
+	static void count(StatsCounter counter, uint64_t amount = 1)
+	{
+		if (enabled)
+			counters[(int)counter] += amount;
+	}
+	// Выделение и освобождение памяти учитываются, только пока сбор включён: объём живой памяти отсчитывается
+	// от включения сбора, а освобождение памяти, выделенной до него, не опускает объём ниже нуля
+	static void allocated(StatsStructure structure, size_t bytes)
+	{
+		if (!enabled)
+			return;
+		int index = (int)structure;
+		allocations[index]++;
+		allocatedBytes[index] += bytes;
+		liveBytes[index] += bytes;
+		if (liveBytes[index] > peakBytes[index])
+			peakBytes[index] = liveBytes[index];
+		liveTotalBytes += bytes;
+		if (currentPhase >= 0) {
+			phaseAllocations[currentPhase]++;
+			phaseAllocatedBytes[currentPhase] += bytes;
+			if (liveTotalBytes > phasePeakBytes[currentPhase])
+				phasePeakBytes[currentPhase] = liveTotalBytes;
+		}
+	}
+	static void released(StatsStructure structure, size_t bytes)
+	{
+		if (!enabled)
+			return;
+		uint64_t& structureBytes = liveBytes[(int)structure];
+		structureBytes -= bytes < structureBytes ? bytes : structureBytes;
+		liveTotalBytes -= bytes < liveTotalBytes ? bytes : liveTotalBytes;
+	}
+	static void addTime(StatsPhase phase, uint64_t wallNanoseconds, uint64_t cpuNanoseconds);
+	static int enterPhase(StatsPhase phase);
+	static void leavePhase(int previousPhase);
+	static uint64_t getCounter(StatsCounter counter);
+	static uint64_t getCalls(StatsPhase phase);
+	static uint64_t getAllocations(StatsStructure structure);
+	static uint64_t getLiveBytes(StatsStructure structure);
+	static uint64_t getPeakBytes(StatsStructure structure);
+	static uint64_t getPhaseAllocations(StatsPhase phase);
+	static uint64_t peakResidentBytes();
+	static void reset();
+	static void report(ostream& out, bool json);
+	static uint64_t cpuTime();
+private:
+	static atomic<bool> enabled;
+	static thread_local uint64_t counters[(int)StatsCounter::Count];
+	static thread_local uint64_t calls[(int)StatsPhase::Count];
+	static thread_local uint64_t wallTimes[(int)StatsPhase::Count];
+	static thread_local uint64_t cpuTimes[(int)StatsPhase::Count];
+	static thread_local uint64_t allocations[(int)StatsStructure::Count];
+	static thread_local uint64_t allocatedBytes[(int)StatsStructure::Count];
+	static thread_local uint64_t liveBytes[(int)StatsStructure::Count];
+	static thread_local uint64_t peakBytes[(int)StatsStructure::Count];
+	static thread_local uint64_t liveTotalBytes;
+	// Этап, к которому относятся выделения памяти (-1 - ни один этап не замеряется)
+	static thread_local int currentPhase;
+	static thread_local uint64_t phaseAllocations[(int)StatsPhase::Count];
+	static thread_local uint64_t phaseAllocatedBytes[(int)StatsPhase::Count];
+	static thread_local uint64_t phasePeakBytes[(int)StatsPhase::Count];
+};
+
+// Замер времени этапа от создания объекта до его уничтожения
+class PhaseTimer {
+public:
+	explicit PhaseTimer(StatsPhase phase);
+	~PhaseTimer();
+	PhaseTimer(const PhaseTimer&) = delete;
+	PhaseTimer& operator=(const PhaseTimer&) = delete;
+private:
+	StatsPhase phase;
+	bool active;
+	chrono::steady_clock::time_point wallStart;
+	uint64_t cpuStart;
+	int previousPhase;
+};
+
+// Распределитель памяти для контейнеров, учитывающий выделенную память в заданной структуре данных
+template <class T, StatsStructure structure>
+class StatsAllocator {
+public:
+	using value_type = T;
+	template <class U>
+	struct rebind
+	{
+		using other = StatsAllocator<U, structure>;
+	};
+
+	StatsAllocator() = default;
+	template <class U>
+	StatsAllocator(const StatsAllocator<U, structure>&)
+	{
+	}
+	T* allocate(size_t count)
+	{
+		SearchStats::allocated(structure, count * sizeof(T));
+		return allocator<T>().allocate(count);
+	}
+	void deallocate(T* pointer, size_t count)
+	{
+		SearchStats::released(structure, count * sizeof(T));
+		allocator<T>().deallocate(pointer, count);
+	}
+	template <class U>
+	bool operator==(const StatsAllocator<U, structure>&) const
+	{
+		return true;
+	}
+	template <class U>
+	bool operator!=(const StatsAllocator<U, structure>&) const
+	{
+		return false;
+	}
+};
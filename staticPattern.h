@@ -0,0 +1,290 @@
+#pragma once
+#include "findSubTree.h"
+#include "assignmentEngine.h"
+#include "searchStats.h"
+#include <array>
+#include <type_traits>
+
+
+// Для каждого ребёнка искомого дерева - номер первого ребёнка с той же меткой (начала групп одноимённых детей)
+template <class T, size_t N>
+constexpr array<size_t, N> staticGroupLeaders(const array<T, N>& labels)
+{
+	array<size_t, N> leaders{};
+	for (size_t i = 0; i < N; i++) {
+		leaders[i] = i;
+		for (size_t j = 0; j < i; j++) {
+			if (labels[j] == labels[i]) {
+				leaders[i] = j;
+				break;
+			}
+		}
+	}
+	return leaders;
+}
+
+// Для каждой группы одноимённых детей (по номеру её начала) - сумма или наибольшая стоимость недостающих детей группы
+template <size_t N>
+constexpr array<int, N> staticGroupMissing(const array<size_t, N>& leaders, const array<int, N>& missingCosts, bool maximum)
+{
+	array<int, N> result{};
+	for (size_t i = 0; i < N; i++) {
+		int& value = result[leaders[i]];
+		value = maximum ? (value > missingCosts[i] ? value : missingCosts[i]) : value + missingCosts[i];
+	}
+	return result;
+}
+
+// Искомое дерево, заданное при компиляции: тип-описание с меткой корня и поддеревьями-детьми.
+// Метка задаётся типом с константой label (string_view для деревьев Node, uint32_t для IdNode), например
+//     struct Ev { static constexpr string_view label = "ev"; };
+//     using Rule = StaticPattern<Ev, StaticPattern<Id>, StaticPattern<Kind, StaticPattern<K0>>>;
+// Оценка кандидата повторяет BasicNode::evaluatePatch, но структура, метки и стоимости недостающих узлов
+// искомого дерева - константы, а проверки детей разворачиваются для каждого узла описания.
+// Кандидаты и дерево разности те же, что у findSubTree: дерево разности строится обычным путём по лучшему кандидату
+template <class LabelHolder, class... Children>
+class StaticPattern {
+public:
+	using LabelConstant = remove_cv_t<decltype(LabelHolder::label)>;
+
+	static constexpr LabelConstant label = LabelHolder::label;
+	static constexpr size_t childrenCount = sizeof...(Children);
+	static constexpr int descendants = (0 + ... + (1 + Children::descendants));
+
+	/**
+	 * Количество узлов, которых не хватает кандидату (см. BasicNode::evaluatePatchWrap)
+	 * \param[in] candidate Узел главного дерева с меткой корня искомого дерева
+	 * \param[in] policy Способ сопоставления детей
+	 * \return Количество недостающих узлов или -1, если сопоставление невозможно
+	 */
+	template <class Label>
+	static int evaluate(const BasicNode<Label>* candidate, MatchPolicy policy = MatchPolicy::Unordered)
+	{
+		switch (policy) {
+		case MatchPolicy::OrderedSubsequence:
+			return evaluatePatch<MatchPolicy::OrderedSubsequence>(candidate);
+		case MatchPolicy::OrderedExact:
+			return evaluatePatch<MatchPolicy::OrderedExact>(candidate);
+		default:
+			return evaluatePatch<MatchPolicy::Unordered>(candidate);
+		}
+	}
+
+	/**
+	 * Подсчёт недостающих узлов по тем же кандидатам, что и у BasicNode::countMissingNodes
+	 * \param[in] mainTree Главное дерево
+	 * \param[in] policy Способ сопоставления детей
+	 * \return Количество недостающих узлов или -1, если поддерево не найдено
+	 */
+	template <class Label>
+	static int countMissingNodes(const BasicNode<Label>* mainTree, MatchPolicy policy = MatchPolicy::Unordered)
+	{
+		const BasicNode<Label>* best;
+		return findBest(mainTree, policy, best);
+	}
+
+	/**
+	 * Поиск поддерева (см. BasicNode::findSubTree). Кандидаты оцениваются специализированно,
+	 * а дерево разности строится для лучшего из них по развёрнутому искомому дереву
+	 * \param[in] mainTree Главное дерево
+	 * \param[out] deltaTree Дерево разности
+	 * \param[in] policy Способ сопоставления детей
+	 * \return Количество недостающих узлов или -1, если поддерево не найдено
+	 */
+	template <class Label>
+	static int findSubTree(const BasicNode<Label>* mainTree, unique_ptr<BasicNode<Label>>& deltaTree, MatchPolicy policy = MatchPolicy::Unordered)
+	{
+		const BasicNode<Label>* best = nullptr;
+		if (findBest(mainTree, policy, best) == -1) {
+			deltaTree = nullptr;
+			return -1;
+		}
+		auto pattern = materialize<Label>();
+		return mainTree->findSubTreeAmong({ best }, pattern.get(), deltaTree, policy);
+	}
+
+	/**
+	 * Построить искомое дерево в виде обычных узлов
+	 * \return Дерево; текстовые метки ссылаются на константы описания
+	 */
+	template <class Label>
+	static unique_ptr<BasicNode<Label>> materialize()
+	{
+		unique_ptr<BasicNode<Label>> node;
+		if constexpr (is_same_v<Label, TextLabel>)
+			node = make_unique<BasicNode<Label>>(TextLabel{ label, nullptr });
+		else
+			node = make_unique<BasicNode<Label>>(Label(label));
+		(node->addChild(Children::template materialize<Label>()), ...);
+		return node;
+	}
+
+	// Вес соединения узла главного дерева с этим поддеревом (см. BasicNode::evaluateConnection)
+	template <MatchPolicy policy, class Label>
+	static int evaluateConnection(const BasicNode<Label>* mainNode)
+	{
+		if (mainNode->isLeaf())
+			return descendants;
+		if constexpr (childrenCount == 0)
+			return -1;
+		else
+			return evaluatePatch<policy>(mainNode);
+	}
+
+	// Вес сопоставления детей узла главного дерева с детьми этого поддерева (см. BasicNode::evaluatePatch)
+	template <MatchPolicy policy, class Label>
+	static int evaluatePatch(const BasicNode<Label>* mainNode)
+	{
+		SearchStats::count(StatsCounter::NodesVisited);
+		auto mainChildren = mainNode->getChildrenView();
+		if constexpr (childrenCount == 0) {
+			return mainChildren.empty() ? 0 : -1;
+		}
+		else {
+			using Connection = int (*)(const BasicNode<Label>*);
+			static constexpr array<Connection, childrenCount> connections = { &Children::template evaluateConnection<policy, Label>... };
+
+			if constexpr (policy == MatchPolicy::OrderedExact) {
+				// Лист главного дерева - как в BasicNode::buildPatch
+				if (mainChildren.empty())
+					return descendants;
+				if (mainChildren.size() != childrenCount)
+					return -1;
+				int sumConnections = 0;
+				for (size_t i = 0; i < childrenCount; i++) {
+					if (mainChildren[i]->getLabel() != labels[i])
+						return -1;
+					int weight = connections[i](mainChildren[i]);
+					if (weight == -1)
+						return -1;
+					sumConnections += weight;
+				}
+				return sumConnections;
+			}
+			else if constexpr (policy == MatchPolicy::OrderedSubsequence) {
+				int sumConnections = 0;
+				size_t cmpIndex = 0;
+				for (auto mainChild : mainChildren) {
+					int weight = -1;
+					while (weight == -1 && cmpIndex < childrenCount) {
+						size_t i = cmpIndex++;
+						if (mainChild->getLabel() == labels[i])
+							weight = connections[i](mainChild);
+						if (weight == -1)
+							sumConnections += missingCosts[i];
+					}
+					if (weight == -1)
+						return -1;
+					sumConnections += weight;
+				}
+				for (; cmpIndex < childrenCount; cmpIndex++)
+					sumConnections += missingCosts[cmpIndex];
+				return sumConnections;
+			}
+			else {
+				// Каждому ребёнку главного дерева нужен одноимённый ребёнок искомого дерева
+				for (auto mainChild : mainChildren) {
+					bool named = false;
+					for (size_t i = 0; i < childrenCount && !named; i++)
+						named = mainChild->getLabel() == labels[i];
+					if (!named)
+						return -1;
+				}
+
+				int sumConnections = 0;
+				for (size_t leader = 0; leader < childrenCount; leader++) {
+					if (leaders[leader] != leader)
+						continue;
+
+					size_t rowsCount = 0;
+					const BasicNode<Label>* row = nullptr;
+					for (auto mainChild : mainChildren) {
+						if (mainChild->getLabel() == labels[leader]) {
+							row = mainChild;
+							rowsCount++;
+						}
+					}
+
+					if (rowsCount == 0) {
+						sumConnections += missingSums[leader];
+					}
+					// Единственному ребёнку достаточно самого лёгкого соединения
+					else if (rowsCount == 1) {
+						int minWeight = -1;
+						int minMissingCost = 0;
+						for (size_t i = leader; i < childrenCount; i++) {
+							if (leaders[i] != leader)
+								continue;
+							int weight = connections[i](row);
+							if (weight != -1 && (minWeight == -1 || weight < minWeight)) {
+								minWeight = weight;
+								minMissingCost = missingCosts[i];
+							}
+						}
+						if (minWeight == -1)
+							return -1;
+						sumConnections += minWeight + missingSums[leader] - minMissingCost;
+					}
+					else {
+						size_t colsCount = 0;
+						for (size_t i = leader; i < childrenCount; i++)
+							colsCount += leaders[i] == leader;
+						SparseAssignment assignment((int)rowsCount, (int)colsCount);
+						int rowIndex = 0;
+						for (auto mainChild : mainChildren) {
+							if (mainChild->getLabel() != labels[leader])
+								continue;
+							int col = 0;
+							for (size_t i = leader; i < childrenCount; i++) {
+								if (leaders[i] != leader)
+									continue;
+								int weight = connections[i](mainChild);
+								if (weight != -1)
+									assignment.addEdge(rowIndex, col, (long long)weight + maxMissingCosts[leader] - missingCosts[i]);
+								col++;
+							}
+							rowIndex++;
+						}
+						if (!assignment.solve())
+							return -1;
+						sumConnections += (int)(assignment.getCost() - (long long)rowsCount * maxMissingCosts[leader] + missingSums[leader]);
+					}
+				}
+				return sumConnections;
+			}
+		}
+	}
+private:
+	// Лучший кандидат в прямом порядке обхода; при равных оценках - первый.
+	// Кандидаты те же, что возвращает findDescendants, но оцениваются сразу при обходе, без сбора в список
+	template <class Label>
+	static int findBest(const BasicNode<Label>* mainTree, MatchPolicy policy, const BasicNode<Label>*& best)
+	{
+		PhaseTimer timer(StatsPhase::PatchBuilding);
+		int minDelta = -1;
+		vector<const BasicNode<Label>*> path{ mainTree };
+		while (!path.empty()) {
+			const BasicNode<Label>* node = path.back();
+			path.pop_back();
+			if (node->getLabel() == label) {
+				SearchStats::count(StatsCounter::CandidatesEvaluated);
+				int curDelta = evaluate(node, policy);
+				if (curDelta != -1 && (minDelta == -1 || curDelta < minDelta)) {
+					minDelta = curDelta;
+					best = node;
+				}
+			}
+			auto children = node->getChildrenView();
+			for (size_t i = children.size(); i > 0; i--)
+				path.push_back(children[i - 1]);
+		}
+		return minDelta;
+	}
+
+	// Метки детей, стоимости недостающих детей и группы одноимённых детей
+	static constexpr array<LabelConstant, childrenCount> labels = { LabelConstant(Children::label)... };
+	static constexpr array<int, childrenCount> missingCosts = { (1 + Children::descendants)... };
+	static constexpr array<size_t, childrenCount> leaders = staticGroupLeaders(labels);
+	static constexpr array<int, childrenCount> missingSums = staticGroupMissing(leaders, missingCosts, false);
+	static constexpr array<int, childrenCount> maxMissingCosts = staticGroupMissing(leaders, missingCosts, true);
+};
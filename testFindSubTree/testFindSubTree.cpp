@@ -1,6 +1,22 @@
 ﻿#include "pch.h"
 #include "CppUnitTest.h"
 #include "../FindSubTree/findSubTree.h"
+#include "../FindSubTree/treeEditDistance.h"
+#include "../FindSubTree/pqGramIndex.h"
+#include "../FindSubTree/assignmentEngine.h"
+#include "../FindSubTree/searchCache.h"
+#include "../FindSubTree/searchStats.h"
+#include "../FindSubTree/patchArena.h"
+#include "../FindSubTree/treeDag.h"
+#include "../FindSubTree/multiPatternSearch.h"
+#include "../FindSubTree/treeStream.h"
+#include "../FindSubTree/treeLayout.h"
+#include "../FindSubTree/matchEnumerator.h"
+#include "../FindSubTree/findSubTreeApi.h"
+#include "../FindSubTree/compactTree.h"
+#include "../FindSubTree/treeSnapshot.h"
+#include "../FindSubTree/staticPattern.h"
+#include "../FindSubTree/asyncFileReader.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 using namespace std;
@@ -494,6 +510,64 @@ namespace testsNode
 
 			Assert::IsTrue(compareTrees(realDeltaTreeRoot.get(), desiredDeltaTreeRoot.get()));
 		}
+		TEST_METHOD(UnorderedKeepsSearchedTree)
+		{
+			string delimiters = "() ";
+			string searchedText = "1(3 2(4 5) 6(7))";
+			auto mainTree = parseOnTree("1(2(4) 3)", delimiters);
+			auto searchedTree = parseOnTree(searchedText, delimiters);
+
+			// Совпавший целиком ребёнок 3 пропускается, у 2(4 5) остаётся недостающая часть, 6(7) копируется целиком
+			unique_ptr<Node> realDeltaTree;
+			Assert::IsTrue(mainTree->buildDeltaTreeWrap(searchedTree.get(), realDeltaTree, MatchPolicy::Unordered) == 3);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), parseOnTree("1(2(5) 6(7))", delimiters).get()));
+			Assert::IsTrue(compareTrees(searchedTree.get(), parseOnTree(searchedText, delimiters).get()));
+		}
+		TEST_METHOD(UnorderedAssignsSameNamedChildren)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2 2(4))", delimiters);
+			auto searchedTree = parseOnTree("1(2(4 5) 2(4) 3)", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			Assert::IsTrue(mainTree->buildDeltaTreeWrap(searchedTree.get(), realDeltaTree, MatchPolicy::Unordered) == 3);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), parseOnTree("1(2(4 5) 3)", delimiters).get()));
+		}
+		TEST_METHOD(SubsequenceKeepsSearchedTree)
+		{
+			string delimiters = "() ";
+			string searchedText = "1(5 2 3(4 6) 7)";
+			auto mainTree = parseOnTree("1(2 3(4))", delimiters);
+			auto searchedTree = parseOnTree(searchedText, delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			Assert::IsTrue(mainTree->buildDeltaTreeWrap(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedSubsequence) == 3);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), parseOnTree("1(5 3(6) 7)", delimiters).get()));
+			Assert::IsTrue(compareTrees(searchedTree.get(), parseOnTree(searchedText, delimiters).get()));
+		}
+		TEST_METHOD(ExactKeepsSearchedTree)
+		{
+			string delimiters = "() ";
+			string searchedText = "1(2(3 5) 4(6))";
+			auto mainTree = parseOnTree("1(2(3 5) 4)", delimiters);
+			auto searchedTree = parseOnTree(searchedText, delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			Assert::IsTrue(mainTree->buildDeltaTreeWrap(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedExact) == 1);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), parseOnTree("1(4(6))", delimiters).get()));
+			Assert::IsTrue(compareTrees(searchedTree.get(), parseOnTree(searchedText, delimiters).get()));
+		}
+		TEST_METHOD(NoDeltaTreeWithoutMatch)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2(3) 4)", delimiters);
+			auto searchedTree = parseOnTree("1(2(3 5) 4)", delimiters);
+
+			// При точном сопоставлении количество детей 2 различается
+			unique_ptr<Node> realDeltaTree = make_unique<Node>("0");
+			Assert::IsTrue(mainTree->buildDeltaTreeWrap(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedExact) == -1);
+			Assert::IsTrue(realDeltaTree == nullptr);
+		}
 	};
 	TEST_CLASS(testFindSubTree)
 	{
@@ -662,6 +736,1190 @@ namespace testsNode
 
 	};
 
+	TEST_CLASS(orderedMatchingTests)
+	{
+		TEST_METHOD(ExactSameOrder)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2(4 5) 3)", delimiters);
+			auto searchedTree = parseOnTree("2(4 5)", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedExact);
+
+			Assert::IsTrue(result == 0);
+			Assert::IsTrue(realDeltaTree.get() == nullptr);
+		}
+		TEST_METHOD(ExactDifferentOrder)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2(5 4) 3)", delimiters);
+			auto searchedTree = parseOnTree("2(4 5)", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedExact);
+
+			Assert::IsTrue(result == -1);
+			Assert::IsTrue(realDeltaTree.get() == nullptr);
+		}
+		TEST_METHOD(ExactLeafRuleIsSameAtRoot)
+		{
+			// Лист главного дерева сопоставляется с одноимённым узлом с детьми и в корне кандидата, и ниже него
+			string delimiters = "() ";
+			string mainText = "c(a)";
+			auto mainTree = parseOnTree(mainText, delimiters);
+			TreeDag dag = parseOnDag(make_shared<const string>(mainText), delimiters);
+			for (string searchedText : { "a(b)", "c(a(b))" }) {
+				auto searchedTree = parseOnTree(searchedText, delimiters);
+				unique_ptr<Node> realDeltaTree;
+				Assert::IsTrue(mainTree->findSubTree(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedExact) == 1);
+				Assert::IsTrue(compareTrees(realDeltaTree.get(), parseOnTree("c(a(b))", delimiters).get()));
+				Assert::IsTrue(mainTree->countMissingNodes(searchedTree.get(), MatchPolicy::OrderedExact) == 1);
+				Assert::IsTrue(dag.countMissingNodes(searchedTree.get(), MatchPolicy::OrderedExact) == 1);
+			}
+		}
+		TEST_METHOD(SubsequenceMissingMiddleChild)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2(4 6) 3)", delimiters);
+			auto searchedTree = parseOnTree("2(4 5 6)", delimiters);
+			auto desiredDeltaTree = parseOnTree("1(2(5))", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedSubsequence);
+
+			Assert::IsTrue(result == 1);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), desiredDeltaTree.get()));
+		}
+		TEST_METHOD(SubsequenceWrongOrder)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2(6 4) 3)", delimiters);
+			auto searchedTree = parseOnTree("2(4 5 6)", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedSubsequence);
+
+			Assert::IsTrue(result == -1);
+			Assert::IsTrue(realDeltaTree.get() == nullptr);
+		}
+		TEST_METHOD(SubsequenceSkipsInvalidSimmilar)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2(3(7)))", delimiters);
+			auto searchedTree = parseOnTree("2(3 3(7 8))", delimiters);
+			auto desiredDeltaTree = parseOnTree("1(2(3 3(8)))", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree, MatchPolicy::OrderedSubsequence);
+
+			Assert::IsTrue(result == 2);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), desiredDeltaTree.get()));
+		}
+		TEST_METHOD(ParsePolicyNames)
+		{
+			MatchPolicy policy = MatchPolicy::Unordered;
+
+			Assert::IsTrue(parseMatchPolicy("exact", policy));
+			Assert::IsTrue(policy == MatchPolicy::OrderedExact);
+			Assert::IsTrue(parseMatchPolicy("subsequence", policy));
+			Assert::IsTrue(policy == MatchPolicy::OrderedSubsequence);
+			Assert::IsFalse(parseMatchPolicy("sorted", policy));
+		}
+	};
+
+	TEST_CLASS(treeEditDistanceTests)
+	{
+		TEST_METHOD(SameTrees)
+		{
+			string delimiters = "() ";
+			auto tree1 = parseOnTree("1(3(4 5 6) 2(9 10))", delimiters);
+			auto tree2 = parseOnTree("1(3(4 5 6) 2(9 10))", delimiters);
+
+			Assert::IsTrue(treeEditDistance(tree1.get(), tree2.get()) == 0);
+		}
+		TEST_METHOD(RelabelRoot)
+		{
+			auto tree1 = make_unique<Node>("1");
+			auto tree2 = make_unique<Node>("2");
+
+			Assert::IsTrue(treeEditDistance(tree1.get(), tree2.get()) == 1);
+		}
+		TEST_METHOD(InsertLeaves)
+		{
+			string delimiters = "() ";
+			auto tree1 = parseOnTree("1", delimiters);
+			auto tree2 = parseOnTree("1(2 3)", delimiters);
+
+			Assert::IsTrue(treeEditDistance(tree1.get(), tree2.get()) == 2);
+			Assert::IsTrue(treeEditDistance(tree2.get(), tree1.get()) == 2);
+		}
+		TEST_METHOD(MoveByDeleteAndInsert)
+		{
+			string delimiters = "() ";
+			auto tree1 = parseOnTree("f(d(a c(b)) e)", delimiters);
+			auto tree2 = parseOnTree("f(c(d(a b)) e)", delimiters);
+
+			Assert::IsTrue(treeEditDistance(tree1.get(), tree2.get()) == 2);
+		}
+		TEST_METHOD(ClosestSubTree)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(3(4 5 6 7) 2(3(4 5)))", delimiters);
+			auto searchedTree = parseOnTree("3(4 5 6)", delimiters);
+
+			const Node* closestTree = nullptr;
+			int distance = findClosestSubTree(mainTree.get(), searchedTree.get(), &closestTree);
+
+			Assert::IsTrue(distance == 1);
+			Assert::IsTrue(closestTree == mainTree->getChildren()[0]);
+		}
+		TEST_METHOD(NoCandidates)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(3(4 5 6 7) 2)", delimiters);
+			auto searchedTree = parseOnTree("9(4 5 6)", delimiters);
+
+			const Node* closestTree = nullptr;
+
+			Assert::IsTrue(findClosestSubTree(mainTree.get(), searchedTree.get(), &closestTree) == -1);
+			Assert::IsTrue(closestTree == nullptr);
+		}
+	};
+
+	TEST_CLASS(pqGramIndexTests)
+	{
+		TEST_METHOD(MostSimilarTreeFirst)
+		{
+			string delimiters = "() ";
+			auto tree1 = parseOnTree("1(3(4 5) 2(9 10))", delimiters);
+			auto tree2 = parseOnTree("7(3(4 5 6) 8)", delimiters);
+			auto tree3 = parseOnTree("9(9(9))", delimiters);
+			auto searchedTree = parseOnTree("3(4 5 6)", delimiters);
+
+			PqGramIndex index;
+			index.addTree("tree1", tree1.get());
+			index.addTree("tree2", tree2.get());
+			index.addTree("tree3", tree3.get());
+			auto candidates = index.shortlist(searchedTree.get(), 10, 10);
+
+			Assert::IsTrue(candidates.size() == 2);
+			Assert::IsTrue(index.getPath(candidates[0].treeIndex) == "tree2");
+			Assert::IsTrue(index.getPath(candidates[1].treeIndex) == "tree1");
+			Assert::IsTrue(candidates[0].score > candidates[1].score);
+		}
+		TEST_METHOD(ShortlistedRootsAreCandidates)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(3(4) 2(3(4 5 6)) 3)", delimiters);
+			auto searchedTree = parseOnTree("3(4 5 6)", delimiters);
+
+			PqGramIndex index;
+			index.addTree("main", mainTree.get());
+			auto candidates = index.shortlist(searchedTree.get(), 10, 1);
+			auto roots = findPreorderNodes(mainTree.get(), candidates[0].roots);
+
+			Assert::IsTrue(roots.size() == 1);
+			Assert::IsTrue(roots[0] == mainTree->getChildren()[1]->getChildren()[0]);
+
+			unique_ptr<Node> realDeltaTree;
+			Assert::IsTrue(mainTree->findSubTreeAmong(roots, searchedTree.get(), realDeltaTree) == 0);
+		}
+		TEST_METHOD(SaveAndLoad)
+		{
+			string delimiters = "() ";
+			auto tree1 = parseOnTree("1(3(4 5) 2(9 10))", delimiters);
+			auto tree2 = parseOnTree("7(3(4 5 6) 8)", delimiters);
+			auto searchedTree = parseOnTree("3(4 5 6)", delimiters);
+			string indexPath = (std::filesystem::temp_directory_path() / "pqGramIndexTests.idx").string();
+
+			PqGramIndex index;
+			index.addTree("tree1", tree1.get());
+			index.addTree("tree2", tree2.get());
+			Assert::IsTrue(index.save(indexPath));
+
+			PqGramIndex loadedIndex;
+			Assert::IsTrue(loadedIndex.load(indexPath));
+			std::filesystem::remove(indexPath);
+
+			auto expected = index.shortlist(searchedTree.get(), 10, 10);
+			auto loaded = loadedIndex.shortlist(searchedTree.get(), 10, 10);
+			Assert::IsTrue(loadedIndex.size() == 2);
+			Assert::IsTrue(loaded.size() == expected.size());
+			for (size_t i = 0; i < loaded.size(); i++) {
+				Assert::IsTrue(loaded[i].treeIndex == expected[i].treeIndex);
+				Assert::IsTrue(loaded[i].roots == expected[i].roots);
+			}
+		}
+		TEST_METHOD(LoadMissingFile)
+		{
+			PqGramIndex index;
+
+			Assert::IsFalse(index.load("not existing index file"));
+		}
+		TEST_METHOD(LoadCorruptFile)
+		{
+			auto tree = parseOnTree("1(3(4 5) 2(9 10))", "() ");
+			string indexPath = (std::filesystem::temp_directory_path() / "pqGramIndexCorrupt.idx").string();
+			PqGramIndex index;
+			index.addTree("tree", tree.get());
+			Assert::IsTrue(index.save(indexPath));
+			string content;
+			{
+				ifstream in(indexPath, ios::binary);
+				content.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+			}
+
+			// Огромные длины на месте количества деревьев и длины пути первого дерева
+			const uint64_t hugeLength = UINT64_MAX / 2;
+			for (size_t offset : { 16, 24 }) {
+				string corrupted = content;
+				corrupted.replace(offset, sizeof(hugeLength), reinterpret_cast<const char*>(&hugeLength), sizeof(hugeLength));
+				ofstream(indexPath, ios::binary) << corrupted;
+				PqGramIndex loadedIndex;
+				Assert::IsFalse(loadedIndex.load(indexPath));
+			}
+			// Неверное содержимое при верных длинах: p, конец грамм первого узла, номер дерева последней pq-граммы
+			Assert::AreEqual(string("tree"), content.substr(32, 4));
+			const size_t gramEndOffset = 44 + sizeof(uint64_t) + sizeof(uint32_t);
+			for (auto patch : { make_pair((size_t)8, 0u), make_pair(gramEndOffset, 1000000u), make_pair(content.size() - 8, 5u) }) {
+				string corrupted = content;
+				corrupted.replace(patch.first, sizeof(uint32_t), reinterpret_cast<const char*>(&patch.second), sizeof(uint32_t));
+				ofstream(indexPath, ios::binary) << corrupted;
+				PqGramIndex loadedIndex;
+				Assert::IsFalse(loadedIndex.load(indexPath));
+			}
+			// Обрезанный файл
+			for (size_t length = 0; length < content.size(); length++) {
+				ofstream(indexPath, ios::binary) << content.substr(0, length);
+				PqGramIndex loadedIndex;
+				Assert::IsFalse(loadedIndex.load(indexPath));
+			}
+			std::filesystem::remove(indexPath);
+		}
+	};
+
+	TEST_CLASS(treeDagTests)
+	{
+		TEST_METHOD(RepeatedSubtreesAreShared)
+		{
+			string text = "0(1(2 3) 1(2 3) 4(1(2 3)))";
+			TreeDag dag = parseOnDag(make_shared<const string>(text), "() ");
+
+			Assert::IsTrue(dag.getTreeSize() == 11);
+			Assert::IsTrue(dag.size() == 5);
+			Assert::IsTrue(compareTrees(dag.materialize(dag.getRoot()).get(), parseOnTree(text, "() ").get()));
+		}
+		TEST_METHOD(EveryOccurrenceIsReported)
+		{
+			string delimiters = "() ";
+			string text = "0(1(2 3) 5 1(2 3) 4(1(2 3)))";
+			TreeDag dag = parseOnDag(make_shared<const string>(text), delimiters);
+			auto mainTree = parseOnTree(text, delimiters);
+			auto searchedTree = parseOnTree("1(2 3 6)", delimiters);
+
+			unique_ptr<Node> realDeltaTree, dagDeltaTree;
+			vector<TreeDag::Location> locations;
+			int delta = mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+
+			Assert::IsTrue(dag.findSubTree(searchedTree.get(), dagDeltaTree, locations) == delta);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), dagDeltaTree.get()));
+			Assert::IsTrue(locations == vector<TreeDag::Location>({ { 0 }, { 2 }, { 3, 0 } }));
+		}
+		TEST_METHOD(OnlyRootTreeIsSearched)
+		{
+			string delimiters = "() ";
+			auto firstTree = parseOnTree("x(a(b))", delimiters);
+			auto rootTree = parseOnTree("y(c)", delimiters);
+			TreeDag dag;
+			dag.addTree(firstTree.get());
+			dag.addTree(rootTree.get());
+			auto searchedTree = parseOnTree("a(b)", delimiters);
+
+			// Класс a(b) есть в DAG, но не в дереве корня
+			unique_ptr<Node> dagDeltaTree;
+			vector<TreeDag::Location> locations;
+			Assert::IsTrue(dag.countMissingNodes(searchedTree.get()) == -1);
+			Assert::IsTrue(dag.findSubTree(searchedTree.get(), dagDeltaTree, locations) == -1);
+			Assert::IsTrue(dagDeltaTree == nullptr && locations.empty());
+			Assert::IsTrue(dag.countMissingNodes(parseOnTree("c", delimiters).get()) == 0);
+		}
+		TEST_METHOD(ClassesAreEvaluatedWithoutMaterializing)
+		{
+			string delimiters = "() ";
+			string text = "0(1(2(3 4) 2(3) 5) 6(1(2(3 4) 2(3) 5)) 1(2(3) 5 7))";
+			TreeDag dag = parseOnDag(make_shared<const string>(text), delimiters);
+			auto mainTree = parseOnTree(text, delimiters);
+			auto searchedTree = parseOnTree("1(2(3 4 8) 2(3) 5)", delimiters);
+
+			for (MatchPolicy policy : { MatchPolicy::Unordered, MatchPolicy::OrderedSubsequence, MatchPolicy::OrderedExact }) {
+				unique_ptr<Node> realDeltaTree;
+				int delta = mainTree->findSubTree(searchedTree.get(), realDeltaTree, policy);
+
+				// Подсчёт по DAG не создаёт ни одного узла дерева
+				SearchStats::enable(true);
+				SearchStats::reset();
+				int dagDelta = dag.countMissingNodes(searchedTree.get(), policy);
+				uint64_t allocations = SearchStats::getAllocations(StatsStructure::Nodes);
+				SearchStats::enable(false);
+				Assert::IsTrue(dagDelta == delta);
+				Assert::IsTrue(allocations == 0);
+
+				unique_ptr<Node> dagDeltaTree;
+				vector<TreeDag::Location> locations;
+				Assert::IsTrue(dag.findSubTree(searchedTree.get(), dagDeltaTree, locations, policy) == delta);
+				Assert::IsTrue(compareTrees(realDeltaTree.get(), dagDeltaTree.get()));
+			}
+		}
+	};
+
+	TEST_CLASS(multiPatternTests)
+	{
+		TEST_METHOD(MatchesSeparateSearches)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2 3(4)) 5(1(2 3(4 6))) 1(7))", delimiters);
+			vector<unique_ptr<Node>> searchedTrees;
+			for (string text : { "1(2 3(4 8))", "1(7 9)", "3(4 6 2)", "1(2 3(4 8))", "9" })
+				searchedTrees.push_back(parseOnTree(text, delimiters));
+
+			MultiPatternSearch engine;
+			for (const auto& searchedTree : searchedTrees)
+				engine.addPattern(searchedTree.get());
+			auto matches = engine.search(mainTree.get());
+
+			Assert::IsTrue(matches.size() == searchedTrees.size());
+			for (size_t i = 0; i < searchedTrees.size(); i++) {
+				unique_ptr<Node> realDeltaTree, engineDeltaTree;
+				int delta = mainTree->findSubTree(searchedTrees[i].get(), realDeltaTree);
+				Assert::IsTrue(matches[i].delta == delta);
+				Assert::IsTrue(engine.buildDeltaTree(mainTree.get(), i, matches[i], engineDeltaTree) == delta);
+				Assert::IsTrue(compareTrees(realDeltaTree.get(), engineDeltaTree.get()));
+			}
+		}
+		TEST_METHOD(SharedSubtreesAreEvaluatedOnce)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3 4) 5) 1(2(3 4) 6))", delimiters);
+			auto first = parseOnTree("1(2(3 4) 5)", delimiters);
+			auto second = parseOnTree("1(2(3 4) 5 7)", delimiters);
+
+			MultiPatternSearch engine;
+			engine.addPattern(first.get());
+			engine.addPattern(second.get());
+			auto matches = engine.search(mainTree.get());
+
+			Assert::IsTrue(matches[0].delta == 0 && matches[1].delta == 1);
+			Assert::IsTrue(matches[0].root == mainTree->getChild(0));
+			// Вес пары (узел 2 главного дерева, поддерево 2(3 4)) второго дерева взят из первого
+			Assert::IsTrue(engine.getMemo().getHits() > 0);
+		}
+	};
+
+	TEST_CLASS(treeStreamTests)
+	{
+		TEST_METHOD(TreesAreReadOneByOne)
+		{
+			istringstream in("0(1 2)\n  3\n4(5(6)) 7 8(9)");
+			TreeStreamReader reader(in, "() \t\n\r");
+			vector<string> expected = { "0(1 2)", "3", "4(5(6))", "7", "8(9)" };
+
+			for (const auto& text : expected) {
+				auto tree = reader.next();
+				Assert::IsTrue(compareTrees(tree.get(), parseOnTree(text, "() ").get()));
+			}
+			Assert::IsTrue(reader.next() == nullptr);
+			Assert::IsTrue(reader.isFinished());
+			Assert::IsTrue(reader.getTreesRead() == expected.size());
+		}
+		TEST_METHOD(ReadingContinuesAfterBadTree)
+		{
+			istringstream in("0(1) 2(3)) 4(5)");
+			TreeStreamReader reader(in, "() ");
+			bool failed = false;
+
+			Assert::IsTrue(reader.next()->getName() == "0");
+			Assert::IsTrue(reader.next()->getName() == "2");
+			// Лишняя закрывающая скобка читается как отдельное ошибочное дерево
+			try {
+				reader.next();
+			}
+			catch (...) {
+				failed = true;
+			}
+			Assert::IsTrue(failed);
+			Assert::IsTrue(reader.next()->getName() == "4");
+		}
+	};
+
+	TEST_CLASS(treeLayoutTests)
+	{
+		TEST_METHOD(SearchMatchesInMemory)
+		{
+			string delimiters = "() ";
+			string mainText = "0(1(2(3) 2(4)) 5(1(2(3 4)) 1(2)))";
+			string layoutPath = (std::filesystem::temp_directory_path() / "treeLayoutTests.lay").string();
+			istringstream in(mainText);
+			string error;
+			Assert::IsTrue(TreeLayout::build(in, layoutPath, delimiters, error));
+
+			TreeLayout layout;
+			Assert::IsTrue(layout.open(layoutPath));
+			Assert::IsTrue(layout.size() == 13);
+			auto mainTree = parseOnTree(mainText, delimiters);
+			for (string searchedText : { "1(2(3 4) 2(4 5))", "2(3 4)", "1(2 7)", "5(1(2))", "9" }) {
+				auto searchedTree = parseOnTree(searchedText, delimiters);
+				unique_ptr<Node> expectedDeltaTree, deltaTree;
+				int expected = mainTree->findSubTree(searchedTree.get(), expectedDeltaTree);
+				Assert::IsTrue(layout.findSubTree(searchedTree.get(), deltaTree) == expected);
+				Assert::IsTrue(compareTrees(deltaTree.get(), expectedDeltaTree.get()));
+				Assert::IsTrue(layout.countMissingNodes(searchedTree.get()) == expected);
+			}
+			layout = TreeLayout();
+			std::filesystem::remove(layoutPath);
+		}
+		TEST_METHOD(CandidatesOverBudgetAreSkipped)
+		{
+			string delimiters = "() ";
+			string layoutPath = (std::filesystem::temp_directory_path() / "treeLayoutBudget.lay").string();
+			istringstream in("0(1(2 3) 1(2))");
+			string error;
+			Assert::IsTrue(TreeLayout::build(in, layoutPath, delimiters, error));
+
+			TreeLayout layout;
+			Assert::IsTrue(layout.open(layoutPath));
+			auto searchedTree = parseOnTree("1(2 3)", delimiters);
+			// В ограничение умещается только корень кандидата
+			layout.setMemoryBudget(1);
+			Assert::IsTrue(layout.countMissingNodes(searchedTree.get()) == -1);
+			Assert::IsTrue(layout.getSkippedCandidates() == 2);
+
+			layout.setMemoryBudget(TreeLayout::DEFAULT_MEMORY_BUDGET);
+			Assert::IsTrue(layout.countMissingNodes(searchedTree.get()) == 0);
+			Assert::IsTrue(layout.getSkippedCandidates() == 0);
+			layout = TreeLayout();
+			std::filesystem::remove(layoutPath);
+		}
+	};
+
+	TEST_CLASS(matchEnumeratorTests)
+	{
+		TEST_METHOD(MatchesFollowPreorder)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3) 2(4)) 5(1(2(3 4)) 1(7) 1(2)))", delimiters);
+			auto searchedTree = parseOnTree("1(2(3 4) 2(4 5))", delimiters);
+			MatchEnumerator matches(mainTree.get(), searchedTree.get());
+
+			vector<int> deltas;
+			const Node* best = nullptr;
+			int minDelta = INT_MAX;
+			for (const auto& match : matches) {
+				Assert::IsTrue(match.delta == match.root->evaluatePatchWrap(searchedTree.get()));
+				deltas.push_back(match.delta);
+				if (match.delta < minDelta) {
+					minDelta = match.delta;
+					best = match.root;
+				}
+			}
+			// Кандидат 1(7) не подходит и пропускается
+			Assert::IsTrue(deltas == vector<int>({ 2, 3, 5 }));
+			Assert::IsTrue(matches.getCandidatesEvaluated() == 4);
+
+			unique_ptr<Node> deltaTree, expectedDeltaTree;
+			Assert::IsTrue(matches.buildDeltaTree({ minDelta, best }, deltaTree) == mainTree->findSubTree(searchedTree.get(), expectedDeltaTree));
+			Assert::IsTrue(compareTrees(deltaTree.get(), expectedDeltaTree.get()));
+		}
+		TEST_METHOD(EarlyStopSkipsRemainingCandidates)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2) 1(2) 1(2 3) 1)", delimiters);
+			auto searchedTree = parseOnTree("1(2)", delimiters);
+			MatchEnumerator matches(mainTree.get(), searchedTree.get());
+
+			BasicPatternMatch<TextLabel> match{ -1, nullptr };
+			Assert::IsTrue(matches.next(match));
+			Assert::IsTrue(match.delta == 0);
+			Assert::IsTrue(match.root == mainTree->getChildrenView()[0]);
+			Assert::IsTrue(matches.getCandidatesEvaluated() == 1);
+			Assert::IsFalse(matches.isFinished());
+		}
+	};
+
+	TEST_CLASS(apiTests)
+	{
+		TEST_METHOD(SearchFromMemoryBuffers)
+		{
+			string mainText = "0(1(2(3) 2(4)))", searchedText = "1(2(3 4) 2(4 5 6))";
+			fst_tree* mainTree = nullptr;
+			fst_tree* searchedTree = nullptr;
+			Assert::IsTrue(fst_parse_tree(mainText.data(), mainText.size(), nullptr, &mainTree) == FST_OK);
+			Assert::IsTrue(fst_parse_tree(searchedText.data(), searchedText.size(), nullptr, &searchedTree) == FST_OK);
+			Assert::IsTrue(fst_tree_size(mainTree) == 6);
+
+			fst_result* result = nullptr;
+			Assert::IsTrue(fst_find_subtree(mainTree, searchedTree, FST_UNORDERED, &result) == FST_OK);
+			unique_ptr<Node> expectedDeltaTree;
+			auto expected = parseOnTree(mainText, "() ")->findSubTree(parseOnTree(searchedText, "() ").get(), expectedDeltaTree);
+			Assert::IsTrue(fst_result_delta(result) == expected);
+
+			// Дерево разности обходится через узлы интерфейса
+			const fst_node* root = fst_result_delta_tree(result);
+			size_t length;
+			const char* label = fst_node_label(root, &length);
+			Assert::IsTrue(string(label, length) == expectedDeltaTree->getName());
+			Assert::IsTrue(fst_node_children_count(root) == expectedDeltaTree->getChildrenCount());
+			Assert::IsTrue(fst_node_child(root, fst_node_children_count(root)) == nullptr);
+
+			int delta;
+			Assert::IsTrue(fst_count_missing_nodes(mainTree, searchedTree, FST_UNORDERED, &delta) == FST_OK);
+			Assert::IsTrue(delta == expected);
+			fst_free_result(result);
+			fst_free_tree(searchedTree);
+			fst_free_tree(mainTree);
+		}
+		TEST_METHOD(ErrorsAreReturnedAsStatus)
+		{
+			string badText = "0(1 2", emptyText = " ";
+			fst_tree* tree = nullptr;
+			Assert::IsTrue(fst_parse_tree(badText.data(), badText.size(), nullptr, &tree) == FST_ERROR_PARSE);
+			Assert::IsTrue(tree == nullptr);
+			Assert::IsTrue(fst_parse_tree(emptyText.data(), emptyText.size(), nullptr, &tree) == FST_ERROR_PARSE);
+			Assert::IsTrue(fst_find_subtree(nullptr, nullptr, FST_UNORDERED, nullptr) == FST_ERROR_ARGUMENT);
+			Assert::IsTrue(fst_index_create(0, 3, nullptr) == FST_ERROR_ARGUMENT);
+			Assert::AreEqual(string("Internal error"), string(fst_status_message(FST_ERROR_INTERNAL)));
+		}
+		TEST_METHOD(IndexSearchesPreloadedTrees)
+		{
+			vector<string> texts = { "0(1(2) 3)", "5(1(2(3 4)) 6)", "7(8 9)" };
+			vector<fst_tree*> trees(texts.size(), nullptr);
+			fst_index* index = nullptr;
+			Assert::IsTrue(fst_index_create(2, 3, &index) == FST_OK);
+			for (size_t i = 0; i < texts.size(); i++) {
+				Assert::IsTrue(fst_parse_tree(texts[i].data(), texts[i].size(), nullptr, &trees[i]) == FST_OK);
+				Assert::IsTrue(fst_index_add_tree(index, trees[i], nullptr) == FST_OK);
+			}
+
+			string searchedText = "1(2(3 4))";
+			fst_tree* searchedTree = nullptr;
+			fst_result* result = nullptr;
+			size_t treeIndex = texts.size();
+			Assert::IsTrue(fst_parse_tree(searchedText.data(), searchedText.size(), nullptr, &searchedTree) == FST_OK);
+			Assert::IsTrue(fst_index_search(index, searchedTree, FST_UNORDERED, 3, &result, &treeIndex) == FST_OK);
+			Assert::IsTrue(fst_result_delta(result) == 0);
+			Assert::IsTrue(treeIndex == 1);
+
+			fst_free_result(result);
+			fst_free_tree(searchedTree);
+			fst_free_index(index);
+			for (auto tree : trees)
+				fst_free_tree(tree);
+		}
+		TEST_METHOD(ConcurrentQueriesOnSharedTrees)
+		{
+			vector<string> mainTexts = { "0(1(2 3(4 5)) 6(1(2 7)) 8)", "9(1(2(3 4)) 6(7 8))" };
+			vector<string> searchedTexts = { "1(2 3(4))", "1(2 7 9)", "6(1 7)", "3(4 5 10)" };
+			vector<fst_tree*> mainTrees(mainTexts.size(), nullptr);
+			fst_index* index = nullptr;
+			Assert::IsTrue(fst_index_create(2, 3, &index) == FST_OK);
+			for (size_t i = 0; i < mainTexts.size(); i++) {
+				Assert::IsTrue(fst_parse_tree(mainTexts[i].data(), mainTexts[i].size(), nullptr, &mainTrees[i]) == FST_OK);
+				Assert::IsTrue(fst_index_add_tree(index, mainTrees[i], nullptr) == FST_OK);
+			}
+
+			// Ожидаемые результаты получаются последовательно
+			vector<int> expectedDeltas, expectedIndexDeltas;
+			for (const auto& text : searchedTexts) {
+				fst_tree* searchedTree = nullptr;
+				fst_result* result = nullptr;
+				Assert::IsTrue(fst_parse_tree(text.data(), text.size(), nullptr, &searchedTree) == FST_OK);
+				Assert::IsTrue(fst_find_subtree(mainTrees[0], searchedTree, FST_UNORDERED, &result) == FST_OK);
+				expectedDeltas.push_back(fst_result_delta(result));
+				fst_free_result(result);
+				Assert::IsTrue(fst_index_search(index, searchedTree, FST_SUBSEQUENCE, 2, &result, nullptr) == FST_OK);
+				expectedIndexDeltas.push_back(fst_result_delta(result));
+				fst_free_result(result);
+				fst_free_tree(searchedTree);
+			}
+
+			// Потоки разбирают свои искомые деревья и ищут их в общих главных деревьях и индексе
+			atomic<int> mismatches{ 0 };
+			vector<thread> workers;
+			for (int worker = 0; worker < 4; worker++) {
+				workers.emplace_back([&] {
+					for (int round = 0; round < 50; round++) {
+						for (size_t i = 0; i < searchedTexts.size(); i++) {
+							fst_tree* searchedTree = nullptr;
+							fst_result* result = nullptr;
+							int delta = -2;
+							if (fst_parse_tree(searchedTexts[i].data(), searchedTexts[i].size(), nullptr, &searchedTree) != FST_OK) {
+								mismatches++;
+								continue;
+							}
+							if (fst_find_subtree(mainTrees[0], searchedTree, FST_UNORDERED, &result) != FST_OK || fst_result_delta(result) != expectedDeltas[i])
+								mismatches++;
+							fst_free_result(result);
+							if (fst_count_missing_nodes(mainTrees[0], searchedTree, FST_UNORDERED, &delta) != FST_OK || delta != expectedDeltas[i])
+								mismatches++;
+							if (fst_index_search(index, searchedTree, FST_SUBSEQUENCE, 2, &result, nullptr) != FST_OK || fst_result_delta(result) != expectedIndexDeltas[i])
+								mismatches++;
+							fst_free_result(result);
+							fst_free_tree(searchedTree);
+						}
+					}
+				});
+			}
+			for (auto& worker : workers)
+				worker.join();
+			Assert::AreEqual(0, mismatches.load());
+
+			fst_free_index(index);
+			for (auto tree : mainTrees)
+				fst_free_tree(tree);
+		}
+	};
+
+	TEST_CLASS(asyncFileReaderTests)
+	{
+		TEST_METHOD(StreamingParseMatchesWholeText)
+		{
+			string delimiters = "() \t\n\r";
+			string treePath = (std::filesystem::temp_directory_path() / "asyncFileReaderTests.txt").string();
+			{
+				ofstream out(treePath);
+				out << "root(alpha(beta gamma)\n delta(epsilon(zeta eta) theta)\n iota kappa(lambda))";
+			}
+			auto expectedTree = parseOnTree(string("root(alpha(beta gamma) delta(epsilon(zeta eta) theta) iota kappa(lambda))"), delimiters);
+
+			// Маленькие части разрезают имена узлов на границах
+			for (size_t chunkSize : { 1, 3, 7, 1024 }) {
+				AsyncFileReader file(treePath, chunkSize);
+				auto tree = parseOnTree(file, delimiters);
+				Assert::IsTrue(compareTrees(tree.get(), expectedTree.get()));
+			}
+			std::filesystem::remove(treePath);
+		}
+		TEST_METHOD(LinesAreJoined)
+		{
+			string treePath = (std::filesystem::temp_directory_path() / "asyncFileReaderLines.txt").string();
+			{
+				ofstream out(treePath);
+				out << "1(2\n3 4)\n";
+			}
+			AsyncFileReader file(treePath, 2);
+			Assert::IsTrue(file.wait());
+			Assert::IsTrue(*file.getContent() == "1(23 4)");
+			std::filesystem::remove(treePath);
+		}
+		TEST_METHOD(MissingAndEmptyFiles)
+		{
+			string treePath = (std::filesystem::temp_directory_path() / "asyncFileReaderEmpty.txt").string();
+			{
+				ofstream out(treePath);
+				out << "\n\n";
+			}
+			AsyncFileReader emptyFile(treePath);
+			Assert::IsTrue(emptyFile.isEmpty());
+			Assert::IsTrue(parseOnTree(emptyFile, "() ") == nullptr);
+
+			AsyncFileReader missingFile(treePath + ".missing");
+			Assert::IsFalse(missingFile.wait());
+			Assert::IsTrue(parseOnTree(missingFile, "() ") == nullptr);
+			std::filesystem::remove(treePath);
+		}
+	};
+
+	TEST_CLASS(searchCacheTests)
+	{
+		TEST_METHOD(RepeatedQueryHits)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3) 2(4)))", delimiters);
+			auto searchedTree = parseOnTree("1(2(3 4) 2(4 5 6))", delimiters);
+			auto sameSearchedTree = parseOnTree("1(2(3 4) 2(4 5 6))", delimiters);
+			SearchCache cache(4);
+
+			unique_ptr<Node> firstDeltaTree, secondDeltaTree;
+			int firstResult = cache.findSubTree(mainTree.get(), searchedTree.get(), firstDeltaTree);
+			int secondResult = cache.findSubTree(mainTree.get(), sameSearchedTree.get(), secondDeltaTree);
+
+			Assert::IsTrue(firstResult == secondResult);
+			Assert::IsTrue(compareTrees(firstDeltaTree.get(), secondDeltaTree.get()));
+			Assert::IsTrue(cache.getHits() == 1);
+			Assert::IsTrue(cache.getMisses() == 1);
+		}
+		TEST_METHOD(MutationInvalidates)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2))", delimiters);
+			auto searchedTree = parseOnTree("1(2 3)", delimiters);
+			SearchCache cache(4);
+
+			unique_ptr<Node> realDeltaTree;
+			Assert::IsTrue(cache.findSubTree(mainTree.get(), searchedTree.get(), realDeltaTree) == 1);
+			mainTree->getChild(0)->addChild("3");
+			Assert::IsTrue(cache.findSubTree(mainTree.get(), searchedTree.get(), realDeltaTree) == 0);
+
+			Assert::IsTrue(realDeltaTree == nullptr);
+			Assert::IsTrue(cache.getHits() == 0);
+			Assert::IsTrue(cache.getInvalidations() == 1);
+		}
+		TEST_METHOD(LeastRecentlyUsedIsEvicted)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2) 3(4))", delimiters);
+			auto first = parseOnTree("1(2)", delimiters);
+			auto second = parseOnTree("3(4)", delimiters);
+			auto third = parseOnTree("1(5)", delimiters);
+			SearchCache cache(2);
+
+			unique_ptr<Node> realDeltaTree;
+			cache.findSubTree(mainTree.get(), first.get(), realDeltaTree);
+			cache.findSubTree(mainTree.get(), second.get(), realDeltaTree);
+			cache.findSubTree(mainTree.get(), first.get(), realDeltaTree);
+			cache.findSubTree(mainTree.get(), third.get(), realDeltaTree);
+			cache.findSubTree(mainTree.get(), first.get(), realDeltaTree);
+			cache.findSubTree(mainTree.get(), second.get(), realDeltaTree);
+
+			Assert::IsTrue(cache.size() == 2);
+			Assert::IsTrue(cache.getHits() == 2);
+			Assert::IsTrue(cache.getEvictions() == 2);
+		}
+	};
+
+	TEST_CLASS(searchStatsTests)
+	{
+		TEST_METHOD(CountersFollowSearch)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2) 1(2 3))", delimiters);
+			auto searchedTree = parseOnTree("1(2 3)", delimiters);
+			unique_ptr<Node> realDeltaTree;
+
+			SearchStats::reset();
+			SearchStats::enable(true);
+			mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+			SearchStats::enable(false);
+
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::CandidatesEvaluated) == 2);
+			// Patch-граф строится только для лучшего кандидата: два ребёнка и корень
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::ConnectionsCreated) == 3);
+			Assert::IsTrue(SearchStats::getCalls(StatsPhase::PatchBuilding) == 2);
+			Assert::IsTrue(SearchStats::getCalls(StatsPhase::CandidateLookup) == 1);
+		}
+		TEST_METHOD(NodeMemoryIsAccounted)
+		{
+			SearchStats::enable(true);
+			uint64_t liveBefore = SearchStats::getLiveBytes(StatsStructure::Nodes);
+			uint64_t allocationsBefore = SearchStats::getAllocations(StatsStructure::Nodes);
+			{
+				auto tree = parseOnTree("0(1(2 3) 4)", "() ");
+				Assert::IsTrue(SearchStats::getAllocations(StatsStructure::Nodes) == allocationsBefore + 5);
+				Assert::IsTrue(SearchStats::getLiveBytes(StatsStructure::Nodes) == liveBefore + 5 * sizeof(Node));
+			}
+
+			Assert::IsTrue(SearchStats::getLiveBytes(StatsStructure::Nodes) == liveBefore);
+			Assert::IsTrue(SearchStats::getLiveBytes(StatsStructure::Lexems) == 0);
+			SearchStats::enable(false);
+		}
+		TEST_METHOD(DisabledStatsSkipMemory)
+		{
+			SearchStats::enable(false);
+			uint64_t allocationsBefore = SearchStats::getAllocations(StatsStructure::Nodes);
+			auto tree = parseOnTree("0(1(2 3) 4)", "() ");
+			Assert::IsTrue(SearchStats::getAllocations(StatsStructure::Nodes) == allocationsBefore);
+
+			// Узлы, созданные до включения сбора, не уводят объём живой памяти ниже нуля
+			SearchStats::enable(true);
+			uint64_t liveBefore = SearchStats::getLiveBytes(StatsStructure::Nodes);
+			tree.reset();
+			Assert::IsTrue(SearchStats::getLiveBytes(StatsStructure::Nodes) <= liveBefore);
+			SearchStats::enable(false);
+		}
+		TEST_METHOD(DisabledStatsStayEmpty)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2))", delimiters);
+			auto searchedTree = parseOnTree("1(2)", delimiters);
+			unique_ptr<Node> realDeltaTree;
+
+			SearchStats::reset();
+			mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::NodesVisited) == 0);
+			Assert::IsTrue(SearchStats::getCalls(StatsPhase::PatchBuilding) == 0);
+		}
+	};
+
+	TEST_CLASS(assignmentTests)
+	{
+		TEST_METHOD(CheapestDistinctColumns)
+		{
+			SparseAssignment assignment(2, 3);
+			assignment.addEdge(0, 0, 1);
+			assignment.addEdge(0, 1, 2);
+			assignment.addEdge(1, 0, 1);
+			assignment.addEdge(1, 2, 5);
+
+			Assert::IsTrue(assignment.solve());
+			Assert::IsTrue(assignment.getColumn(0) == 1);
+			Assert::IsTrue(assignment.getColumn(1) == 0);
+			Assert::IsTrue(assignment.getCost() == 3);
+		}
+		TEST_METHOD(NotEnoughColumns)
+		{
+			SparseAssignment assignment(2, 2);
+			assignment.addEdge(0, 0, 1);
+			assignment.addEdge(1, 0, 1);
+
+			Assert::IsFalse(assignment.solve());
+		}
+		TEST_METHOD(ManyEqualRows)
+		{
+			const int size = 2000;
+			SparseAssignment assignment(size, size);
+			for (int row = 0; row < size; row++) {
+				for (int col = 0; col < 3; col++)
+					assignment.addEdge(row, (row + col) % size, 1);
+			}
+
+			Assert::IsTrue(assignment.solve());
+			Assert::IsTrue(assignment.getCost() == size);
+		}
+		TEST_METHOD(SimmilarNamedSiblingsAreNotShared)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3) 2))", delimiters);
+			auto searchedTree = parseOnTree("1(2(3 4) 2(3))", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+
+			Assert::IsTrue(result == 2);
+			Assert::IsTrue(realDeltaTree.get() != nullptr);
+		}
+		TEST_METHOD(OptimalAssignmentDeltaTree)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3) 2(4)))", delimiters);
+			auto searchedTree = parseOnTree("1(2(3 4) 2(4 5 6))", delimiters);
+			auto desiredDeltaTree = parseOnTree("0(1(2(4) 2(5 6)))", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+
+			Assert::IsTrue(result == 3);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), desiredDeltaTree.get()));
+		}
+	};
+
+	TEST_CLASS(patchCoverageTests)
+	{
+		TEST_METHOD(UncaughtChildrenBeyondOneWord)
+		{
+			auto mainNode = make_unique<Node>("0");
+			auto cmpNode = make_unique<Node>("0");
+			for (int i = 0; i < 130; i++)
+				cmpNode->addChild(to_string(i));
+
+			PatchNode patch(mainNode.get());
+			for (int i = 0; i < 130; i++) {
+				if (i == 3 || i == 100)
+					continue;
+				auto patchChild = make_unique<PatchNode>();
+				patchChild->addConnection(0, cmpNode->getChild(i), nullptr, i);
+				patch.addChild(move(patchChild));
+			}
+
+			vector<Node*> uncaught = patch.findUncaughtChildren(cmpNode.get());
+			Assert::IsTrue(uncaught.size() == 2);
+			Assert::IsTrue(uncaught[0]->getName() == "3");
+			Assert::IsTrue(uncaught[1]->getName() == "100");
+		}
+		TEST_METHOD(DeletedReferencesAreHidden)
+		{
+			auto mainNode = make_unique<Node>("0");
+			auto cmpNode = make_unique<Node>("0");
+			Node* first = cmpNode->addChild("1");
+			Node* second = cmpNode->addChild("1");
+
+			PatchNode patch(mainNode.get());
+			for (int i = 0; i < 2; i++) {
+				PatchNode* patchChild = patch.addChild(make_unique<PatchNode>());
+				patchChild->addConnection(0, first, nullptr, 0);
+				patchChild->addConnection(0, second, nullptr, 1);
+			}
+
+			Assert::IsTrue(patch.deleteAllChildReferences(first, 0) == 2);
+			Assert::IsTrue(patch.deleteAllChildReferences(first, 0) == 0);
+			for (PatchNode* patchChild : patch.getChildren()) {
+				Assert::IsTrue(patchChild->getConnections().size() == 1);
+				Assert::IsTrue(patchChild->getConnections()[0].first == second);
+			}
+		}
+		TEST_METHOD(SameNamedSiblingsBuildLinearPatch)
+		{
+			// Все дети одноимённы, поэтому все пары детей оцениваются, но patch-деревья строятся только для выбранных пар
+			const int siblingsCount = 1000;
+			string mainText = "a(", searchedText = "a(", deltaText = "a(";
+			for (int i = 0; i < siblingsCount; i++) {
+				mainText += " r(k" + to_string(i) + ")";
+				searchedText += " r(k" + to_string(i) + " v)";
+				deltaText += " r(v)";
+			}
+			auto mainTree = parseOnTree(mainText + ")", "() ");
+			auto searchedTree = parseOnTree(searchedText + ")", "() ");
+
+			SearchStats::reset();
+			SearchStats::enable(true);
+			unique_ptr<Node> realDeltaTree;
+			int delta = mainTree->buildDeltaTreeWrap(searchedTree.get(), realDeltaTree);
+			SearchStats::enable(false);
+
+			Assert::IsTrue(delta == siblingsCount);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), parseOnTree(deltaText + ")", "() ").get()));
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::PatchNodesAllocated) <= 3 * siblingsCount + 1);
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::ConnectionsCreated) <= 2 * siblingsCount + 1);
+		}
+	};
+
+	struct StaticOne { static constexpr string_view label = "1"; };
+	struct StaticTwo { static constexpr string_view label = "2"; };
+	struct StaticThree { static constexpr string_view label = "3"; };
+	struct StaticFour { static constexpr string_view label = "4"; };
+	struct StaticFive { static constexpr string_view label = "5"; };
+	struct StaticTwoId { static constexpr uint32_t label = 2; };
+	struct StaticThreeId { static constexpr uint32_t label = 3; };
+
+	TEST_CLASS(staticPatternTests)
+	{
+		// 1(2(3 4) 2(5) 3)
+		using Pattern = StaticPattern<StaticOne,
+			StaticPattern<StaticTwo, StaticPattern<StaticThree>, StaticPattern<StaticFour>>,
+			StaticPattern<StaticTwo, StaticPattern<StaticFive>>,
+			StaticPattern<StaticThree>>;
+
+		TEST_METHOD(DescriptionIsConstant)
+		{
+			static_assert(Pattern::childrenCount == 3);
+			static_assert(Pattern::descendants == 6);
+			auto searchedTree = Pattern::materialize<TextLabel>();
+			Assert::IsTrue(compareTrees(searchedTree.get(), parseOnTree("1(2(3 4) 2(5) 3)", "() ").get()));
+		}
+		TEST_METHOD(SameResultsAsGenericSearch)
+		{
+			string delimiters = "() ";
+			auto searchedTree = Pattern::materialize<TextLabel>();
+			for (string mainText : { "0(1(2(3 4) 2(5) 3) 1(2 3))", "0(1(2(4) 2 2(5)) 6(1(3 2(3 4))))", "1(2(3 6))", "0(1(3 3) 1)", "7", "0(1)" }) {
+				auto mainTree = parseOnTree(mainText, delimiters);
+				for (MatchPolicy policy : { MatchPolicy::Unordered, MatchPolicy::OrderedSubsequence, MatchPolicy::OrderedExact }) {
+					unique_ptr<Node> expectedDeltaTree, deltaTree;
+					int expected = mainTree->findSubTree(searchedTree.get(), expectedDeltaTree, policy);
+					Assert::IsTrue(Pattern::findSubTree(mainTree.get(), deltaTree, policy) == expected);
+					Assert::IsTrue(compareTrees(deltaTree.get(), expectedDeltaTree.get()));
+					Assert::IsTrue(Pattern::countMissingNodes(mainTree.get(), policy) == expected);
+				}
+			}
+		}
+		TEST_METHOD(IntegerLabels)
+		{
+			using IdPattern = StaticPattern<StaticTwoId, StaticPattern<StaticThreeId>>;
+			auto mainTree = make_unique<IdNode>(1u);
+			auto candidate = make_unique<IdNode>(2u);
+			candidate->addChild(make_unique<IdNode>(3u));
+			mainTree->addChild(make_unique<IdNode>(2u));
+			mainTree->addChild(move(candidate));
+
+			Assert::IsTrue(IdPattern::countMissingNodes(mainTree.get()) == 0);
+			Assert::IsTrue(IdPattern::countMissingNodes(mainTree.get(), MatchPolicy::OrderedExact) == 0);
+		}
+	};
+
+	TEST_CLASS(compactTreeTests)
+	{
+		TEST_METHOD(CopyKeepsStructureAndResults)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3) 2(4)) 5(1(2(3 4)) 1(7)))", delimiters);
+			CompactTree compactTree(mainTree.get());
+			Assert::IsTrue(compareTrees(compactTree.getRoot(), mainTree.get()));
+
+			for (string searchedText : { "1(2(3 4) 2(4 5))", "2(3 4)", "5(1(7 8))" }) {
+				auto searchedTree = parseOnTree(searchedText, delimiters);
+				unique_ptr<Node> expectedDeltaTree, deltaTree;
+				int expected = mainTree->findSubTree(searchedTree.get(), expectedDeltaTree);
+				Assert::IsTrue(compactTree.getRoot()->findSubTree(searchedTree.get(), deltaTree) == expected);
+				Assert::IsTrue(compareTrees(deltaTree.get(), expectedDeltaTree.get()));
+			}
+		}
+		TEST_METHOD(ChildrenAreContiguous)
+		{
+			auto mainTree = parseOnTree("0(1(2 3 4) 5(6 7) 8)", "() ");
+			CompactTree compactTree(mainTree.get());
+
+			vector<const Node*> nodes = { compactTree.getRoot() };
+			while (!nodes.empty()) {
+				const Node* node = nodes.back();
+				nodes.pop_back();
+				auto children = node->getChildrenView();
+				for (size_t i = 1; i < children.size(); i++)
+					Assert::IsTrue(children[i] == children[i - 1] + 1);
+				for (auto child : children) {
+					Assert::IsTrue(child->getParent() == node);
+					nodes.push_back(child);
+				}
+			}
+			Assert::IsTrue(compactTree.getCapacity() >= 9 * sizeof(Node));
+		}
+	};
+
+	TEST_CLASS(treeSnapshotTests)
+	{
+		TEST_METHOD(CopySharesAllNodes)
+		{
+			auto mainTree = parseOnTree("0(1(2 3) 4(5(6)) 7)", "() ");
+			TreeSnapshot snapshot(mainTree.get());
+			TreeSnapshot snapshotCopy = snapshot.copy();
+
+			Assert::IsTrue(snapshotCopy.getRoot() == snapshot.getRoot());
+			Assert::IsTrue(snapshotCopy.getRevision() == snapshot.getRevision());
+			Assert::IsTrue(compareTrees(snapshotCopy.toTree().get(), mainTree.get()));
+		}
+		TEST_METHOD(EditCopiesOnlyPathToRoot)
+		{
+			auto mainTree = parseOnTree("0(1(2 3) 4(5(6)) 7)", "() ");
+			TreeSnapshot snapshot(mainTree.get());
+			TreeSnapshot edited = snapshot.copy();
+			Assert::IsTrue(edited.addChild({ 1, 0 }, LabelTraits<TextLabel>::make("8")));
+
+			// Исходный снимок не изменился
+			Assert::IsTrue(compareTrees(snapshot.toTree().get(), mainTree.get()));
+			auto expectedTree = parseOnTree("0(1(2 3) 4(5(6 8)) 7)", "() ");
+			Assert::IsTrue(compareTrees(edited.toTree().get(), expectedTree.get()));
+
+			// Узлы пути скопированы и получили новый номер изменения, остальные - общие
+			for (TreeSnapshot::Position position : { TreeSnapshot::Position{}, { 1 }, { 1, 0 } }) {
+				Assert::IsTrue(edited.getNode(position) != snapshot.getNode(position));
+				Assert::IsTrue(edited.getRevision(position) != snapshot.getRevision(position));
+			}
+			for (TreeSnapshot::Position position : { TreeSnapshot::Position{ 0 }, { 1, 0, 0 }, { 2 } }) {
+				Assert::IsTrue(edited.getNode(position) == snapshot.getNode(position));
+				Assert::IsTrue(edited.getRevision(position) == snapshot.getRevision(position));
+			}
+		}
+		TEST_METHOD(EditsMatchTreeEdits)
+		{
+			auto mainTree = parseOnTree("0(1(2 3) 4(5(6)) 7)", "() ");
+			TreeSnapshot snapshot(mainTree.get());
+
+			auto inserted = parseOnTree("9(10)", "() ");
+			mainTree->insertDescendant(mainTree->getChild(1)->getChild(0), inserted);
+			Assert::IsTrue(snapshot.insertDescendant({ 1, 0 }, TreeSnapshot(parseOnTree("9(10)", "() ").get())));
+			mainTree->getChild(0)->removeChild(mainTree->getChild(0)->getChild(0));
+			Assert::IsTrue(snapshot.removeChild({ 0, 0 }));
+			mainTree->addChild("11");
+			Assert::IsTrue(snapshot.addChild({}, LabelTraits<TextLabel>::make("11")));
+			Assert::IsTrue(compareTrees(snapshot.toTree().get(), mainTree.get()));
+
+			// Корень и отсутствующие позиции не изменяются
+			unsigned long long revision = snapshot.getRevision();
+			Assert::IsFalse(snapshot.removeChild({}));
+			Assert::IsFalse(snapshot.removeChild({ 0, 5 }));
+			Assert::IsFalse(snapshot.addChild({ 7 }, LabelTraits<TextLabel>::make("12")));
+			Assert::IsFalse(snapshot.insertDescendant({}, snapshot));
+			Assert::IsTrue(snapshot.getRevision() == revision);
+			Assert::IsTrue(compareTrees(snapshot.toTree().get(), mainTree.get()));
+		}
+		TEST_METHOD(ParentAndContainsFollowPosition)
+		{
+			TreeSnapshot snapshot(parseOnTree("0(1 2)", "() ").get());
+			TreeSnapshot shared(parseOnTree("3(4)", "() ").get());
+			Assert::IsTrue(snapshot.addChild({ 0 }, shared));
+			Assert::IsTrue(snapshot.addChild({ 1 }, shared));
+
+			// Один и тот же узел стоит под разными родителями
+			Assert::IsTrue(snapshot.getNode({ 0, 0 }) == snapshot.getNode({ 1, 0 }));
+			Assert::IsTrue(snapshot.getParent({ 0, 0 }) == snapshot.getNode({ 0 }));
+			Assert::IsTrue(snapshot.getParent({ 1, 0 }) == snapshot.getNode({ 1 }));
+			Assert::IsTrue(snapshot.getParent({}) == nullptr);
+			Assert::IsTrue(snapshot.contains({ 0 }, { 0, 0, 0 }));
+			Assert::IsFalse(snapshot.contains({ 1 }, { 0, 0, 0 }));
+			Assert::IsFalse(snapshot.contains({ 0 }, { 0, 1 }));
+
+			// Изменение одного места не затрагивает другое
+			Assert::IsTrue(snapshot.removeChild({ 1, 0, 0 }));
+			auto expectedTree = parseOnTree("0(1(3(4)) 2(3))", "() ");
+			Assert::IsTrue(compareTrees(snapshot.toTree().get(), expectedTree.get()));
+			Assert::IsTrue(compareTrees(shared.toTree().get(), parseOnTree("3(4)", "() ").get()));
+			Assert::IsTrue(compareTrees(snapshot.subtree({ 0, 0 }).toTree().get(), shared.toTree().get()));
+		}
+	};
+
+	TEST_CLASS(lazyEvaluationTests)
+	{
+		TEST_METHOD(CountMatchesDeltaSearch)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2 2(5) 3) 1(2 3(4 4)) 6(1(2)))", delimiters);
+			vector<string> searchedTrees = { "1(2 3)", "1(2(5) 2 3(4))", "1(3 3)", "7", "1(2 4)" };
+			for (MatchPolicy policy : { MatchPolicy::Unordered, MatchPolicy::OrderedSubsequence, MatchPolicy::OrderedExact }) {
+				for (const auto& text : searchedTrees) {
+					auto searchedTree = parseOnTree(text, delimiters);
+					unique_ptr<Node> realDeltaTree;
+					int delta = mainTree->findSubTree(searchedTree.get(), realDeltaTree, policy);
+					Assert::IsTrue(mainTree->countMissingNodes(searchedTree.get(), policy) == delta);
+				}
+			}
+		}
+		TEST_METHOD(CountBuildsNoPatchNodes)
+		{
+			auto mainTree = parseOnTree("0(1(2) 1(2 3))", "() ");
+			auto searchedTree = parseOnTree("1(2 3 4)", "() ");
+
+			SearchStats::reset();
+			SearchStats::enable(true);
+			int delta = mainTree->countMissingNodes(searchedTree.get());
+			SearchStats::enable(false);
+
+			Assert::IsTrue(delta == 1);
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::PatchNodesAllocated) == 0);
+			Assert::IsTrue(SearchStats::getCounter(StatsCounter::ConnectionsCreated) == 0);
+		}
+	};
+
+	TEST_CLASS(patchArenaTests)
+	{
+		TEST_METHOD(ResetReusesMemory)
+		{
+			PatchArena arena(1024);
+			void* first = arena.allocate(100, 8);
+			void* second = arena.allocate(5000, 8);
+			size_t capacity = arena.getCapacity();
+
+			Assert::IsTrue(arena.owns(first));
+			Assert::IsTrue(arena.owns(second));
+			arena.reset();
+			Assert::IsTrue(arena.allocate(100, 8) == first);
+			Assert::IsTrue(arena.getCapacity() == capacity);
+		}
+		TEST_METHOD(PatchNodesLiveInCurrentArena)
+		{
+			auto mainNode = make_unique<Node>("0");
+			PatchArena arena;
+			{
+				PatchArena::Scope scope(arena);
+				auto patch = make_unique<PatchNode>(mainNode.get());
+				PatchNode* child = patch->addChild(make_unique<PatchNode>());
+				child->addConnection(0, mainNode.get());
+
+				Assert::IsTrue(arena.owns(patch.get()));
+				Assert::IsTrue(arena.owns(child));
+			}
+			auto heapPatch = make_unique<PatchNode>(mainNode.get());
+			Assert::IsFalse(arena.owns(heapPatch.get()));
+		}
+	};
+
 	TEST_CLASS(copyTests)
 	{
 		TEST_METHOD(SmallTree)
@@ -804,6 +2062,175 @@ namespace testsNode
 
 	};
 
+	TEST_CLASS(parentLinkTests)
+	{
+		TEST_METHOD(ContainsWithAndWithoutNumbering)
+		{
+			string delimiters = "() ";
+			auto tree = parseOnTree("0(1(2 3) 4(5))", delimiters);
+			Node* first = tree->getChild(0);
+			Node* deep = first->getChild(1);
+			Node* other = tree->getChild(1)->getChild(0);
+
+			Assert::IsTrue(tree->contains(deep));
+			Assert::IsTrue(first->contains(deep));
+			Assert::IsFalse(first->contains(other));
+
+			tree->numberIntervals();
+			Node* added = deep->addChild("6");
+			Assert::IsTrue(first->contains(deep));
+			Assert::IsFalse(first->contains(other));
+			Assert::IsTrue(first->contains(added));
+			Assert::IsFalse(deep->contains(first));
+		}
+		TEST_METHOD(PathFromRoot)
+		{
+			string delimiters = "() ";
+			auto tree = parseOnTree("0(1(2 3) 4(5))", delimiters);
+			Node* deep = tree->getChild(1)->getChild(0);
+
+			vector<const Node*> path = deep->pathFromRoot();
+			Assert::IsTrue(path.size() == 3);
+			Assert::IsTrue(path[0] == tree.get());
+			Assert::IsTrue(path[2] == deep);
+			Assert::IsTrue(deep->getParent()->getName() == "4");
+		}
+		TEST_METHOD(RootMatchKeepsDeltaTree)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("1(2)", delimiters);
+			auto searchedTree = parseOnTree("1(2 3(4))", delimiters);
+			auto desiredDeltaTree = parseOnTree("1(3(4))", delimiters);
+
+			unique_ptr<Node> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+
+			Assert::IsTrue(result == 2);
+			Assert::IsTrue(compareTrees(realDeltaTree.get(), desiredDeltaTree.get()));
+		}
+	};
+
+	TEST_CLASS(labelStorageTests)
+	{
+		TEST_METHOD(LabelsPointIntoInputBuffer)
+		{
+			auto content = make_shared<const string>("root(first(leaf) second)");
+			auto tree = parseOnTree(content, "() ");
+			string_view label = tree->getChild(0)->getLabel();
+
+			Assert::IsTrue(label == "first");
+			Assert::IsTrue(label.data() >= content->data() && label.data() < content->data() + content->size());
+		}
+		TEST_METHOD(TreeOutlivesInputText)
+		{
+			unique_ptr<Node> copied;
+			{
+				string content = "root(first(leaf) second)";
+				auto tree = parseOnTree(content, "() ");
+				content.assign(content.size(), 'x');
+				copied = tree->copy();
+			}
+
+			Assert::IsTrue(copied->getName() == "root");
+			Assert::IsTrue(copied->getChild(0)->getChild(0)->getLabel() == "leaf");
+		}
+		TEST_METHOD(ChildrenViewMatchesChildren)
+		{
+			auto tree = parseOnTree("root(first second third)", "() ");
+			auto view = tree->getChildrenView();
+			auto children = tree->getChildren();
+
+			Assert::IsTrue(view.size() == children.size());
+			size_t i = 0;
+			for (Node* child : view) {
+				Assert::IsTrue(child == children[i]);
+				Assert::IsTrue(view[i] == children[i]);
+				i++;
+			}
+		}
+		TEST_METHOD(ConnectionsViewSkipsRemoved)
+		{
+			auto mainNode = make_unique<Node>("0");
+			auto cmpNode = make_unique<Node>("0");
+			Node* first = cmpNode->addChild("1");
+			Node* second = cmpNode->addChild("1");
+
+			PatchNode patch(mainNode.get());
+			PatchNode* patchChild = patch.addChild(make_unique<PatchNode>());
+			patchChild->addConnection(3, first, nullptr, 0);
+			patchChild->addConnection(5, second, nullptr, 1);
+			patch.deleteAllChildReferences(first, 0);
+
+			auto connections = patchChild->getConnectionsView();
+			Assert::IsTrue(connections.size() == 1);
+			Assert::IsTrue(connections.front().target == second);
+			Assert::IsTrue(connections.front().weight == 5);
+			Assert::IsTrue(patch.getChildrenView()[0] == patchChild);
+		}
+	};
+
+	TEST_CLASS(labelTypeTests)
+	{
+		TEST_METHOD(IntegerLabelsFindSubTree)
+		{
+			auto mainTree = make_unique<IdNode>(0u);
+			IdNode* first = mainTree->addChild(1u);
+			first->addChild(2u);
+			auto searchedTree = make_unique<IdNode>(1u);
+			searchedTree->addChild(2u);
+			searchedTree->addChild(3u)->addChild(4u);
+
+			unique_ptr<IdNode> realDeltaTree;
+			int result = mainTree->findSubTree(searchedTree.get(), realDeltaTree);
+
+			Assert::IsTrue(result == 2);
+			Assert::IsTrue(realDeltaTree->getLabel() == 0u);
+			Assert::IsTrue(realDeltaTree->getChild(0)->getChild(0)->getName() == "3");
+		}
+		TEST_METHOD(InternedLabelsShareStorage)
+		{
+			InternedLabel first("some/long/path/to/a/type");
+			InternedLabel second(string("some/long/path/to/a/") + "type");
+
+			Assert::IsTrue(first == second);
+			Assert::IsTrue(&first.str() == &second.str());
+		}
+		TEST_METHOD(ConcurrentInterningSharesStorage)
+		{
+			// Потоки одновременно интернируют одни и те же строки и должны получить одинаковые метки
+			const int threadsCount = 4, labelsCount = 200;
+			vector<vector<InternedLabel>> labels(threadsCount);
+			vector<thread> workers;
+			for (int worker = 0; worker < threadsCount; worker++) {
+				workers.emplace_back([&labels, worker] {
+					for (int i = 0; i < labelsCount; i++)
+						labels[worker].emplace_back("concurrent/" + to_string(i));
+				});
+			}
+			for (auto& worker : workers)
+				worker.join();
+
+			for (int worker = 1; worker < threadsCount; worker++) {
+				for (int i = 0; i < labelsCount; i++)
+					Assert::IsTrue(labels[worker][i] == labels[0][i]);
+			}
+		}
+		TEST_METHOD(ConvertedTreeGivesSameResult)
+		{
+			string delimiters = "() ";
+			auto mainTree = parseOnTree("0(1(2(3) 2(4)))", delimiters);
+			auto searchedTree = parseOnTree("1(2(3 4) 2(4 5 6))", delimiters);
+
+			unique_ptr<Node> textDeltaTree;
+			unique_ptr<InternedNode> internedDeltaTree;
+			int textResult = mainTree->findSubTree(searchedTree.get(), textDeltaTree);
+			int internedResult = convertTree<InternedLabel>(mainTree.get())->findSubTree(convertTree<InternedLabel>(searchedTree.get()).get(), internedDeltaTree);
+
+			Assert::IsTrue(textResult == internedResult);
+			Assert::IsTrue(textDeltaTree->descendantsCount() == internedDeltaTree->descendantsCount());
+		}
+	};
+
 	TEST_CLASS(descendantsCountTests)
 	{
 		TEST_METHOD(NoDescendants)
@@ -833,6 +2260,65 @@ namespace testsNode
 		}
 	};
 
+	TEST_CLASS(findChildrenNamedTests)
+	{
+		TEST_METHOD(SimmilarNamedInOrder)
+		{
+			auto tractor = make_unique<Node>("tractor");
+			auto firstWheel = tractor->addChild("Wheel");
+			auto cabin = tractor->addChild("Cabin");
+			auto secondWheel = tractor->addChild("Wheel");
+
+			auto found = tractor->findChildrenNamed("Wheel");
+			auto children = tractor->getChildren();
+
+			Assert::IsTrue(found.second - found.first == 2);
+			Assert::IsTrue(children[*found.first] == firstWheel);
+			Assert::IsTrue(children[*(found.first + 1)] == secondWheel);
+		}
+		TEST_METHOD(NoSuchChild)
+		{
+			auto tractor = make_unique<Node>("tractor");
+			tractor->addChild("Wheel");
+
+			auto found = tractor->findChildrenNamed("Cabin");
+
+			Assert::IsTrue(found.first == found.second);
+		}
+		TEST_METHOD(IndexFollowsChanges)
+		{
+			auto tractor = make_unique<Node>("tractor");
+			auto firstWheel = tractor->addChild("Wheel");
+			tractor->findChildrenNamed("Wheel");
+			tractor->addChild("Cabin");
+			tractor->removeChild(firstWheel);
+
+			auto found = tractor->findChildrenNamed("Cabin");
+
+			Assert::IsTrue(found.second - found.first == 1);
+			Assert::IsTrue(tractor->findChildrenNamed("Wheel").first == tractor->findChildrenNamed("Wheel").second);
+		}
+		TEST_METHOD(IndexIsReadyWithoutLookup)
+		{
+			auto tree = parseOnTree("0(c a b a)", "() ");
+			auto copy = tree->copy();
+			auto removed = copy->getChild(0);
+			copy->removeChild(removed);
+			copy->addChild("c");
+
+			// Поиск не меняет индекс: он уже упорядочен после разбора, копирования и изменений
+			for (const Node* node : { (const Node*)tree.get(), (const Node*)copy.get() }) {
+				auto found = node->findChildrenNamed("a");
+				Assert::IsTrue(found.second - found.first == 2);
+				Assert::IsTrue(*found.first < *(found.first + 1));
+				for (auto it = found.first; it != found.second; ++it)
+					Assert::IsTrue(node->getChild(*it)->getName() == "a");
+				Assert::IsTrue(node->findChildrenNamed("c").second - node->findChildrenNamed("c").first == 1);
+			}
+			Assert::IsTrue(copy->getChild(*copy->findChildrenNamed("c").first)->getParent() == copy.get());
+		}
+	};
+
 	TEST_CLASS(findDescendants)
 	{
 		TEST_METHOD(NoDescendants)
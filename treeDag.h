@@ -0,0 +1,82 @@
+#pragma once
+#include "findSubTree.h"
+#include <unordered_map>
+#include <cstdint>
+
+
+// Главное дерево, в котором структурно одинаковые поддеревья хранятся один раз (хеш-консинг).
+// Узел DAG - класс одинаковых поддеревьев; вхождения класса в дерево различаются путями от корня.
+// В один DAG можно сложить несколько деревьев, корнем считается последнее из них
+template <class Label>
+class BasicTreeDag {
+public:
+	using TreeNode = BasicNode<Label>;
+	using LabelView = typename LabelTraits<Label>::View;
+	// Путь от корня дерева: номера детей на каждом уровне
+	using Location = vector<unsigned>;
+
+	BasicTreeDag();
+	explicit BasicTreeDag(const TreeNode* tree);
+	unsigned addTree(const TreeNode* tree, unordered_map<const TreeNode*, unsigned>* classes = nullptr);
+	void openNode(const Label& label);
+	void closeNode();
+	bool isEmpty() const;
+	unsigned getRoot() const;
+	size_t size() const;
+	unsigned long long getTreeSize() const;
+	LabelView getLabel(unsigned id) const;
+	pair<vector<unsigned>::const_iterator, vector<unsigned>::const_iterator> getChildren(unsigned id) const;
+	unique_ptr<TreeNode> materialize(unsigned id) const;
+	vector<Location> findOccurrences(unsigned id) const;
+	int countMissingNodes(const TreeNode* cmpTree, MatchPolicy policy = MatchPolicy::Unordered) const;
+	int findSubTree(const TreeNode* cmpTree, unique_ptr<TreeNode>& deltaTree, vector<Location>& locations, MatchPolicy policy = MatchPolicy::Unordered) const;
+private:
+	// Класс одинаковых поддеревьев: метка, дети (по номерам классов) и размер развёрнутого поддерева
+	struct DagNode
+	{
+		Label label;
+		unsigned firstChild;
+		unsigned childrenCount;
+		unsigned long long treeSize;
+	};
+	// Открытый при построении узел: метка и начало его детей в стеке готовых детей
+	struct OpenNode
+	{
+		Label label;
+		size_t firstChild;
+	};
+	// Пара (класс, узел искомого дерева), вес которой запоминается при оценке кандидатов
+	struct MemoKey
+	{
+		unsigned id;
+		const TreeNode* cmpNode;
+		bool operator==(const MemoKey& other) const;
+	};
+	struct MemoKeyHash
+	{
+		size_t operator()(const MemoKey& key) const;
+	};
+	using WeightMemo = unordered_map<MemoKey, int, MemoKeyHash>;
+
+	unsigned intern(const Label& label, size_t firstChild);
+	vector<bool> reachableClasses() const;
+	vector<int> evaluateCandidates(const TreeNode* cmpTree, MatchPolicy policy) const;
+	template <MatchPolicy policy>
+	int evaluateClass(unsigned id, const TreeNode* cmpTree, WeightMemo& memo) const;
+	template <MatchPolicy policy>
+	int evaluateConnection(unsigned id, const TreeNode* cmpChild, WeightMemo& memo) const;
+	vector<Location> collectOccurrences(const vector<bool>& targets) const;
+
+	vector<DagNode> nodes;
+	// Дети всех классов подряд
+	vector<unsigned> childIds;
+	// Классы по хешу метки и детей
+	unordered_multimap<uint64_t, unsigned> idsByHash;
+	vector<OpenNode> openNodes;
+	vector<unsigned> closedChildren;
+	unsigned root;
+};
+
+using TreeDag = BasicTreeDag<TextLabel>;
+
+TreeDag parseOnDag(shared_ptr<const string> content, const string& delimiters);
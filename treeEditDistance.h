@@ -0,0 +1,45 @@
+#pragma once
+#include "findSubTree.h"
+#include <unordered_map>
+#include <deque>
+#include <type_traits>
+
+
+// Способ оценки близости найденного поддерева к искомому дереву
+enum class SearchMetric
+{
+	MissingNodes, MissingCount, EditDistance
+};
+
+// Словарь, переводящий имена узлов в целые числа для быстрого сравнения
+class LabelDictionary {
+public:
+	int add(string_view label);
+	int find(string_view label) const;
+private:
+	// Ключи указывают на строки names, которые не перемещаются при пополнении словаря
+	deque<string> names;
+	unordered_map<string_view, int> ids;
+};
+
+// Дерево, разложенное в массивы обратного (postorder) порядка обхода
+class PostorderTree {
+public:
+	PostorderTree(const Node* root, LabelDictionary& dictionary);
+	PostorderTree(const Node* root, const LabelDictionary& dictionary);
+	int size() const;
+	int labelAt(int index) const;
+	int leftmostLeafAt(int index) const;
+	const vector<int>& getKeyroots() const;
+private:
+	template <class Dictionary>
+	void build(const Node* root, Dictionary& dictionary);
+	vector<int> labels;
+	vector<int> leftmostLeaves;
+	vector<int> keyroots;
+};
+
+int treeEditDistance(const PostorderTree& tree1, const PostorderTree& tree2);
+int treeEditDistance(const Node* tree1, const Node* tree2);
+int findClosestSubTree(const Node* mainTree, const Node* cmpTree, const Node** closestTree);
+bool parseSearchMetric(const string& note, SearchMetric& metric);
@@ -0,0 +1,68 @@
+#pragma once
+#include "findSubTree.h"
+#include <cstdint>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+
+
+// Главное дерево, разложенное в файле для поиска без загрузки дерева целиком.
+// Узлы записаны в прямом порядке обхода, поэтому любое поддерево занимает непрерывный отрезок файла;
+// для каждой метки хранится список номеров её узлов. При поиске читаются только кандидаты с меткой корня
+// искомого дерева и лишь на глубину искомого дерева, а в памяти одновременно находится один кандидат
+class TreeLayout {
+public:
+	static bool build(istream& in, const string& layoutPath, const string& delimiters, string& error, size_t memoryBudget = DEFAULT_MEMORY_BUDGET);
+	TreeLayout();
+	bool open(const string& layoutPath);
+	bool isOpen() const;
+	uint64_t size() const;
+	size_t getLabelsCount() const;
+	void setMemoryBudget(size_t bytes);
+	size_t getSkippedCandidates() const;
+	int countMissingNodes(const Node* cmpTree, MatchPolicy policy = MatchPolicy::Unordered);
+	int findSubTree(const Node* cmpTree, unique_ptr<Node>& deltaTree, MatchPolicy policy = MatchPolicy::Unordered);
+
+	static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+private:
+	// Запись узла в файле: родитель, последний потомок (номер самого узла для листа), метка и число детей
+	struct LayoutNode
+	{
+		uint64_t parent;
+		uint64_t last;
+		uint32_t label;
+		uint32_t childrenCount;
+	};
+	// Ограничения, которым должен удовлетворять кандидат на каждой глубине искомого дерева
+	struct PatternLevel
+	{
+		size_t maxChildren;
+		unordered_set<uint32_t> labels;
+	};
+	enum class LoadResult { Loaded, Impossible, OverBudget };
+	class Writer;
+
+	const LayoutNode& readNode(uint64_t index);
+	bool readPostings(uint32_t label, uint64_t first, vector<uint64_t>& positions);
+	bool findLabel(string_view label, uint32_t& id) const;
+	TextLabel makeLabel(uint32_t id) const;
+	vector<PatternLevel> describePattern(const Node* cmpTree) const;
+	LoadResult loadCandidate(uint64_t position, const vector<PatternLevel>& levels, unique_ptr<Node>& candidate);
+	unique_ptr<Node> loadAncestors(uint64_t position, Node** deepestAncestor);
+	int evaluateCandidates(const Node* cmpTree, MatchPolicy policy, uint64_t& bestPosition);
+
+	ifstream file;
+	uint64_t nodesCount;
+	uint64_t postingsOffset;
+	// Метки хранятся одним буфером, на который ссылаются узлы загруженных кандидатов
+	shared_ptr<const string> labelsText;
+	vector<pair<size_t, size_t>> labelBounds;
+	unordered_map<string_view, uint32_t> labelIds;
+	// Начало и длина списка узлов каждой метки
+	vector<pair<uint64_t, uint64_t>> postings;
+	// Страница записей узлов, прочитанная последней
+	vector<LayoutNode> page;
+	uint64_t pageStart;
+	size_t memoryBudget;
+	size_t skippedCandidates;
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include "findSubTree.h"
+
+
+// Неизменяемый узел снимка дерева. Узлы разделяются между снимками, поэтому не хранят родителя:
+// родитель и принадлежность поддереву определяются снимком по позиции узла
+template <class Label>
+struct BasicSnapshotNode
+{
+	Label label;
+	vector<shared_ptr<const BasicSnapshotNode>> children;
+	// Номер последнего изменения поддерева узла; узлы, скопированные при изменении снимка, получают новый номер
+	unsigned long long revision;
+};
+
+// Снимок главного дерева с общими неизменяемыми поддеревьями.
+// Копия снимка создаётся за O(1), а изменение копирует только узлы на пути от корня до изменяемого узла,
+// поэтому остальные поддеревья остаются общими с другими снимками. Узел в снимке задаётся позицией -
+// номерами детей на пути от корня: один и тот же общий узел может стоять в разных местах разных снимков
+template <class Label>
+class BasicTreeSnapshot {
+public:
+	using TreeNode = BasicNode<Label>;
+	using SnapshotNode = BasicSnapshotNode<Label>;
+	// Позиция узла: номера детей на пути от корня (пустая позиция - корень)
+	using Position = vector<unsigned>;
+
+	BasicTreeSnapshot();
+	explicit BasicTreeSnapshot(const TreeNode* tree);
+	explicit BasicTreeSnapshot(const Label& label);
+	BasicTreeSnapshot copy() const;
+	BasicTreeSnapshot subtree(const Position& position) const;
+	bool empty() const;
+	const SnapshotNode* getRoot() const;
+	const SnapshotNode* getNode(const Position& position) const;
+	const SnapshotNode* getParent(const Position& position) const;
+	bool contains(const Position& ancestor, const Position& position) const;
+	unsigned long long getRevision(const Position& position = Position()) const;
+	bool addChild(const Position& parent, const Label& newChildLabel);
+	bool addChild(const Position& parent, const BasicTreeSnapshot& newChild);
+	bool removeChild(const Position& child);
+	bool insertDescendant(const Position& removingChild, const BasicTreeSnapshot& insertingTree);
+	unique_ptr<TreeNode> toTree() const;
+private:
+	template <class Edit>
+	bool copyPath(const Position& position, Edit edit);
+
+	shared_ptr<const SnapshotNode> root;
+};
+
+using TreeSnapshot = BasicTreeSnapshot<TextLabel>;
@@ -0,0 +1,23 @@
+#pragma once
+#include "findSubTree.h"
+
+
+// Чтение последовательности деревьев из одного потока (файла или стандартного ввода).
+// Деревья разбираются по одному, и каждое из них держит в памяти только собственный текст
+class TreeStreamReader {
+public:
+	TreeStreamReader(istream& in, const string& delimiters);
+	unique_ptr<Node> next();
+	bool isFinished() const;
+	size_t getTreesRead() const;
+private:
+	int readChar();
+	bool isDelimiter(int symbol) const;
+
+	istream& in;
+	string delimiters;
+	// Символ, прочитанный из потока, но относящийся к следующему дереву
+	int pendingChar;
+	bool finished;
+	size_t treesRead;
+};